@@ -0,0 +1,137 @@
+/**************************************************************************
+* @ file    : conn_walk.c
+* @ author  : qinhj@lsec.cc.ac.cn
+* @ date    : 2026.10.17
+* @ brief   : poll loop cost per connection it visits, idle and ready ones
+* -------------------------------------------------------------------------
+* Note:
+* 1. Connections are placed at random heap addresses, as on a server that
+* has been up for a while, so every visit is a likely cache miss.
+* 2. "poll set": none of them has MG_F_NO_POLL, so mg_mgr_poll() walks all
+* of them for MG_EV_POLL, each time.
+* 3. "ready K": all have MG_F_NO_POLL (as src/server.c sets), K of them have
+* a socket with one byte to read per round. With epoll the loop visits only
+* those, so a round should cost in proportion to K, not to the number of
+* connections. A round polls until all K bytes are read: epoll hands out
+* MG_EPOLL_MAX_EVENTS per poll.
+* 4. select() still walks every connection to build its fd sets; its ready
+* sockets must fit in FD_SETSIZE.
+***************************************************************************/
+
+#include "mongoose.c"
+
+static unsigned long s_recvs = 0;
+
+static void walk_handler(struct mg_connection *nc, int ev, void *ev_data) {
+    (void) ev_data;
+    if (ev == MG_EV_RECV) {
+        s_recvs++;
+        mbuf_remove(&nc->recv_mbuf, nc->recv_mbuf.len);
+    }
+}
+
+static double walk_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// @brief:  leave n connection-sized holes all over the heap, in random order
+static void walk_scatter(int n) {
+    void **holes = (void **) malloc(sizeof(void *) * n);
+    int i;
+    for (i = 0; i < n; i++) {
+        holes[i] = malloc(sizeof(struct mg_connection));
+        if (malloc(16) == NULL) exit(1); // guard, keeps holes from merging
+    }
+    for (i = n - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        void *t = holes[i];
+        holes[i] = holes[j];
+        holes[j] = t;
+    }
+    for (i = 0; i < n; i++) free(holes[i]);
+    free(holes);
+}
+
+// @brief:  ns per round with n connections, ready of which get a byte each
+static double walk_run(const struct mg_iface_vtable *iface, int n, int ready,
+                       int no_poll, int rounds) {
+    struct mg_mgr mgr;
+    struct mg_mgr_init_opts opts;
+    int *peers = (int *) malloc(sizeof(int) * (ready + 1)), i, k, num = 0;
+    double t = 0;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.main_iface = iface;
+    mg_mgr_init_opt(&mgr, NULL, opts);
+    walk_scatter(n);
+    for (i = 0; i < n; i++) {
+        sock_t sock = INVALID_SOCKET;
+        struct mg_connection *nc;
+        int sv[2];
+        // spread the ready connections evenly over the others
+        if (num < ready && (long) i * ready / n >= num &&
+            socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0) {
+            sock = sv[0];
+            peers[num++] = sv[1];
+        }
+        nc = mg_add_sock(&mgr, sock, walk_handler);
+        if (no_poll) nc->flags |= MG_F_NO_POLL;
+    }
+    for (k = 0; k < 5; k++) mg_mgr_poll(&mgr, 0);
+    for (k = 0; k < rounds; k++) {
+        double t0;
+        for (i = 0; i < num; i++) {
+            if (write(peers[i], "x", 1) != 1) exit(1);
+        }
+        s_recvs = 0;
+        t0 = walk_now();
+        do {
+            mg_mgr_poll(&mgr, 0);
+        } while (s_recvs < (unsigned long) num);
+        t += walk_now() - t0;
+    }
+    mg_mgr_free(&mgr);
+    for (i = 0; i < num; i++) close(peers[i]);
+    free(peers);
+    return t * 1e9 / rounds;
+}
+
+// usage: conn_walk [connections] [rounds] [epoll|select] [ready]...
+int main(int argc, char *argv[]) {
+    static const int readies[] = {0, 16, 256, 1024};
+    const struct mg_iface_vtable *iface = &mg_epoll_iface_vtable;
+    int n = argc > 1 ? atoi(argv[1]) : 100000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 100;
+    int num = argc > 4 ? argc - 4 : (int) (sizeof(readies) / sizeof(readies[0]));
+    int i, max_ready = n;
+    double t;
+    if (n <= 0) n = 1;
+    if (rounds <= 0) rounds = 1;
+    if (argc > 3 && strcmp(argv[3], "select") == 0) {
+        iface = &mg_socket_iface_vtable;
+        max_ready = (FD_SETSIZE - 16) / 2; // both ends of each socketpair
+    }
+    srand(1);
+    printf("%d connections, %s, struct mg_connection %d bytes\n", n,
+           iface == &mg_epoll_iface_vtable ? "epoll" : "select",
+           (int) sizeof(struct mg_connection));
+    printf("%-12s %12s %16s\n", "visited", "us/round", "ns/connection");
+    t = walk_run(iface, n, 0, 0, rounds);
+    printf("%-12s %12.1f %16.1f\n", "poll set", t / 1e3, t / n);
+    for (i = 0; i < num; i++) {
+        int ready = argc > 4 ? atoi(argv[i + 4]) : readies[i];
+        char name[32];
+        if (ready > n) ready = n;
+        if (ready > max_ready) continue;
+        t = walk_run(iface, n, ready, 1, rounds);
+        snprintf(name, sizeof(name), "ready %d", ready);
+        if (ready > 0) {
+            printf("%-12s %12.1f %16.1f\n", name, t / 1e3, t / ready);
+        } else {
+            printf("%-12s %12.1f %16s\n", name, t / 1e3, "-");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,113 @@
+/**************************************************************************
+* @ file    : ctl_wake.c
+* @ author  : qinhj@lsec.cc.ac.cn
+* @ date    : 2026.10.17
+* @ brief   : mg_post() to a sleeping IO thread, eventfd and socketpair wakeup
+* -------------------------------------------------------------------------
+* Note:
+* 1. mgr->ctl is an eventfd on Linux; without one it is a socketpair. Here
+* eventfd() is wrapped so that it can fail on demand, which makes the same
+* build run both paths.
+* 2. The IO thread sleeps in mg_mgr_poll() with a long timeout, the poster
+* measures from mg_post() until the message is delivered (its free_cb runs).
+* 3. An IO thread that blocks while draining the wakeup never returns from
+* mg_mgr_poll(): the run is then aborted after a few seconds.
+***************************************************************************/
+
+static int s_no_eventfd = 0;
+
+// the same feature set as mongoose.h, it is included once
+#define _XOPEN_SOURCE 600
+#include <sys/eventfd.h>
+#define eventfd(count, flags) (s_no_eventfd ? -1 : eventfd(count, flags))
+
+#include "mongoose.c"
+
+static struct mg_mgr s_mgr;
+static volatile int s_stop = 0;
+static unsigned long s_delivered = 0;
+
+static void wake_handler(struct mg_connection *nc, int ev, void *ev_data) {
+    (void) nc;
+    (void) ev;
+    (void) ev_data;
+}
+
+static void wake_free_cb(void *data) {
+    (void) data;
+    __atomic_add_fetch(&s_delivered, 1, __ATOMIC_RELEASE);
+}
+
+static void wake_stuck(int sig) {
+    (void) sig;
+    fprintf(stderr, "IO thread stuck in mg_mgr_poll()\n");
+    _exit(1);
+}
+
+static void *wake_io_thread(void *arg) {
+    (void) arg;
+    while (!s_stop) mg_mgr_poll(&s_mgr, 10000);
+    return NULL;
+}
+
+static double wake_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// @brief:  us per delivered message, with a fresh manager on iface
+static double wake_run(const struct mg_iface_vtable *iface, int rounds) {
+    struct mg_mgr_init_opts opts;
+    pthread_t io;
+    double t0, t = 0;
+    int i;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.main_iface = iface;
+    mg_mgr_init_opt(&s_mgr, NULL, opts);
+    if (s_mgr.ctl[0] == INVALID_SOCKET ||
+        (s_mgr.ctl[0] != s_mgr.ctl[1]) != s_no_eventfd) {
+        fprintf(stderr, "ctl is not the expected kind\n");
+        exit(1);
+    }
+    s_stop = 0;
+    s_delivered = 0;
+    pthread_create(&io, NULL, wake_io_thread, NULL);
+    alarm(5);
+    for (i = 0; i < rounds; i++) {
+        usleep(200); // let the IO thread go back to sleep
+        t0 = wake_now();
+        if (!mg_post(&s_mgr, 0, wake_handler, NULL, wake_free_cb)) exit(1);
+        while (__atomic_load_n(&s_delivered, __ATOMIC_ACQUIRE) <=
+               (unsigned long) i) {
+            sched_yield();
+        }
+        t += wake_now() - t0;
+    }
+    s_stop = 1;
+    mg_post(&s_mgr, 0, wake_handler, NULL, NULL);
+    pthread_join(io, NULL);
+    alarm(0);
+    mg_mgr_free(&s_mgr);
+    return t * 1e6 / rounds;
+}
+
+// usage: ctl_wake [rounds]
+int main(int argc, char *argv[]) {
+    static const char *names[] = {"eventfd", "socketpair"};
+    int rounds = argc > 1 ? atoi(argv[1]) : 2000;
+    int i;
+    if (rounds <= 0) rounds = 1;
+    signal(SIGALRM, wake_stuck);
+    printf("%d wakeups each\n", rounds);
+    printf("%-12s %12s %12s\n", "ctl", "epoll us", "select us");
+    for (i = 0; i < 2; i++) {
+        double e, s;
+        s_no_eventfd = i;
+        e = wake_run(&mg_epoll_iface_vtable, rounds);
+        s = wake_run(&mg_socket_iface_vtable, rounds);
+        printf("%-12s %12.1f %12.1f\n", names[i], e, s);
+    }
+    return 0;
+}
@@ -0,0 +1,96 @@
+/**************************************************************************
+* @ file    : hdr_drip.c
+* @ author  : qinhj@lsec.cc.ac.cn
+* @ date    : 2026.10.17
+* @ brief   : cost per byte of a request header that arrives one byte per poll
+* -------------------------------------------------------------------------
+* Note:
+* 1. A socketpair stands in for the client, which writes one byte before
+* each mg_mgr_poll(), so every recv brings a single byte of the header.
+* 2. MG_MAX_HTTP_REQUEST_SIZE is raised to 64K here so that large header
+* blocks are accepted (the Linux default is 1K).
+* 3. The write/poll/recv syscalls alone take a few us per byte, so compare
+* sizes with each other: a rescan from the start grows with the size.
+***************************************************************************/
+
+#define MG_MAX_HTTP_REQUEST_SIZE 65536
+#include "mongoose.c"
+
+static int s_handled = 0;
+
+static void drip_handler(struct mg_connection *nc, int ev, void *ev_data) {
+    (void) ev_data;
+    if (ev == MG_EV_HTTP_REQUEST) {
+        s_handled++;
+        mg_printf(nc, "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n");
+    }
+}
+
+// @brief:  build a GET request with filler headers up to about hdr bytes
+static char *drip_request(int hdr, int *len) {
+    char *req = (char *) malloc(hdr + 256);
+    int n = sprintf(req, "GET /x HTTP/1.1\r\nHost: x\r\n");
+    while (n < hdr) {
+        n += sprintf(req + n, "X-Filler-%05d: %s\r\n", n,
+                     "abcdefghijklmnopqrstuvwxyz0123456789");
+    }
+    n += sprintf(req + n, "\r\n");
+    *len = n;
+    return req;
+}
+
+// @brief:  return the seconds taken to drip reqs requests of hdr bytes
+static double drip_run(int hdr, int reqs, int *len) {
+    struct mg_mgr mgr;
+    struct mg_connection *nc;
+    char *req = drip_request(hdr, len), junk[4096];
+    int sv[2], i, k;
+    double t;
+
+    mg_mgr_init(&mgr, NULL);
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        perror("socketpair");
+        exit(1);
+    }
+    nc = mg_add_sock(&mgr, sv[0], drip_handler);
+    nc->listener = nc; // parse requests as a server connection would
+    mg_set_protocol_http_websocket(nc);
+    t = mg_time();
+    for (k = 0; k < reqs; k++) {
+        for (i = 0; i < *len; i++) {
+            if (write(sv[1], req + i, 1) != 1) exit(1);
+            mg_mgr_poll(&mgr, 0);
+        }
+        mg_mgr_poll(&mgr, 0);
+        while (recv(sv[1], junk, sizeof(junk), MSG_DONTWAIT) > 0) continue;
+    }
+    t = mg_time() - t;
+    nc->listener = NULL;
+    mg_mgr_free(&mgr);
+    close(sv[1]);
+    free(req);
+    return t;
+}
+
+// usage: hdr_drip [requests] [header bytes]...
+int main(int argc, char *argv[]) {
+    static const int sizes[] = {1024, 8192, 32768};
+    int reqs = argc > 1 ? atoi(argv[1]) : 3, i, num;
+    if (reqs <= 0) reqs = 1;
+    num = argc > 2 ? argc - 2 : (int) (sizeof(sizes) / sizeof(sizes[0]));
+    printf("%8s %8s %10s %10s\n", "bytes", "requests", "ms", "us/byte");
+    for (i = 0; i < num; i++) {
+        int hdr = argc > 2 ? atoi(argv[i + 2]) : sizes[i], len = 0;
+        double t;
+        s_handled = 0;
+        t = drip_run(hdr, reqs, &len);
+        if (s_handled != reqs) {
+            fprintf(stderr, "%d-byte header: %d of %d requests handled\n",
+                    len, s_handled, reqs);
+            return 1;
+        }
+        printf("%8d %8d %10.1f %10.2f\n", len, reqs, t * 1e3,
+               t * 1e6 / len / reqs);
+    }
+    return 0;
+}
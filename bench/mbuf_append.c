@@ -0,0 +1,75 @@
+/**************************************************************************
+* @ file    : mbuf_append.c
+* @ author  : qinhj@lsec.cc.ac.cn
+* @ date    : 2026.10.17
+* @ brief   : mbuf_append() of 1..64 MB in 4 KB pieces, grows and time taken
+* -------------------------------------------------------------------------
+* Note:
+* 1. Each size is appended twice: with the libc realloc, and with a
+* realloc that always copies. glibc moves large blocks with mremap(), which
+* hides most of the cost of growing too often; allocators without it copy.
+* 2. With geometric growth both columns grow linearly with the size.
+***************************************************************************/
+
+#include <stdlib.h> // need for: malloc, realloc, free
+#include <string.h> // need for: memcpy
+#include <malloc.h> // need for: malloc_usable_size
+
+static int s_copying = 0;
+
+// @brief:  realloc(), or malloc + memcpy + free if s_copying is set
+static void *bench_realloc(void *p, size_t size) {
+    void *q;
+    size_t old;
+    if (!s_copying || p == NULL) return realloc(p, size);
+    q = malloc(size);
+    if (q == NULL) return NULL;
+    old = malloc_usable_size(p);
+    memcpy(q, p, old < size ? old : size);
+    free(p);
+    return q;
+}
+
+#define MBUF_REALLOC bench_realloc
+#include "mongoose.c"
+
+// @brief:  append total bytes in pieces, return ms taken and count grows
+static double append_run(size_t total, size_t piece, int *grows) {
+    struct mbuf mb;
+    char *data = (char *) calloc(1, piece), *last = NULL;
+    size_t n, last_size = 0;
+    double t;
+    *grows = 0;
+    mbuf_init(&mb, 0);
+    t = mg_time();
+    for (n = 0; n < total; n += piece) {
+        mbuf_append(&mb, data, piece);
+        if (mb.buf != last || mb.size != last_size) {
+            (*grows)++;
+            last = mb.buf;
+            last_size = mb.size;
+        }
+    }
+    t = (mg_time() - t) * 1e3;
+    mbuf_free(&mb);
+    free(data);
+    return t;
+}
+
+// usage: mbuf_append [max MB] [piece bytes]
+int main(int argc, char *argv[]) {
+    size_t max_mb = argc > 1 ? (size_t) atoi(argv[1]) : 64;
+    size_t piece = argc > 2 ? (size_t) atoi(argv[2]) : 4096, mb;
+    if (piece == 0) piece = 4096;
+    printf("%6s %8s %12s %12s\n", "MB", "grows", "realloc ms", "copying ms");
+    for (mb = 1; mb <= max_mb; mb <<= 1) {
+        int grows, grows_copying;
+        double t, t_copying;
+        s_copying = 0;
+        t = append_run(mb << 20, piece, &grows);
+        s_copying = 1;
+        t_copying = append_run(mb << 20, piece, &grows_copying);
+        printf("%6d %8d %12.1f %12.1f\n", (int) mb, grows, t, t_copying);
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+/**************************************************************************
+* @ file    : route_check.c
+* @ author  : qinhj@lsec.cc.ac.cn
+* @ date    : 2026.10.17
+* @ brief   : random patterns and uris, the route trie must match the list
+* -------------------------------------------------------------------------
+* Note:
+* 1. Each round registers up to 40 random patterns, built from the glob
+* characters mongoose knows ('?', '*', '**', '$', '|', ','), and looks up
+* 2000 random uris with both the trie and the list scan.
+* 2. Lookups are mixed with registrations, so the trie is also dropped and
+* compiled again midway.
+* 3. Exits with 1 on the first mismatches, printing up to 10 of them.
+***************************************************************************/
+
+#include "mongoose.c"
+
+#define ROUNDS 300
+#define MAX_PATTERNS 40
+#define URIS_PER_ROUND 2000
+
+static void route_handler(struct mg_connection *nc, int ev, void *ev_data) {
+    (void) nc;
+    (void) ev;
+    (void) ev_data;
+}
+
+// @brief:  longest match over the endpoint list, without the trie
+static struct mg_http_endpoint *list_lookup(struct mg_connection *nc,
+                                            struct mg_str uri) {
+    struct mg_http_endpoint *ep, *ret = NULL;
+    int matched, matched_max = 0;
+    for (ep = mg_http_get_proto_data(nc)->endpoints; ep; ep = ep->next) {
+        matched = mg_match_prefix_n(ep->uri_pattern, uri);
+        if (matched > matched_max) {
+            ret = ep;
+            matched_max = matched;
+        }
+    }
+    return ret;
+}
+
+// @brief:  fill buf with up to max_len random characters of alpha
+static void random_str(char *buf, const char *alpha, int max_len) {
+    int n = rand() % (max_len + 1), i, num = (int) strlen(alpha);
+    for (i = 0; i < n; i++) buf[i] = alpha[rand() % num];
+    buf[n] = '\0';
+}
+
+// usage: route_check [seed]
+int main(int argc, char *argv[]) {
+    int round, checked = 0, found = 0, bad = 0;
+    srand(argc > 1 ? atoi(argv[1]) : 1);
+    for (round = 0; round < ROUNDS; round++) {
+        struct mg_mgr mgr;
+        struct mg_connection *nc;
+        int n = 1 + rand() % MAX_PATTERNS, i;
+        mg_mgr_init(&mgr, NULL);
+        nc = mg_add_sock(&mgr, INVALID_SOCKET, route_handler);
+        for (i = 0; i < n; i++) {
+            struct mg_http_endpoint_opts opts;
+            char pat[40], tag[16];
+            memset(&opts, 0, sizeof(opts));
+            pat[0] = '/';
+            random_str(pat + (rand() % 2), "//aAbB.?*$|,", 10);
+            // auth_domain tells the endpoints apart, the trie keeps copies
+            snprintf(tag, sizeof(tag), "d%d", i);
+            opts.auth_domain = tag;
+            opts.auth_file = "f";
+            mg_register_http_endpoint_opt(nc, pat, route_handler, opts);
+            if (rand() % 8 == 0) {
+                struct mg_str uri = mg_mk_str("/a");
+                mg_http_get_endpoint_handler(nc, &uri);
+            }
+        }
+        for (i = 0; i < URIS_PER_ROUND; i++) {
+            char u[32];
+            struct mg_str uri;
+            struct mg_http_endpoint *a, *b;
+            random_str(u, "//aAbB.$x", 12);
+            uri = mg_mk_str(u);
+            a = list_lookup(nc, uri);
+            b = mg_http_get_endpoint_handler(nc, &uri);
+            checked++;
+            found += a != NULL;
+            if ((a == NULL) != (b == NULL) ||
+                (a != NULL && strcmp(a->auth_domain, b->auth_domain) != 0)) {
+                if (bad++ < 10) {
+                    printf("uri '%s': list '%.*s', trie '%.*s'\n", u,
+                           a ? (int) a->uri_pattern.len : 0,
+                           a ? a->uri_pattern.p : "",
+                           b ? (int) b->uri_pattern.len : 0,
+                           b ? b->uri_pattern.p : "");
+                }
+            }
+        }
+        if (mg_http_get_proto_data(nc)->routes == NULL) {
+            printf("round %d: the trie was not compiled\n", round);
+            bad++;
+        }
+        mg_mgr_free(&mgr);
+    }
+    printf("checked %d uris, %d matched a route, %d mismatches\n", checked,
+           found, bad);
+    return bad != 0;
+}
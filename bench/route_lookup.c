@@ -0,0 +1,119 @@
+/**************************************************************************
+* @ file    : route_lookup.c
+* @ author  : qinhj@lsec.cc.ac.cn
+* @ date    : 2026.10.17
+* @ brief   : endpoint lookup cost, compiled route trie vs the list scan
+* -------------------------------------------------------------------------
+* Note:
+* 1. Routes mix exact uris, '*' and '**' wildcards, '$' anchors and '|'
+* alternatives, plus a static dir and a php suffix as most servers have.
+* 2. The list scan is the lookup mongoose used before the trie, it is
+* still what mg_http_get_endpoint_handler() falls back to on OOM.
+* 3. Every lookup result is checked against the list scan, see also
+* route_check.c for random patterns.
+***************************************************************************/
+
+#include "mongoose.c"
+
+#define NUM_URIS 64
+
+static void route_handler(struct mg_connection *nc, int ev, void *ev_data) {
+    (void) nc;
+    (void) ev;
+    (void) ev_data;
+}
+
+// @brief:  longest match over the endpoint list, without the trie
+static struct mg_http_endpoint *list_lookup(struct mg_connection *nc,
+                                            struct mg_str uri) {
+    struct mg_http_endpoint *ep, *ret = NULL;
+    int matched, matched_max = 0;
+    for (ep = mg_http_get_proto_data(nc)->endpoints; ep; ep = ep->next) {
+        matched = mg_match_prefix_n(ep->uri_pattern, uri);
+        if (matched > matched_max) {
+            ret = ep;
+            matched_max = matched;
+        }
+    }
+    return ret;
+}
+
+// @brief:  register n + 2 routes and make NUM_URIS uris that hit them
+static void route_setup(struct mg_connection *nc, int n,
+                        char uris[NUM_URIS][64]) {
+    int i;
+    mg_register_http_endpoint(nc, "/static/**", route_handler);
+    mg_register_http_endpoint(nc, "**.php$", route_handler);
+    for (i = 0; i < n; i++) {
+        char pat[64];
+        switch (i % 4) {
+            case 0: snprintf(pat, sizeof(pat), "/api/v1/res%d", i); break;
+            case 1: snprintf(pat, sizeof(pat), "/api/v1/res%d/*/items$", i);
+                break;
+            case 2: snprintf(pat, sizeof(pat), "/api/v2/obj%d/**", i); break;
+            default: snprintf(pat, sizeof(pat), "/u/%d|/users/%d", i, i);
+        }
+        mg_register_http_endpoint(nc, pat, route_handler);
+    }
+    for (i = 0; i < NUM_URIS; i++) {
+        int r = rand() % (n / 4) * 4; // first of a group of 4 routes
+        switch (i % 5) {
+            case 0: snprintf(uris[i], 64, "/api/v1/res%d", r); break;
+            case 1: snprintf(uris[i], 64, "/api/v1/res%d/42/items", r + 1);
+                break;
+            case 2: snprintf(uris[i], 64, "/api/v2/obj%d/a/b/c", r + 2); break;
+            case 3: snprintf(uris[i], 64, "/static/css/site.css"); break;
+            default: snprintf(uris[i], 64, "/users/%d", r + 3);
+        }
+    }
+}
+
+// usage: route_lookup [route counts]...
+int main(int argc, char *argv[]) {
+    static const int sizes[] = {10, 100, 1000, 10000};
+    int num = argc > 1 ? argc - 1 : (int) (sizeof(sizes) / sizeof(sizes[0]));
+    int k, bad = 0;
+    printf("%8s %12s %12s\n", "routes", "list ns", "trie ns");
+    for (k = 0; k < num; k++) {
+        struct mg_mgr mgr;
+        struct mg_connection *nc;
+        char uris[NUM_URIS][64];
+        int n = argc > 1 ? atoi(argv[k + 1]) : sizes[k], i, iters;
+        long found = 0;
+        double t, t_list, t_trie;
+        if (n < 4) n = 4;
+        mg_mgr_init(&mgr, NULL);
+        nc = mg_add_sock(&mgr, INVALID_SOCKET, route_handler);
+        route_setup(nc, n, uris);
+
+        iters = 2000000 / n + 1000;
+        t = mg_time();
+        for (i = 0; i < iters; i++) {
+            found += list_lookup(nc, mg_mk_str(uris[i % NUM_URIS])) != NULL;
+        }
+        t_list = (mg_time() - t) * 1e9 / iters;
+
+        iters = 2000000;
+        for (i = 0; i <= iters; i++) {
+            struct mg_str uri = mg_mk_str(uris[i % NUM_URIS]);
+            if (i == 1) t = mg_time(); // the first lookup compiles the trie
+            found += mg_http_get_endpoint_handler(nc, &uri) != NULL;
+        }
+        t_trie = (mg_time() - t) * 1e9 / iters;
+
+        for (i = 0; i < NUM_URIS; i++) {
+            struct mg_str uri = mg_mk_str(uris[i]);
+            struct mg_http_endpoint *a = list_lookup(nc, uri);
+            struct mg_http_endpoint *b = mg_http_get_endpoint_handler(nc, &uri);
+            if (a == NULL || b == NULL || mg_strcmp(a->uri_pattern,
+                                                    b->uri_pattern) != 0) {
+                fprintf(stderr, "%s: list and trie disagree\n", uris[i]);
+                bad++;
+            }
+        }
+        printf("%8d %12.0f %12.0f\n", n + 2, t_list, t_trie);
+        mg_mgr_free(&mgr);
+        (void) found;
+    }
+    return bad != 0;
+}
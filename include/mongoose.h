@@ -402,6 +402,7 @@ unsigned int sleep(unsigned int seconds);
 #include <math.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -415,6 +416,7 @@ unsigned int sleep(unsigned int seconds);
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #ifdef __APPLE__
@@ -2074,11 +2076,20 @@ extern "C" {
 #endif
 #endif
 
+/*
+ * Buffers smaller than this grow by at most MBUF_SIZE_MAX_HEADROOM, larger
+ * ones by MBUF_SIZE_MULTIPLIER: appending n bytes in pieces costs O(n).
+ */
+#ifndef MBUF_SIZE_GEOMETRIC_MIN
+#define MBUF_SIZE_GEOMETRIC_MIN 65536
+#endif
+
 /* Memory buffer descriptor */
 struct mbuf {
   char *buf;   /* Buffer pointer */
   size_t len;  /* Data length. Data is located between offset 0 and len. */
   size_t size; /* Buffer size allocated by realloc(1). Must be >= len */
+  size_t off;  /* Removed bytes in front of buf, the allocation is buf - off */
 };
 
 /*
@@ -2114,7 +2125,11 @@ size_t mbuf_append_and_free(struct mbuf *, void *data, size_t data_size);
  */
 size_t mbuf_insert(struct mbuf *, size_t, const void *, size_t);
 
-/* Removes `data_size` bytes from the beginning of the buffer. */
+/*
+ * Removes `data_size` bytes from the beginning of the buffer.
+ * This is O(1): `buf` is moved past the removed data, which is reclaimed
+ * when the buffer empties or has to grow.
+ */
 void mbuf_remove(struct mbuf *, size_t data_size);
 
 /*
@@ -2125,6 +2140,17 @@ void mbuf_remove(struct mbuf *, size_t data_size);
  */
 void mbuf_resize(struct mbuf *, size_t new_size);
 
+/*
+ * Makes room for `len` more bytes after the data, so that appending them
+ * doesn't reallocate. Callers that know the final size (a Content-Length,
+ * a frame length) pass it to save the reallocations on the way there.
+ * A buffer that has to grow grows by at least MBUF_SIZE_MULTIPLIER, so
+ * reserving piece by piece stays linear too.
+ *
+ * Returns 0 if out of memory, 1 otherwise.
+ */
+int mbuf_reserve(struct mbuf *, size_t len);
+
 /* Moves the state from one mbuf to the other. */
 void mbuf_move(struct mbuf *from, struct mbuf *to);
 
@@ -3139,6 +3165,19 @@ struct {								\
 #ifndef CS_MONGOOSE_SRC_FEATURES_H_
 #define CS_MONGOOSE_SRC_FEATURES_H_
 
+/*
+ * Max connections a listener accepts per poll iteration, unless overridden
+ * by `mg_bind_opts::accept_budget`. Only loop where accept() is known to honour
+ * a non-blocking listening socket (eCos, for one, hangs).
+ */
+#ifndef MG_ACCEPT_BUDGET
+#ifdef __linux__
+#define MG_ACCEPT_BUDGET 64
+#else
+#define MG_ACCEPT_BUDGET 1
+#endif
+#endif
+
 #ifndef MG_DISABLE_HTTP_DIGEST_AUTH
 #define MG_DISABLE_HTTP_DIGEST_AUTH 0
 #endif
@@ -3207,6 +3246,24 @@ struct {								\
 #define MG_ENABLE_HTTP_CGI 0
 #endif
 
+/* Give HTTP proto data back to the pool between keep-alive requests */
+#ifndef MG_ENABLE_HTTP_IDLE_RELEASE
+#define MG_ENABLE_HTTP_IDLE_RELEASE 1
+#endif
+
+/*
+ * Scan HTTP headers 16 (SSE2) or 32 (AVX2, when the CPU has it) bytes at a
+ * time. Needs GCC or Clang on x86.
+ */
+#ifndef MG_ENABLE_HTTP_SIMD
+#if defined(__GNUC__) && defined(__SSE2__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define MG_ENABLE_HTTP_SIMD 1
+#else
+#define MG_ENABLE_HTTP_SIMD 0
+#endif
+#endif
+
 #ifndef MG_ENABLE_HTTP_SSI
 #define MG_ENABLE_HTTP_SSI MG_ENABLE_FILESYSTEM
 #endif
@@ -3243,6 +3300,15 @@ struct {								\
 #define MG_ENABLE_MQTT_BROKER 0
 #endif
 
+/* mg_post() message queue, needs GCC-style atomic builtins */
+#ifndef MG_ENABLE_MSG_QUEUE
+#if MG_ENABLE_BROADCAST && defined(__GNUC__)
+#define MG_ENABLE_MSG_QUEUE 1
+#else
+#define MG_ENABLE_MSG_QUEUE 0
+#endif
+#endif
+
 #ifndef MG_ENABLE_SSL
 #define MG_ENABLE_SSL 0
 #endif
@@ -3335,6 +3401,7 @@ extern "C" {
 struct mg_mgr;
 struct mg_connection;
 union socket_address;
+struct mg_udp_msg;
 
 struct mg_iface_vtable;
 
@@ -3380,6 +3447,22 @@ struct mg_iface_vtable {
   /* Put connection's address into *sa, local (remote = 0) or remote. */
   void (*get_conn_addr)(struct mg_connection *nc, int remote,
                         union socket_address *sa);
+
+  /*
+   * Gather-send `num_bufs` buffers in one go, like tcp_send. Optional:
+   * without it, data passed to mg_send_ref() is copied to send_mbuf.
+   */
+  int (*tcp_sendv)(struct mg_connection *nc, const struct mg_str *bufs,
+                   int num_bufs);
+
+  /*
+   * Optional batched UDP I/O on a listener's socket: receive or send up to
+   * `num_msgs` datagrams. Return the number of datagrams done, -1 on error.
+   */
+  int (*udp_recv_batch)(struct mg_connection *nc, struct mg_udp_msg *msgs,
+                        int num_msgs);
+  int (*udp_send_batch)(struct mg_connection *nc, struct mg_udp_msg *msgs,
+                        int num_msgs);
 };
 
 extern const struct mg_iface_vtable *mg_ifaces[];
@@ -3414,6 +3497,11 @@ void mg_if_connect_cb(struct mg_connection *nc, int err);
  */
 void mg_if_can_recv_cb(struct mg_connection *nc);
 void mg_if_can_send_cb(struct mg_connection *nc);
+/*
+ * Callback that tells the core that the interface has sent `num_sent` bytes
+ * from the beginning of send_mbuf by itself, e.g. batched. -1: error.
+ */
+void mg_if_sent_cb(struct mg_connection *nc, int num_sent);
 /*
  * Receive callback.
  * buf must be heap-allocated and ownership is transferred to the core.
@@ -3438,6 +3526,104 @@ double mg_mgr_min_timer(const struct mg_mgr *mgr);
 
 #endif /* CS_MONGOOSE_SRC_NET_IF_H_ */
 #ifdef MG_MODULE_LINES
+#line 1 "mongoose/src/mg_net_if_epoll.h"
+#endif
+
+#ifndef CS_MONGOOSE_SRC_NET_IF_EPOLL_H_
+#define CS_MONGOOSE_SRC_NET_IF_EPOLL_H_
+
+/* Amalgamated: #include "mg_net_if.h" */
+
+/*
+ * epoll(7)-based variant of the socket interface. Sockets are registered
+ * once when they are attached to a connection, and interest is only changed
+ * when it actually flips (e.g. `send_mbuf` goes between empty and non-empty),
+ * so the I/O cost of `mg_mgr_poll()` scales with the number of ready sockets
+ * rather than with the total number of connections. There is no FD_SETSIZE
+ * limit either.
+ *
+ * Select it at runtime via `mg_mgr_init_opt()`:
+ *
+ * ```c
+ * struct mg_mgr_init_opts opts;
+ * memset(&opts, 0, sizeof(opts));
+ * opts.main_iface = &mg_epoll_iface_vtable;
+ * mg_mgr_init_opt(&mgr, NULL, opts);
+ * ```
+ */
+
+#ifndef MG_ENABLE_NET_IF_EPOLL
+#if defined(__linux__) && MG_NET_IF == MG_NET_IF_SOCKET
+#define MG_ENABLE_NET_IF_EPOLL 1
+#else
+#define MG_ENABLE_NET_IF_EPOLL 0
+#endif
+#endif
+
+#if MG_ENABLE_NET_IF_EPOLL
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+extern const struct mg_iface_vtable mg_epoll_iface_vtable;
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* MG_ENABLE_NET_IF_EPOLL */
+
+#endif /* CS_MONGOOSE_SRC_NET_IF_EPOLL_H_ */
+#ifdef MG_MODULE_LINES
+#line 1 "mongoose/src/mg_net_if_io_uring.h"
+#endif
+
+#ifndef CS_MONGOOSE_SRC_NET_IF_IO_URING_H_
+#define CS_MONGOOSE_SRC_NET_IF_IO_URING_H_
+
+/* Amalgamated: #include "mg_net_if.h" */
+
+/*
+ * io_uring(7)-based variant of the socket interface. TCP listeners use a
+ * multishot accept, and accepted connections receive into a ring of buffers
+ * provided to the kernel up front, so a busy connection costs no syscall per
+ * read. Outgoing data is handed over with one SEND per connection per
+ * iteration, and all submissions plus the wait are a single
+ * `io_uring_enter()` call. SSL, UDP and outgoing connections are served via
+ * one-shot polls on the same ring.
+ *
+ * Needs Linux 5.19 or newer. When the ring or the provided buffers can not be
+ * set up, the manager silently falls back to the epoll (or select) interface.
+ *
+ * ```c
+ * struct mg_mgr_init_opts opts;
+ * memset(&opts, 0, sizeof(opts));
+ * opts.main_iface = &mg_io_uring_iface_vtable;
+ * mg_mgr_init_opt(&mgr, NULL, opts);
+ * ```
+ */
+
+#ifndef MG_ENABLE_NET_IF_IO_URING
+#define MG_ENABLE_NET_IF_IO_URING 0
+#endif
+
+#if MG_ENABLE_NET_IF_IO_URING
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+extern const struct mg_iface_vtable mg_io_uring_iface_vtable;
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* MG_ENABLE_NET_IF_IO_URING */
+
+#endif /* CS_MONGOOSE_SRC_NET_IF_IO_URING_H_ */
+#ifdef MG_MODULE_LINES
 #line 1 "mongoose/src/mg_ssl_if.h"
 #endif
 
@@ -3540,6 +3726,13 @@ union socket_address {
 
 struct mg_connection;
 
+/* A datagram for udp_recv_batch() and udp_send_batch() */
+struct mg_udp_msg {
+  char *buf;
+  size_t len; /* Buffer size or datagram length, updated with the result */
+  union socket_address sa;
+};
+
 /*
  * Callback function (event handler) prototype. Must be defined by the user.
  * Mongoose calls the event handler, passing the events defined below.
@@ -3556,6 +3749,96 @@ typedef void (*mg_event_handler_t)(struct mg_connection *nc, int ev,
 #define MG_EV_CLOSE 5   /* Connection is closed. NULL */
 #define MG_EV_TIMER 6   /* now >= conn->ev_timer_time. double * */
 
+/* Timer resolution, timers fire on the first poll after their tick */
+#ifndef MG_TIMER_TICK_MS
+#define MG_TIMER_TICK_MS 10
+#endif
+
+struct mg_timer_wheel;
+struct mg_udp_peers;
+struct mg_sock_opts;
+struct mg_msg_queue;
+struct mg_conn_ids;
+
+/*
+ * Data queued with `mg_send_ref()`. It goes out after the first `pos` bytes
+ * of send_mbuf that follow the previous reference, if any.
+ */
+struct mg_send_ref {
+  struct mg_send_ref *next;
+  size_t pos;       /* send_mbuf bytes in front of this reference */
+  const char *buf;  /* Unsent part of the data */
+  size_t len;
+  void *data;                  /* The buffer as passed to mg_send_ref() */
+  void (*free_cb)(void *data); /* Called once the data is sent or dropped */
+};
+
+/* mg_connection::send_refs */
+struct mg_send_chain {
+  struct mg_send_ref *head, *tail;
+  size_t mbuf_pos; /* send_mbuf bytes in front of the tail */
+  size_t len;      /* Unsent bytes of all references */
+};
+
+/* Number of idle classes, class 0 means "not tracked" */
+#ifndef MG_NUM_IDLE_CLASSES
+#define MG_NUM_IDLE_CLASSES 4
+#endif
+
+/*
+ * Connections of one idle class, least recently active first. All of them
+ * share the timeout, so only the head can be the next to expire.
+ */
+struct mg_idle_list {
+  struct mg_connection *head, *tail;
+  int timeout; /* Seconds, 0: never expire */
+};
+
+/*
+ * Connection timer, see `mg_timer_add()`. Lives on the manager's timer wheel
+ * and on its connection's list of timers.
+ */
+struct mg_timer {
+  struct mg_timer *next, **pprev;           /* Wheel slot linkage */
+  struct mg_timer *conn_next, **conn_pprev; /* mg_connection::timers linkage */
+  struct mg_connection *nc;
+  mg_event_handler_t cb; /* NULL: the connection's handler */
+  double deadline;       /* Passed as MG_EV_TIMER's ev_data */
+  uint64_t expires;      /* Deadline in timer ticks */
+  int slot;              /* Wheel slot the timer is in */
+};
+
+/* Max number of free objects a pool keeps around */
+#ifndef MG_POOL_MAX_FREE
+#define MG_POOL_MAX_FREE 1024
+#endif
+
+/*
+ * Free list of same-sized objects (connections, protocol data), to avoid
+ * a malloc()/free() pair per connection or per request.
+ */
+struct mg_pool {
+  void *free_list; /* Linked through the first word of each object */
+  int num_free;
+  int max_free; /* 0: MG_POOL_MAX_FREE */
+  size_t obj_size; /* Of the objects on the free list */
+  unsigned long hits;   /* Allocations served from the free list */
+  unsigned long misses; /* Allocations that fell back to MG_CALLOC */
+};
+
+/*
+ * Connection I/O buffers are borrowed from per-manager pools of
+ * MG_NUM_IO_BUF_CLASSES size classes: MG_IO_BUF_SIZE, 4x that, 16x that...
+ * Larger buffers come from the heap.
+ */
+#ifndef MG_IO_BUF_SIZE
+#define MG_IO_BUF_SIZE 4096
+#endif
+
+#ifndef MG_NUM_IO_BUF_CLASSES
+#define MG_NUM_IO_BUF_CLASSES 3
+#endif
+
 /*
  * Mongoose event manager.
  */
@@ -3565,13 +3848,24 @@ struct mg_mgr {
   const char *hexdump_file; /* Debug hexdump file path */
 #endif
 #if MG_ENABLE_BROADCAST
-  sock_t ctl[2]; /* Socketpair for mg_broadcast() */
+  sock_t ctl[2]; /* Socketpair for mg_broadcast(), or one eventfd twice */
+#endif
+#if MG_ENABLE_MSG_QUEUE
+  struct mg_msg_queue *msgs;    /* See mg_post() */
+  struct mg_conn_ids *conn_ids; /* Connections by mg_conn_id() */
 #endif
   void *user_data; /* User data */
   int num_ifaces;
   int num_calls;
   struct mg_iface **ifaces; /* network interfaces */
   const char *nameserver;   /* DNS server to use */
+  struct mg_timer_wheel *timers; /* Armed timers of all connections */
+  struct mg_idle_list idle[MG_NUM_IDLE_CLASSES]; /* See mg_set_idle() */
+  struct mg_pool conn_pool;       /* Free struct mg_connection */
+  struct mg_pool proto_data_pool; /* Free HTTP protocol data */
+  struct mg_pool send_ref_pool;   /* Free struct mg_send_ref */
+  struct mg_pool io_buf_pools[MG_NUM_IO_BUF_CLASSES]; /* Free I/O buffers */
+  struct mg_connection *poll_set; /* Visited every poll, see MG_F_NO_POLL */
 };
 
 /*
@@ -3627,6 +3921,35 @@ struct mg_connection {
 #define MG_F_PROTO_1 (1 << 12)
 #define MG_F_PROTO_2 (1 << 13)
 #define MG_F_ENABLE_BROADCAST (1 << 14)    /* Allow broadcast address usage */
+#define MG_F_REUSE_PORT (1 << 15) /* Listen with SO_REUSEPORT, see mg_bind */
+/*
+ * Write right after the event handler returns if it queued data onto an empty
+ * send queue, instead of waiting for the next poll to report writability.
+ * What can't be sent at once goes the usual way. TCP only; inherited by
+ * connections a listener accepts.
+ */
+#define MG_F_EAGER_SEND (1 << 16)
+/*
+ * No periodic MG_EV_POLL: the connection is only visited by the poll loop
+ * when its socket is ready, an event handler ran for it, data was queued for
+ * it, or `mg_want_poll()` asked for one MG_EV_POLL. Idle connections then
+ * cost nothing per `mg_mgr_poll()`. Timers work as usual. Inherited by
+ * connections a listener accepts.
+ * Whatever runs off MG_EV_POLL stops for idle connections: handler code,
+ * and protocol code such as the MQTT keep-alive or the SOCKS relay. Websocket
+ * connections drop the flag when they are upgraded, so that idle ones are
+ * still pinged.
+ */
+#define MG_F_NO_POLL (1 << 17)
+#define MG_F_WANT_POLL (1 << 18) /* Set by mg_want_poll() */
+/*
+ * More output follows what is queued now, e.g. the rest of a file being
+ * served: TCP writes are flagged MSG_MORE, so that the kernel fills whole
+ * segments instead of pushing each piece. Clear it together with queueing
+ * the last piece; while it is set, the tail can be held back for up to
+ * 200ms. Writes that leave data queued are flagged MSG_MORE regardless.
+ */
+#define MG_F_SEND_MORE (1 << 19)
 
 /* Flags left for application */
 #define MG_F_USER_1 (1 << 20)
@@ -3640,6 +3963,22 @@ struct mg_connection {
   void *ssl_if_data; /* SSL library data. */
 #else
   void *unused_ssl_if_data; /* To keep the size of the structure the same. */
+#endif
+  int accept_budget; /* Listeners: max accepts per poll, 0 = default */
+  struct mg_timer *timers;  /* Armed timers of this connection */
+  struct mg_timer *ev_timer; /* Backs mg_set_timer() */
+  struct mg_connection *idle_next, *idle_prev; /* mg_mgr::idle linkage */
+  time_t idle_time; /* When the connection became idle */
+  int idle_class;   /* mg_mgr::idle list the connection is on, 0: none */
+  struct mg_send_chain send_refs; /* Data queued with mg_send_ref() */
+  struct mg_udp_peers *udp_peers; /* UDP listeners: peers by address */
+  struct mg_connection *udp_peer_next, **udp_peer_pprev; /* udp_peers link */
+  struct mg_connection *poll_next, **poll_pprev; /* mg_mgr::poll_set link */
+  struct mg_sock_opts *sock_opts; /* From mg_bind_opts/mg_connect_opts */
+  unsigned int sock_opts_applied; /* MG_SOCK_OPT_* set on the socket */
+#if MG_ENABLE_MSG_QUEUE
+  unsigned long id;              /* See mg_conn_id(), 0: none yet */
+  struct mg_connection *id_next; /* mg_mgr::conn_ids linkage */
 #endif
 };
 
@@ -3701,6 +4040,27 @@ void mg_mgr_free(struct mg_mgr *mgr);
  */
 int mg_mgr_poll(struct mg_mgr *mgr, int milli);
 
+/* Memory held by a manager, see `mg_mgr_mem_stats()`. */
+struct mg_mem_stats {
+  unsigned long num_conns;    /* Connections, listeners included */
+  unsigned long num_parked;   /* ... with no buffers or proto data attached */
+  unsigned long conn_bytes;   /* Held by all connections */
+  unsigned long parked_bytes; /* ... by the parked ones */
+  unsigned long pool_bytes;   /* Kept on the manager's free lists */
+};
+
+/*
+ * Sums up the memory held by the manager's connections: struct
+ * mg_connection, I/O buffers, references queued with `mg_send_ref()` and
+ * protocol data, the latter counted at the size of HTTP protocol data.
+ * Sockets and interface state are not included.
+ *
+ * A connection is parked when it holds nothing but itself, as an HTTP
+ * keep-alive connection between requests does:
+ * `parked_bytes / num_parked` is the cost of an idle client.
+ */
+void mg_mgr_mem_stats(struct mg_mgr *mgr, struct mg_mem_stats *st);
+
 #if MG_ENABLE_BROADCAST
 /*
  * Passes a message of a given length to all connections.
@@ -3713,11 +4073,39 @@ int mg_mgr_poll(struct mg_mgr *mgr, int milli);
  * connection. When called, the event will be `MG_EV_POLL`, and a message will
  * be passed as the `ev_data` pointer. Maximum message size is capped
  * by `MG_CTL_MSG_MESSAGE_SIZE` which is set to 8192 bytes by default.
+ *
+ * With `MG_ENABLE_MSG_QUEUE`, the message is copied and sent with
+ * `mg_post()`; the call only waits while the queue is full and the size is
+ * not capped.
  */
 void mg_broadcast(struct mg_mgr *mgr, mg_event_handler_t cb, void *data,
                   size_t len);
 #endif
 
+#if MG_ENABLE_MSG_QUEUE
+/*
+ * Queues a message for the IO thread, from any thread. Unlike
+ * `mg_broadcast()`, this never blocks and copies nothing.
+ *
+ * In the next `mg_mgr_poll()`, `cb` is called with `MG_EV_POLL` and `data`
+ * for the connection `conn_id` (see `mg_conn_id()`), or for every connection
+ * if `conn_id` is 0. Afterwards `free_cb(data)` is called if not NULL,
+ * also when the connection is already gone.
+ *
+ * Returns 0 if the queue (`MG_MSG_QUEUE_SIZE` messages) is full, then `data`
+ * is still owned by the caller.
+ */
+int mg_post(struct mg_mgr *mgr, unsigned long conn_id, mg_event_handler_t cb,
+            void *data, void (*free_cb)(void *data));
+
+/*
+ * Returns the id that `mg_post()` addresses the connection with. Ids are not
+ * reused, so a message to a closed connection is dropped rather than
+ * delivered to a new one. Must be called from the IO thread.
+ */
+unsigned long mg_conn_id(struct mg_connection *nc);
+#endif
+
 /*
  * Iterates over all active connections.
  *
@@ -3767,17 +4155,54 @@ struct mg_connection *mg_add_sock_opt(struct mg_mgr *mgr, sock_t sock,
                                             void *user_data),
                                       struct mg_add_sock_opts opts);
 
+/*
+ * Socket tuning for `mg_bind_opt()` and `mg_connect_opt()`. Zero fields keep
+ * the system default. A listener's options are inherited by the connections
+ * it accepts. Options the platform lacks or rejects are skipped; the ones
+ * that took effect are reported in `mg_connection::sock_opts_applied`.
+ */
+struct mg_sock_opts {
+  int nodelay;       /* TCP_NODELAY: 1 to set, -1 to clear */
+  int sndbuf;        /* SO_SNDBUF, bytes */
+  int rcvbuf;        /* SO_RCVBUF, bytes */
+  int notsent_lowat; /* TCP_NOTSENT_LOWAT, bytes */
+  int backlog;       /* Listeners: listen() backlog, 0 = SOMAXCONN */
+  int defer_accept;  /* Listeners: TCP_DEFER_ACCEPT, seconds */
+  /*
+   * TCP_FASTOPEN. Listeners: the queue length of pending TFO requests.
+   * Outgoing connections: nonzero sets TCP_FASTOPEN_CONNECT.
+   */
+  int fastopen;
+};
+
+#define MG_SOCK_OPT_NODELAY (1 << 0)
+#define MG_SOCK_OPT_SNDBUF (1 << 1)
+#define MG_SOCK_OPT_RCVBUF (1 << 2)
+#define MG_SOCK_OPT_NOTSENT_LOWAT (1 << 3)
+#define MG_SOCK_OPT_BACKLOG (1 << 4)
+#define MG_SOCK_OPT_DEFER_ACCEPT (1 << 5)
+#define MG_SOCK_OPT_FASTOPEN (1 << 6)
+
 /*
  * Optional parameters to `mg_bind_opt()`.
  *
  * `flags` is an initial `struct mg_connection::flags` bitmask to set,
- * see `MG_F_*` flags definitions.
+ * see `MG_F_*` flags definitions. `MG_F_REUSE_PORT` binds the listener with
+ * SO_REUSEPORT, so that several managers (e.g. one per thread) can each bind
+ * the same port and the kernel spreads incoming connections among them.
  */
 struct mg_bind_opts {
   void *user_data;           /* Initial value for connection's user_data */
   unsigned int flags;        /* Extra connection flags */
   const char **error_string; /* Placeholder for the error string */
   struct mg_iface *iface;    /* Interface instance */
+  /*
+   * Max connections accepted per `mg_mgr_poll()` iteration, so that a full
+   * backlog is drained in one wakeup without starving existing connections.
+   * 0 means `MG_ACCEPT_BUDGET`.
+   */
+  int accept_budget;
+  struct mg_sock_opts sock_opts; /* TCP tuning, see `struct mg_sock_opts` */
 #if MG_ENABLE_SSL
   /*
    * SSL settings.
@@ -3844,6 +4269,7 @@ struct mg_connect_opts {
   const char **error_string; /* Placeholder for the error string */
   struct mg_iface *iface;    /* Interface instance */
   const char *nameserver;    /* DNS server to use, NULL for default */
+  struct mg_sock_opts sock_opts; /* TCP tuning, see `struct mg_sock_opts` */
 #if MG_ENABLE_SSL
   /*
    * SSL settings.
@@ -3982,6 +4408,33 @@ const char *mg_set_ssl(struct mg_connection *nc, const char *cert,
  */
 void mg_send(struct mg_connection *, const void *buf, int len);
 
+/*
+ * Like `mg_send()`, but queues a reference to `buf` instead of copying it.
+ * The buffer must stay valid until `free_cb(buf)` is called, when the data
+ * has been sent or the connection is gone. `free_cb` may be NULL for static
+ * data.
+ *
+ * The socket interface writes data in send_mbuf and referenced buffers
+ * with one writev(), so a response head built with `mg_printf()` and a body
+ * passed by reference go out together. Where gather-send is not available
+ * (SSL, UDP, other interfaces) the data is copied to send_mbuf and freed
+ * right away. While references are queued, send_mbuf may only be appended to.
+ */
+void mg_send_ref(struct mg_connection *, const void *buf, size_t len,
+                 void (*free_cb)(void *buf));
+
+/*
+ * Returns the number of bytes waiting to be sent: send_mbuf plus the data
+ * queued with `mg_send_ref()`.
+ */
+size_t mg_send_queued(const struct mg_connection *nc);
+
+/*
+ * Asks for one MG_EV_POLL on the next `mg_mgr_poll()`, e.g. for a
+ * `MG_F_NO_POLL` connection that has work to resume.
+ */
+void mg_want_poll(struct mg_connection *nc);
+
 /* Enables format string warnings for mg_printf */
 #if defined(__GNUC__)
 __attribute__((format(printf, 2, 3)))
@@ -4067,6 +4520,45 @@ int mg_check_ip_acl(const char *acl, uint32_t remote_ip);
  */
 double mg_set_timer(struct mg_connection *c, double timestamp);
 
+/*
+ * Adds a one-shot timer to the connection, firing in `ms` milliseconds.
+ * Unlike `mg_set_timer()`, a connection can have any number of these.
+ * On expiry, `cb` (or the connection's handler, if `cb` is NULL) gets
+ * MG_EV_TIMER with a `double *` deadline as `ev_data`; the timer is released
+ * before the call. Pending timers are released when the connection closes.
+ *
+ * Timers are kept on a hierarchical timing wheel with `MG_TIMER_TICK_MS`
+ * resolution: adding and cancelling take constant time, and connections
+ * without timers cost nothing on poll.
+ *
+ * Returns NULL on allocation failure.
+ */
+struct mg_timer *mg_timer_add(struct mg_connection *nc, int ms,
+                              mg_event_handler_t cb);
+
+/*
+ * Cancels a pending timer returned by `mg_timer_add()`. Must not be called
+ * for a timer that has fired, or whose connection has been closed.
+ */
+void mg_timer_cancel(struct mg_timer *t);
+
+/*
+ * Puts the connection into idle class `cls` (moving it out of its current
+ * one) and restarts its idle time. Unless it is moved again or touched
+ * with another call, it is closed once it's been idle for the class timeout,
+ * see `mg_set_idle_timeout()`. Class 0 stops tracking the connection.
+ *
+ * Each class is a list ordered by idle time, so this is O(1), and so is
+ * finding the expired connections on poll.
+ */
+void mg_set_idle(struct mg_connection *nc, int cls);
+
+/*
+ * Sets the timeout of an idle class, in seconds. 0 disables it: connections
+ * stay in the class, but never expire.
+ */
+void mg_set_idle_timeout(struct mg_mgr *mgr, int cls, int seconds);
+
 /*
  * A sub-second precision version of time().
  */
@@ -4393,6 +4885,75 @@ extern "C" {
 #define MG_CGI_ENVIRONMENT_SIZE 8192
 #endif
 
+/*
+ * A message body (or websocket frame) that is buffered gets room for up to
+ * this much of its announced length up front, the rest is grown into as it
+ * arrives. Small, as a peer can announce any length with a header alone:
+ * by default the largest pooled I/O buffer.
+ */
+#ifndef MG_HTTP_MAX_BODY_RESERVE
+#define MG_HTTP_MAX_BODY_RESERVE \
+  ((size_t) MG_IO_BUF_SIZE << (2 * (MG_NUM_IO_BUF_CLASSES - 1)))
+#endif
+
+/*
+ * Pipelined requests a server connection dispatches in a row before it gives
+ * the other connections a turn; the rest follow on its next poll.
+ */
+#ifndef MG_MAX_HTTP_PIPELINE
+#define MG_MAX_HTTP_PIPELINE 32
+#endif
+
+/*
+ * Idle classes of HTTP server connections, see `mg_set_idle()`:
+ * - header: from accept, or from the first byte of the next request on a
+ *   keep-alive connection, until the request headers are in. Trickling
+ *   bytes doesn't restart it.
+ * - body: between two reads of the request body.
+ * - keep-alive: after the last request, between two reads or writes. While
+ *   a file is being sent or a CGI script runs, the connection is in no class;
+ *   keep-alive starts with the write that finishes the response.
+ * Timeouts are in seconds and can be changed with `mg_set_idle_timeout()`.
+ */
+#define MG_HTTP_IDLE_HEADER 1
+#define MG_HTTP_IDLE_BODY 2
+#define MG_HTTP_IDLE_KEEP_ALIVE 3
+
+#ifndef MG_HTTP_HEADER_TIMEOUT
+#define MG_HTTP_HEADER_TIMEOUT 30
+#endif
+
+#ifndef MG_HTTP_BODY_TIMEOUT
+#define MG_HTTP_BODY_TIMEOUT 60
+#endif
+
+#ifndef MG_HTTP_KEEP_ALIVE_TIMEOUT
+#define MG_HTTP_KEEP_ALIVE_TIMEOUT 60
+#endif
+
+/*
+ * Well-known headers, indexed by `mg_parse_http()` while it parses. See
+ * `mg_get_http_header_id()`.
+ */
+enum mg_http_header_id {
+  MG_HTTP_HDR_HOST,
+  MG_HTTP_HDR_CONNECTION,
+  MG_HTTP_HDR_CONTENT_LENGTH,
+  MG_HTTP_HDR_CONTENT_TYPE,
+  MG_HTTP_HDR_TRANSFER_ENCODING,
+  MG_HTTP_HDR_RANGE,
+  MG_HTTP_HDR_IF_MODIFIED_SINCE,
+  MG_HTTP_HDR_IF_NONE_MATCH,
+  MG_HTTP_HDR_AUTHORIZATION,
+  MG_HTTP_HDR_COOKIE,
+  MG_HTTP_HDR_ACCEPT_ENCODING,
+  MG_HTTP_HDR_USER_AGENT,
+  MG_HTTP_HDR_SEC_WEBSOCKET_KEY,
+  MG_HTTP_HDR_SEC_WEBSOCKET_ACCEPT,
+  MG_HTTP_HDR_SEC_WEBSOCKET_PROTOCOL,
+  MG_HTTP_NUM_HEADER_IDS
+};
+
 /* HTTP message */
 struct http_message {
   struct mg_str message; /* Whole message: request line + headers + body */
@@ -4420,6 +4981,13 @@ struct http_message {
   /* Headers */
   struct mg_str header_names[MG_MAX_HTTP_HEADERS];
   struct mg_str header_values[MG_MAX_HTTP_HEADERS];
+
+  /*
+   * For each `mg_http_header_id`: 1 + the index of its first occurrence in
+   * header_names/header_values, 0 if it's absent or not indexed (a message
+   * built by hand).
+   */
+  unsigned short header_ids[MG_HTTP_NUM_HEADER_IDS];
 };
 
 #if MG_ENABLE_HTTP_WEBSOCKET
@@ -4767,6 +5335,17 @@ int mg_parse_http(const char *s, int n, struct http_message *hm, int is_req);
  */
 struct mg_str *mg_get_http_header(struct http_message *hm, const char *name);
 
+/*
+ * Like `mg_get_http_header()` for a well-known header:
+ *
+ *     struct mg_str *host_hdr = mg_get_http_header_id(hm, MG_HTTP_HDR_HOST);
+ *
+ * A header that `mg_parse_http()` has indexed is returned without searching.
+ * Otherwise, e.g. for a message built by hand, it is searched by name.
+ */
+struct mg_str *mg_get_http_header_id(struct http_message *hm,
+                                     enum mg_http_header_id id);
+
 /*
  * Parses the HTTP header `hdr`. Finds variable `var_name` and stores its value
  * in the buffer `*buf`, `buf_size`. If the buffer size is not enough,
@@ -5170,6 +5749,34 @@ void mg_register_http_endpoint_opt(struct mg_connection *nc,
                                    mg_event_handler_t handler,
                                    struct mg_http_endpoint_opts opts);
 
+/*
+ * Endpoints registered on a listener are compiled into an immutable route
+ * table when the first request needs them: a radix trie over the literal
+ * heads of the uri patterns, so a lookup doesn't try every pattern.
+ * Registering another endpoint drops the table, the next lookup compiles it
+ * again.
+ *
+ * Listeners that register the same endpoints, e.g. one per reactor thread,
+ * can share one table:
+ *
+ * ```c
+ *   struct mg_http_routes *routes = mg_http_get_routes(nc0);
+ *   mg_http_set_routes(nc1, routes);
+ *   mg_http_routes_release(routes);
+ * ```
+ *
+ * `mg_http_get_routes()` returns the table of `nc` with a reference taken,
+ * or NULL if it has no endpoints. `mg_http_set_routes()` makes `nc` route
+ * by `routes`, taking its own reference; NULL goes back to the endpoints of
+ * `nc`. `mg_http_routes_release()` drops a reference, the last one frees
+ * the table. References may be dropped from any thread.
+ */
+struct mg_http_routes;
+struct mg_http_routes *mg_http_get_routes(struct mg_connection *nc);
+void mg_http_set_routes(struct mg_connection *nc,
+                        struct mg_http_routes *routes);
+void mg_http_routes_release(struct mg_http_routes *routes);
+
 /*
  * Authenticates a HTTP request against an opened password file.
  * Returns 1 if authenticated, 0 otherwise.
@@ -5209,6 +5816,13 @@ int mg_check_digest_auth(struct mg_str method, struct mg_str uri,
  */
 void mg_send_http_chunk(struct mg_connection *nc, const char *buf, size_t len);
 
+/*
+ * Like `mg_send_http_chunk()`, but the chunk data is sent by reference,
+ * see `mg_send_ref()`. Only the chunk framing is copied to send_mbuf.
+ */
+void mg_send_http_chunk_ref(struct mg_connection *nc, const char *buf,
+                            size_t len, void (*free_cb)(void *buf));
+
 /*
  * Sends a printf-formatted HTTP chunk.
  * Functionality is similar to `mg_send_http_chunk()`.
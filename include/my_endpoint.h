@@ -23,11 +23,22 @@
 #include "my_log.h"
 
 #define BUF_SIZE    1024
+#define CHUNK_SIZE  (16 * 1024) // download chunk, sent by reference
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+    // static content options, read-only (shared by all reactors)
+    static const struct mg_serve_http_opts s_http_server_opts = {
+#ifdef MG_ENABLE_SSL
+        .document_root = HTTPS_SVC_ROOT,
+#else
+        .document_root = HTTP_SVC_ROOT,
+#endif //!MG_ENABLE_SSL
+        .enable_directory_listing = "yes",
+    };
+
     // @brief:  event handler(endpoints:  /say_hello, /run, /download, etc.)
     static void ev_handler(struct mg_connection *nc, int ev, void *p) {
         if (ev == MG_EV_HTTP_REQUEST) {
@@ -86,16 +97,33 @@ extern "C" {
                     mg_printf(nc, "%s", "HTTP/1.1 200 OK" EOL
                         "Content-Type: application/octet-stream" EOL
                         "Transfer-Encoding: chunked" EOL EOL);
-                    // Send http chunk
-                    char buf[BUF_SIZE] = { 0 };
+                    // Send http chunk, the buffers are freed once sent
+                    char *buf = NULL;
                     size_t rlen = 0;
+                    int failed = 0;
                     fseek(fp, 0, SEEK_SET);
                     while (!feof(fp)) {
-                        rlen = fread(buf, 1, BUF_SIZE, fp);
-                        mg_send_http_chunk(nc, buf, rlen);
+                        if (NULL == (buf = (char *)malloc(CHUNK_SIZE))) {
+                            failed = 1;
+                            break;
+                        }
+                        rlen = fread(buf, 1, CHUNK_SIZE, fp);
+                        if (0 == rlen) {
+                            free(buf);
+                            failed = ferror(fp);
+                            break;
+                        }
+                        mg_send_http_chunk_ref(nc, buf, rlen, free);
+                    }
+                    if (failed) {
+                        // No end chunk: the client must not take a truncated file for a whole one
+                        log_err("[%s] send file '%s' failed, closing\n", __FUNCTION__, body.p);
+                        nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+                    }
+                    else {
+                        // Send empty chunk, the end of response
+                        mg_send_http_chunk(nc, "", 0);
                     }
-                    // Send empty chunk, the end of response
-                    mg_send_http_chunk(nc, "", 0);
                     // Close file
                     if (fp) fclose(fp);
                 }
@@ -106,6 +134,17 @@ extern "C" {
                 }
                 mg_strfree(&body);
             }
+            // endpoint: /stats, memory held by this reactor's connections
+            else if (0 == mg_vcmp(&hm->uri, "/stats")) {
+                struct mg_mem_stats st;
+                mg_mgr_mem_stats(nc->mgr, &st);
+                mg_printf(nc, "%s", "HTTP/1.1 200 OK" EOL "Transfer-Encoding: chunked" EOL EOL);
+                mg_printf_http_chunk(nc, "{ \"conns\": %lu, \"parked\": %lu, \"conn_bytes\": %lu, "
+                    "\"parked_bytes\": %lu, \"bytes_per_parked\": %lu, \"pool_bytes\": %lu }" EOL,
+                    st.num_conns, st.num_parked, st.conn_bytes, st.parked_bytes,
+                    st.num_parked ? st.parked_bytes / st.num_parked : 0, st.pool_bytes);
+                mg_send_http_chunk(nc, "", 0);
+            }
             // endpoint: others
             else {
                 struct mg_str uri = mg_strdup_nul(hm->uri);
@@ -128,13 +167,6 @@ extern "C" {
                 log_info("[%s] handle %s by mg_serve_http\n", __FUNCTION__, (uri.p ? uri.p : "nil"));
                 mg_strfree(&uri);
                 // serve static content
-                static struct mg_serve_http_opts s_http_server_opts;
-#ifdef MG_ENABLE_SSL
-                s_http_server_opts.document_root = HTTPS_SVC_ROOT;
-#else
-                s_http_server_opts.document_root = HTTP_SVC_ROOT;
-#endif //!MG_ENABLE_SSL
-                s_http_server_opts.enable_directory_listing = "yes";
                 mg_serve_http(nc, hm, s_http_server_opts);
             }
         }
@@ -0,0 +1,160 @@
+// @author: qinhj@lsec.cc.ac.cn
+// @file:   my_reactor.h
+// @brief:  multi-reactor runner: one mg_mgr (event loop) per worker thread
+//
+// Copyright (c) 2019 ***. All rights reserved.
+// ------------------------------------------------------------------------------
+// Note:
+// 1. Every reactor binds the same port with MG_F_REUSE_PORT, so the kernel
+//  spreads new connections among them; a connection lives in one reactor only.
+// 2. mg_mgr is not thread safe: handlers run in their reactor's thread and may
+//  only touch their own connections. State shared between reactors (serve
+//  options, endpoint tables, ...) must be read-only once the reactors run.
+// 3. Include this header first, cpu pinning needs _GNU_SOURCE.
+
+#ifndef MY_REACTOR_H
+#define MY_REACTOR_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // need for: pthread_setaffinity_np
+#endif
+
+#include <pthread.h>
+#include <sched.h>  // need for: cpu_set_t
+#include <stdio.h>  // need for: NULL
+#include <stdlib.h> // need for: calloc
+#include <unistd.h> // need for: sysconf
+/* 3rd  includes */
+#include "mongoose.h"
+/* user includes */
+#include "my_log.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    struct my_reactor_opts {
+        const char *port;               // listening address, bound by every reactor
+        int num_reactors;               // number of event loops, <= 0: one per online cpu
+        int pin_cpus;                   // pin reactor i to cpu (i % cpus)
+        mg_event_handler_t handler;     // listener event handler
+        // called once per reactor after bind, e.g. to register endpoints and protocol;
+        // it must register the same endpoints each time, see my_reactor_run()
+        void (*setup)(struct mg_connection *nc);
+        const struct mg_iface_vtable *iface;    // event interface, NULL: default
+        struct mg_bind_opts bind_opts;  // extra bind options (ssl, ...)
+    };
+
+    struct my_reactor {
+        struct mg_mgr mgr;
+        pthread_t thread;
+        int id;
+        int cpu;    // -1: not pinned
+    };
+
+    static void _my_reactor_pin(struct my_reactor *r) {
+        if (r->cpu < 0) {
+            return;
+        }
+#ifdef CPU_SET
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(r->cpu, &set);
+        if (0 != pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+            log_err("[%s] reactor %d: failed to pin to cpu %d\n", __FUNCTION__, r->id, r->cpu);
+        }
+#else
+        log_err("[%s] cpu pinning is not supported\n", __FUNCTION__);
+#endif
+    }
+
+    static void *_my_reactor_loop(void *arg) {
+        struct my_reactor *r = (struct my_reactor *) arg;
+        _my_reactor_pin(r);
+        log_verbose("[%s] reactor %d running (cpu %d)\n", __FUNCTION__, r->id, r->cpu);
+        for (;;) {
+            mg_mgr_poll(&r->mgr, 1000);
+        }
+        return NULL;
+    }
+
+    // @brief:  start reactors and run them forever (reactor 0 in the calling thread)
+    // @return: 1 on startup failure, otherwise it doesn't return
+    static int my_reactor_run(const struct my_reactor_opts *opts) {
+        int i, num = opts->num_reactors;
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        struct my_reactor *reactors = NULL;
+        struct mg_http_routes *routes = NULL;
+
+        if (cpus < 1) {
+            cpus = 1;
+        }
+        if (num <= 0) {
+            num = (int) cpus;
+        }
+        reactors = (struct my_reactor *) calloc(num, sizeof(*reactors));
+        if (NULL == reactors) {
+            log_err("[%s] out of memory\n", __FUNCTION__);
+            return 1;
+        }
+
+        // bind every listener up front, so that errors are reported before serving
+        for (i = 0; i < num; i++) {
+            struct my_reactor *r = &reactors[i];
+            struct mg_mgr_init_opts mgr_opts;
+            struct mg_bind_opts bind_opts = opts->bind_opts;
+            struct mg_connection *nc;
+            const char *err = NULL;
+
+            memset(&mgr_opts, 0, sizeof(mgr_opts));
+            mgr_opts.main_iface = opts->iface;
+            mg_mgr_init_opt(&r->mgr, NULL, mgr_opts);
+            r->id = i;
+            r->cpu = opts->pin_cpus ? (int) (i % cpus) : -1;
+
+            if (1 < num) {
+                bind_opts.flags |= MG_F_REUSE_PORT;
+            }
+            if (NULL == bind_opts.error_string) {
+                bind_opts.error_string = &err;
+            }
+            nc = mg_bind_opt(&r->mgr, opts->port, opts->handler, bind_opts);
+            if (NULL == nc) {
+                log_err("[%s] reactor %d: failed to create listener: %s\n", __FUNCTION__, i,
+                    *bind_opts.error_string ? *bind_opts.error_string : "unknown");
+                while (0 <= i) {
+                    mg_mgr_free(&reactors[i--].mgr);
+                }
+                mg_http_routes_release(routes);
+                free(reactors);
+                return 1;
+            }
+            if (opts->setup) {
+                opts->setup(nc);
+            }
+            // compile the endpoints once, every reactor routes by reactor 0's table
+            if (0 == i) {
+                routes = mg_http_get_routes(nc);
+            } else if (routes) {
+                mg_http_set_routes(nc, routes);
+            }
+        }
+        mg_http_routes_release(routes);
+        log_verbose("[%s] %d reactor(s) on port %s\n", __FUNCTION__, num, opts->port);
+
+        for (i = 1; i < num; i++) {
+            if (0 != pthread_create(&reactors[i].thread, NULL, _my_reactor_loop, &reactors[i])) {
+                log_err("[%s] failed to start reactor %d\n", __FUNCTION__, i);
+                return 1;
+            }
+        }
+        _my_reactor_loop(&reactors[0]);
+
+        return 0;
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* MY_REACTOR_H */
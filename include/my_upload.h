@@ -127,15 +127,16 @@ extern "C" {
                 break;
             }
             case MG_EV_HTTP_REQUEST: {
-                // serve static content
-                static struct mg_serve_http_opts s_http_server_opts;
+                // serve static content, read-only (shared by all reactors)
+                static const struct mg_serve_http_opts s_upload_http_opts = {
 #ifdef MG_ENABLE_SSL
-                s_http_server_opts.document_root = HTTPS_SVC_ROOT;
+                    .document_root = HTTPS_SVC_ROOT,
 #else
-                s_http_server_opts.document_root = HTTP_SVC_ROOT;
+                    .document_root = HTTP_SVC_ROOT,
 #endif //!MG_ENABLE_SSL
-                s_http_server_opts.enable_directory_listing = "yes";
-                mg_serve_http(nc, (struct http_message *) p, s_http_server_opts);
+                    .enable_directory_listing = "yes",
+                };
+                mg_serve_http(nc, (struct http_message *) p, s_upload_http_opts);
                 break;
             }
             default: {
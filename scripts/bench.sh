@@ -0,0 +1,137 @@
+#!/bin/bash
+
+####################################################################
+#                    Http Server Throughput Bench
+# ==================================================================
+# @Author:  qinhj@lsec.cc.ac.cn
+# ------------------------------------------------------------------
+# @Note:    Starts http_server with 1..N reactors and measures
+#           requests/sec for each uri, using wrk or ab (keep-alive).
+#           Without either, a curl loop is used, which measures
+#           process spawning more than the server: numbers are only
+#           comparable with each other.
+# ------------------------------------------------------------------
+# @History:
+# 2026/10/17 v1.0.0 init/create
+####################################################################
+
+#########################
+#### Global Settings ####
+#########################
+
+## debug settings
+PATH=.:$PATH
+set -e # -ex
+## script version
+VERSION=1.0.0
+## script options
+COMMENTS="[-s <server>] [-p <port>] [-n <reactors>] [-u <uris>] [-c <connections>] [-d <seconds>] [-a]"
+OPTIONS=":s:p:n:u:c:d:a"
+EXAMPLE0="-n '1 2 4' -u '/say_hello /README.md'"
+EXAMPLE1="-s ../http_server -p 9999 -n '1 2 4 8' -c 128 -d 10 -a"
+## gloval variable
+SERVER="./http_server"          # server binary, run from its directory
+PORT=18080                      # listening port
+REACTORS="1 2 4"                # reactor counts to test
+URIS="/say_hello /README.md"    # endpoint and static file
+CONNS=64                        # concurrent connections
+SECONDS_PER_RUN=5               # duration of one run
+AFFINITY=0                      # pin reactors to cpus
+
+#########################
+#### Function Region ####
+#########################
+
+## hard code as Red
+EchoError() {
+  echo -e "\033[31m[Error ] $@\033[0m"
+}
+
+## hard code as LightBlue
+EchoTitle() {
+  echo -e "\033[36m$@\033[0m"
+}
+
+ShowUsage() {
+  EchoTitle "Http Server Throughput Bench [Version: $VERSION]"
+  echo "Usage:"
+  echo "  [bash] $0 $COMMENTS"
+  echo "Options:"
+  echo "  -s    server binary   (default: $SERVER)"
+  echo "  -p    listening port  (default: $PORT)"
+  echo "  -n    reactor counts  (default: $REACTORS)"
+  echo "  -u    uris to fetch   (default: $URIS)"
+  echo "  -c    connections     (default: $CONNS)"
+  echo "  -d    seconds per run (default: $SECONDS_PER_RUN)"
+  echo "  -a    pin reactors to cpus"
+  echo "Example:"
+  echo -e "  $0 $EXAMPLE0\n  $0 $EXAMPLE1"
+}
+
+## print requests/sec of one run: $1 url
+RunOnce() {
+  if which wrk > /dev/null 2>&1; then
+    wrk -t$(nproc) -c$CONNS -d${SECONDS_PER_RUN}s $1 | awk '/Requests\/sec/ {print $2}'
+  elif which ab > /dev/null 2>&1; then
+    ab -k -q -c $CONNS -t $SECONDS_PER_RUN -n 10000000 $1 2>/dev/null | awk '/Requests per second/ {print $4}'
+  else
+    local total=0
+    local stop=$(( $(date +%s) + SECONDS_PER_RUN ))
+    while [ $(date +%s) -lt $stop ]; do
+      seq $CONNS | xargs -P $CONNS -I{} curl -s -o /dev/null $1
+      let total+=CONNS
+    done
+    echo $(( total / SECONDS_PER_RUN ))
+  fi
+}
+
+## bench all uris against a server with $1 reactors
+RunReactors() {
+  $SERVER $PORT $1 $AFFINITY > /dev/null 2>&1 &
+  local pid=$!
+  sleep 0.5
+  if ! kill -0 $pid 2>/dev/null; then
+    EchoError "failed to start $SERVER with $1 reactor(s)"
+    return 1
+  fi
+  for uri in $URIS; do
+    printf "%-10s %-20s %s\n" $1 $uri $(RunOnce http://127.0.0.1:${PORT}${uri})
+  done
+  kill $pid && wait $pid 2>/dev/null || true
+  ## the listener may outlive the process for a moment
+  while (echo > /dev/tcp/127.0.0.1/$PORT) 2>/dev/null; do
+    sleep 0.1
+  done
+}
+
+#########################
+####  Main   Region  ####
+#########################
+
+## parse option
+while getopts $OPTIONS opt; do
+  case $opt in
+    s) SERVER=$OPTARG;;
+    p) PORT=$OPTARG;;
+    n) REACTORS=$OPTARG;;
+    u) URIS=$OPTARG;;
+    c) CONNS=$OPTARG;;
+    d) SECONDS_PER_RUN=$OPTARG;;
+    a) AFFINITY=1;;
+    ?)
+      ShowUsage
+      exit 101
+  esac
+done
+
+if [ ! -x $SERVER ]; then
+  EchoError "server binary not found: $SERVER"
+  ShowUsage
+  exit 102
+fi
+
+echo "cpus: $(nproc), connections: $CONNS, ${SECONDS_PER_RUN}s per run"
+printf "%-10s %-20s %s\n" reactors uri req/s
+for n in $REACTORS; do
+  RunReactors $n
+done
@@ -0,0 +1,126 @@
+#!/bin/bash
+
+####################################################################
+#                 Mongoose Micro Benchmark Runner
+# ==================================================================
+# @Author:  qinhj@lsec.cc.ac.cn
+# ------------------------------------------------------------------
+# @Note:    Builds each bench/<name>.c against src/mongoose.c (the
+#           benches include the amalgamation, so they can reach its
+#           static functions) and runs it. Extra arguments (-a) are
+#           passed to every bench, extra cflags (-f) to every build,
+#           e.g. to compare a build option: -f "-DMG_ENABLE_X=0".
+# ------------------------------------------------------------------
+# @History:
+# 2026/10/17 v1.0.0 init/create
+####################################################################
+
+#########################
+#### Global Settings ####
+#########################
+
+## debug settings
+set -e # -ex
+## script version
+VERSION=1.0.0
+## script options
+COMMENTS="[-r <repo>] [-b <benches>] [-o <outdir>] [-f <cflags>] [-a <args>] [-l]"
+OPTIONS=":r:b:o:f:a:l"
+EXAMPLE0="-l"
+EXAMPLE1="-b hdr_parse -a 500000 -f '-O3 -march=native'"
+## gloval variable
+REPO=$(cd $(dirname $0)/.. && pwd)  # repo root, with src/ and bench/
+BENCHES=""                      # benches to run, all if empty
+OUTDIR=""                       # build dir, default: <repo>/bench/build
+CC=${CC:-gcc}                   # compiler
+CFLAGS="-O2 -g"                 # compiler flags
+ARGS=""                         # arguments of each bench
+LIST=0                          # only list the benches
+
+#########################
+#### Function Region ####
+#########################
+
+## hard code as Red
+EchoError() {
+  echo -e "\033[31m[Error ] $@\033[0m"
+}
+
+## hard code as LightBlue
+EchoTitle() {
+  echo -e "\033[36m$@\033[0m"
+}
+
+ShowUsage() {
+  EchoTitle "Mongoose Micro Benchmark Runner [Version: $VERSION]"
+  echo "Usage:"
+  echo "  [bash] $0 $COMMENTS"
+  echo "Options:"
+  echo "  -r    repo root       (default: $REPO)"
+  echo "  -b    benches to run  (default: all in bench/)"
+  echo "  -o    build dir       (default: <repo>/bench/build)"
+  echo "  -f    extra cflags    (default: $CFLAGS)"
+  echo "  -a    bench arguments"
+  echo "  -l    list the benches"
+  echo "Example:"
+  echo -e "  $0 $EXAMPLE0\n  $0 $EXAMPLE1"
+}
+
+## print the first line of a bench's brief: $1 name
+Brief() {
+  sed -n 's/^\* @ brief *: //p' $REPO/bench/$1.c | head -1
+}
+
+## build and run bench $1
+RunBench() {
+  local src=$REPO/bench/$1.c
+  if [ ! -f $src ]; then
+    EchoError "no such bench: $1"
+    return 1
+  fi
+  EchoTitle "== $1: $(Brief $1)"
+  $CC $CFLAGS -I$REPO/src -I$REPO/include -I$REPO/extinc -DMG_ENABLE_MQTT=0 \
+    -o $OUTDIR/$1 $src -lpthread -ldl
+  $OUTDIR/$1 $ARGS
+}
+
+#########################
+####  Main   Region  ####
+#########################
+
+## parse option
+while getopts $OPTIONS opt; do
+  case $opt in
+    r) REPO=$OPTARG;;
+    b) BENCHES=$OPTARG;;
+    o) OUTDIR=$OPTARG;;
+    f) CFLAGS="$CFLAGS $OPTARG";;
+    a) ARGS=$OPTARG;;
+    l) LIST=1;;
+    ?)
+      ShowUsage
+      exit 101
+  esac
+done
+
+if [ ! -f $REPO/src/mongoose.c ] || [ ! -d $REPO/bench ]; then
+  EchoError "not a repo root: $REPO"
+  ShowUsage
+  exit 102
+fi
+if [ -z "$BENCHES" ]; then
+  BENCHES=$(cd $REPO/bench && ls *.c | sed 's/\.c$//')
+fi
+if [ $LIST -eq 1 ]; then
+  for b in $BENCHES; do
+    printf "%-12s %s\n" $b "$(Brief $b)"
+  done
+  exit 0
+fi
+
+OUTDIR=${OUTDIR:-$REPO/bench/build}
+mkdir -p $OUTDIR
+echo "cc: $($CC --version | head -1), cflags: $CFLAGS"
+for b in $BENCHES; do
+  RunBench $b
+done
@@ -0,0 +1,117 @@
+#!/bin/bash
+
+####################################################################
+#                 Http Server Idle Connection Bench
+# ==================================================================
+# @Author:  qinhj@lsec.cc.ac.cn
+# ------------------------------------------------------------------
+# @Note:    Starts http_server with one reactor, opens N keep-alive
+#           connections that send one request each and then stay
+#           idle, and reports the server's memory before and after:
+#           VmRSS and the /stats endpoint (mg_mgr_mem_stats()).
+#           Connections are spread over 127.0.0.x source addresses,
+#           ulimit -n must be above N on both sides.
+# ------------------------------------------------------------------
+# @History:
+# 2026/10/17 v1.0.0 init/create
+####################################################################
+
+#########################
+#### Global Settings ####
+#########################
+
+## debug settings
+PATH=.:$PATH
+set -e # -ex
+## script version
+VERSION=1.0.0
+## script options
+COMMENTS="[-s <server>] [-p <port>] [-n <connections>] [-u <uri>]"
+OPTIONS=":s:p:n:u:"
+EXAMPLE0="-n 10000"
+EXAMPLE1="-s ../http_server -p 9999 -n 50000 -u /README.md"
+## gloval variable
+SERVER="./http_server"          # server binary, run from its directory
+PORT=18080                      # listening port
+CONNS=10000                     # connections to park
+URI="/say_hello"                # request sent on each connection
+PER_ADDR=20000                  # connections per client address
+
+#########################
+#### Function Region ####
+#########################
+
+## hard code as Red
+EchoError() {
+  echo -e "\033[31m[Error ] $@\033[0m"
+}
+
+## hard code as LightBlue
+EchoTitle() {
+  echo -e "\033[36m$@\033[0m"
+}
+
+ShowUsage() {
+  EchoTitle "Http Server Idle Connection Bench [Version: $VERSION]"
+  echo "Usage:"
+  echo "  [bash] $0 $COMMENTS"
+  echo "Options:"
+  echo "  -s    server binary   (default: $SERVER)"
+  echo "  -p    listening port  (default: $PORT)"
+  echo "  -n    connections     (default: $CONNS)"
+  echo "  -u    uri to request  (default: $URI)"
+  echo "Example:"
+  echo -e "  $0 $EXAMPLE0\n  $0 $EXAMPLE1"
+}
+
+## print server memory: $1 label, $2 pid
+Report() {
+  local rss=$(awk '/VmRSS/ {print $2}' /proc/$2/status)
+  printf "%-8s rss %8s kB  %s\n" $1 $rss "$(curl -s -m 5 http://127.0.0.1:${PORT}/stats)"
+}
+
+#########################
+####  Main   Region  ####
+#########################
+
+## parse option
+while getopts $OPTIONS opt; do
+  case $opt in
+    s) SERVER=$OPTARG;;
+    p) PORT=$OPTARG;;
+    n) CONNS=$OPTARG;;
+    u) URI=$OPTARG;;
+    ?)
+      ShowUsage
+      exit 101
+  esac
+done
+
+if [ ! -x $SERVER ]; then
+  EchoError "server binary not found: $SERVER"
+  ShowUsage
+  exit 102
+fi
+if [ $(ulimit -n) -le $((CONNS + 16)) ]; then
+  EchoError "ulimit -n is $(ulimit -n), need more than $CONNS"
+  exit 103
+fi
+
+$SERVER $PORT 1 > /dev/null 2>&1 &
+pid=$!
+sleep 0.5
+if ! kill -0 $pid 2>/dev/null; then
+  EchoError "failed to start $SERVER"
+  exit 104
+fi
+Report before $pid
+
+## responses are left unread in the client sockets
+for ((i = 0; i < CONNS; i++)); do
+  exec {fd}<>/dev/tcp/127.0.0.$((1 + i / PER_ADDR))/$PORT
+  printf "GET $URI HTTP/1.1\r\nHost: x\r\n\r\n" >&$fd
+done
+sleep 1
+Report parked $pid
+
+kill $pid && wait $pid 2>/dev/null || true
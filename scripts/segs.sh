@@ -0,0 +1,130 @@
+#!/bin/bash
+
+####################################################################
+#                 Http Server Packet Count Bench
+# ==================================================================
+# @Author:  qinhj@lsec.cc.ac.cn
+# ------------------------------------------------------------------
+# @Note:    Starts http_server with one reactor, fetches each uri N
+#           times over one keep-alive connection (curl) or as one
+#           pipelined batch (-P, bash /dev/tcp), and reports the TCP
+#           segments sent per request, from OutSegs in /proc/net/snmp.
+#           Run on an otherwise quiet host: OutSegs counts the whole
+#           network namespace, client segments (acks) included.
+# ------------------------------------------------------------------
+# @History:
+# 2026/10/17 v1.0.0 init/create
+####################################################################
+
+#########################
+#### Global Settings ####
+#########################
+
+## debug settings
+PATH=.:$PATH
+set -e # -ex
+## script version
+VERSION=1.0.0
+## script options
+COMMENTS="[-s <server>] [-p <port>] [-n <requests>] [-u <uris>] [-P]"
+OPTIONS=":s:p:n:u:P"
+EXAMPLE0="-n 200 -u '/say_hello /README.md'"
+EXAMPLE1="-s ../http_server -p 9999 -n 1000 -P"
+## gloval variable
+SERVER="./http_server"          # server binary, run from its directory
+PORT=18080                      # listening port
+REQUESTS=200                    # requests per uri
+URIS="/say_hello /README.md"    # endpoint and static file
+PIPELINE=0                      # send all requests at once
+
+#########################
+#### Function Region ####
+#########################
+
+## hard code as Red
+EchoError() {
+  echo -e "\033[31m[Error ] $@\033[0m"
+}
+
+## hard code as LightBlue
+EchoTitle() {
+  echo -e "\033[36m$@\033[0m"
+}
+
+ShowUsage() {
+  EchoTitle "Http Server Packet Count Bench [Version: $VERSION]"
+  echo "Usage:"
+  echo "  [bash] $0 $COMMENTS"
+  echo "Options:"
+  echo "  -s    server binary   (default: $SERVER)"
+  echo "  -p    listening port  (default: $PORT)"
+  echo "  -n    requests        (default: $REQUESTS)"
+  echo "  -u    uris to fetch   (default: $URIS)"
+  echo "  -P    pipeline the requests"
+  echo "Example:"
+  echo -e "  $0 $EXAMPLE0\n  $0 $EXAMPLE1"
+}
+
+## print OutSegs of the namespace
+OutSegs() {
+  awk '/^Tcp:/ && $1 == "Tcp:" {if (h) print $12; h = 1}' /proc/net/snmp
+}
+
+## fetch $1 REQUESTS times over one connection
+Fetch() {
+  if [ $PIPELINE -eq 0 ]; then
+    curl -s $(for ((i = 0; i < REQUESTS; i++)); do echo http://127.0.0.1:${PORT}$1; done) > /dev/null
+  else
+    exec {fd}<>/dev/tcp/127.0.0.1/$PORT
+    for ((i = 1; i < REQUESTS; i++)); do
+      printf "GET $1 HTTP/1.1\r\nHost: x\r\n\r\n"
+    done >&$fd
+    printf "GET $1 HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n" >&$fd
+    cat <&$fd > /dev/null
+    exec {fd}>&-
+  fi
+}
+
+#########################
+####  Main   Region  ####
+#########################
+
+## parse option
+while getopts $OPTIONS opt; do
+  case $opt in
+    s) SERVER=$OPTARG;;
+    p) PORT=$OPTARG;;
+    n) REQUESTS=$OPTARG;;
+    u) URIS=$OPTARG;;
+    P) PIPELINE=1;;
+    ?)
+      ShowUsage
+      exit 101
+  esac
+done
+
+if [ ! -x $SERVER ]; then
+  EchoError "server binary not found: $SERVER"
+  ShowUsage
+  exit 102
+fi
+
+$SERVER $PORT 1 > /dev/null 2>&1 &
+pid=$!
+sleep 0.5
+if ! kill -0 $pid 2>/dev/null; then
+  EchoError "failed to start $SERVER"
+  exit 104
+fi
+
+echo "requests: $REQUESTS per uri, pipelined: $PIPELINE"
+printf "%-20s %10s %10s\n" uri segments seg/req
+for uri in $URIS; do
+  before=$(OutSegs)
+  Fetch $uri
+  sleep 0.2
+  segs=$(( $(OutSegs) - before ))
+  printf "%-20s %10s %10s\n" $uri $segs $(awk "BEGIN {printf \"%.2f\", $segs / $REQUESTS}")
+done
+
+kill $pid && wait $pid 2>/dev/null || true
@@ -70,6 +70,27 @@ MG_INTERNAL void mg_call(struct mg_connection *nc,
 void mg_forward(struct mg_connection *from, struct mg_connection *to);
 MG_INTERNAL void mg_add_conn(struct mg_mgr *mgr, struct mg_connection *c);
 MG_INTERNAL void mg_remove_conn(struct mg_connection *c);
+MG_INTERNAL void mg_poll_set_add(struct mg_connection *nc);
+MG_INTERNAL void mg_poll_set_prune(struct mg_connection *nc);
+MG_INTERNAL void mg_timer_wheel_init(struct mg_mgr *mgr);
+MG_INTERNAL void mg_timer_wheel_free(struct mg_mgr *mgr);
+MG_INTERNAL void mg_timer_run(struct mg_mgr *mgr, double now);
+MG_INTERNAL void mg_timer_unpark(struct mg_connection *nc);
+MG_INTERNAL void mg_idle_run(struct mg_mgr *mgr, double now);
+MG_INTERNAL void *mg_pool_alloc(struct mg_pool *pool, size_t size);
+MG_INTERNAL void mg_pool_free(struct mg_pool *pool, void *p);
+MG_INTERNAL void mg_io_buf_reserve(struct mg_mgr *mgr, struct mbuf *mb,
+                                   size_t len);
+MG_INTERNAL void mg_io_buf_release(struct mg_mgr *mgr, struct mbuf *mb);
+#if MG_ENABLE_MSG_QUEUE
+MG_INTERNAL void mg_msg_queue_init(struct mg_mgr *mgr);
+MG_INTERNAL void mg_msg_queue_run(struct mg_mgr *mgr);
+MG_INTERNAL void mg_msg_queue_free(struct mg_mgr *mgr);
+MG_INTERNAL void mg_conn_id_remove(struct mg_connection *nc);
+#endif
+#if MG_ENABLE_BROADCAST
+MG_INTERNAL void mg_mgr_ctl_open(struct mg_mgr *mgr);
+#endif
 MG_INTERNAL struct mg_connection *mg_create_connection(
     struct mg_mgr *mgr, mg_event_handler_t callback,
     struct mg_add_sock_opts opts);
@@ -163,6 +184,7 @@ MG_INTERNAL void mg_handle_put(struct mg_connection *nc, const char *path,
 #if MG_ENABLE_HTTP_WEBSOCKET
 MG_INTERNAL void mg_ws_handler(struct mg_connection *nc, int ev,
                                void *ev_data MG_UD_ARG(void *user_data));
+MG_INTERNAL void mg_ws_allow_poll(struct mg_connection *nc);
 MG_INTERNAL void mg_ws_handshake(struct mg_connection *nc,
                                  const struct mg_str *key,
                                  struct http_message *);
@@ -1416,7 +1438,7 @@ void cs_hmac_sha1(const unsigned char *key, size_t keylen,
 
 void mbuf_init(struct mbuf *mbuf, size_t initial_size) WEAK;
 void mbuf_init(struct mbuf *mbuf, size_t initial_size) {
-  mbuf->len = mbuf->size = 0;
+  mbuf->len = mbuf->size = mbuf->off = 0;
   mbuf->buf = NULL;
   mbuf_resize(mbuf, initial_size);
 }
@@ -1424,13 +1446,25 @@ void mbuf_init(struct mbuf *mbuf, size_t initial_size) {
 void mbuf_free(struct mbuf *mbuf) WEAK;
 void mbuf_free(struct mbuf *mbuf) {
   if (mbuf->buf != NULL) {
-    MBUF_FREE(mbuf->buf);
+    MBUF_FREE(mbuf->buf - mbuf->off);
     mbuf_init(mbuf, 0);
   }
 }
 
+/* Moves the data back to the start of the allocation, see mbuf_remove(). */
+static void mbuf_compact(struct mbuf *a) {
+  if (a->off > 0) {
+    char *base = a->buf - a->off;
+    if (a->len > 0) memmove(base, a->buf, a->len);
+    a->buf = base;
+    a->size += a->off;
+    a->off = 0;
+  }
+}
+
 void mbuf_resize(struct mbuf *a, size_t new_size) WEAK;
 void mbuf_resize(struct mbuf *a, size_t new_size) {
+  mbuf_compact(a);
   if (new_size > a->size || (new_size < a->size && new_size >= a->len)) {
     char *buf = (char *) MBUF_REALLOC(a->buf, new_size);
     /*
@@ -1444,6 +1478,19 @@ void mbuf_resize(struct mbuf *a, size_t new_size) {
   }
 }
 
+int mbuf_reserve(struct mbuf *a, size_t len) WEAK;
+int mbuf_reserve(struct mbuf *a, size_t len) {
+  size_t need = a->len + len, grown;
+  if (need < a->len) return 0; /* Overflow */
+  if (need <= a->size) return 1;
+  mbuf_compact(a);
+  if (need <= a->size) return 1;
+  grown = (size_t)(a->size * MBUF_SIZE_MULTIPLIER);
+  mbuf_resize(a, need > grown ? need : grown);
+  if (a->size < need) mbuf_resize(a, need);
+  return a->size >= need;
+}
+
 void mbuf_trim(struct mbuf *mbuf) WEAK;
 void mbuf_trim(struct mbuf *mbuf) {
   mbuf_resize(mbuf, mbuf->len);
@@ -1460,6 +1507,7 @@ size_t mbuf_insert(struct mbuf *a, size_t off, const void *buf, size_t len) {
   /* check overflow */
   if (~(size_t) 0 - (size_t) a->buf < len) return 0;
 
+  if (a->len + len > a->size) mbuf_compact(a);
   if (a->len + len <= a->size) {
     memmove(a->buf + off + len, a->buf + off, a->len - off);
     if (buf != NULL) {
@@ -1469,7 +1517,8 @@ size_t mbuf_insert(struct mbuf *a, size_t off, const void *buf, size_t len) {
   } else {
     size_t min_size = (a->len + len);
     size_t new_size = (size_t)(min_size * MBUF_SIZE_MULTIPLIER);
-    if (new_size - min_size > MBUF_SIZE_MAX_HEADROOM) {
+    if (new_size - min_size > MBUF_SIZE_MAX_HEADROOM &&
+        min_size < MBUF_SIZE_GEOMETRIC_MIN) {
       new_size = min_size + MBUF_SIZE_MAX_HEADROOM;
     }
     p = (char *) MBUF_REALLOC(a->buf, new_size);
@@ -1504,9 +1553,10 @@ size_t mbuf_append_and_free(struct mbuf *a, void *data, size_t len) {
   /* Optimization: if the buffer is currently empty,
    * take over the user-provided buffer. */
   if (a->len == 0) {
-    if (a->buf != NULL) free(a->buf);
+    if (a->buf != NULL) free(a->buf - a->off);
     a->buf = (char *) data;
     a->len = a->size = len;
+    a->off = 0;
     return len;
   }
   ret = mbuf_insert(a, a->len, data, len);
@@ -1517,14 +1567,23 @@ size_t mbuf_append_and_free(struct mbuf *a, void *data, size_t len) {
 void mbuf_remove(struct mbuf *mb, size_t n) WEAK;
 void mbuf_remove(struct mbuf *mb, size_t n) {
   if (n > 0 && n <= mb->len) {
-    memmove(mb->buf, mb->buf + n, mb->len - n);
+    /*
+     * Step over the removed data instead of moving the rest down, so that
+     * draining a buffer in slices is linear. The space is reclaimed when
+     * the buffer empties, or when it has to grow.
+     */
+    mb->buf += n;
+    mb->off += n;
+    mb->size -= n;
     mb->len -= n;
+    if (mb->len == 0) mbuf_compact(mb);
   }
 }
 
 void mbuf_clear(struct mbuf *mb) WEAK;
 void mbuf_clear(struct mbuf *mb) {
   mb->len = 0;
+  mbuf_compact(mb);
 }
 
 void mbuf_move(struct mbuf *from, struct mbuf *to) WEAK;
@@ -2236,6 +2295,10 @@ size_t mg_match_prefix(const char *pattern, int pattern_len, const char *str) {
 #ifndef MG_UDP_IO_SIZE
 #define MG_UDP_IO_SIZE 1460
 #endif
+/* Max datagrams per udp_recv_batch() or udp_send_batch() */
+#ifndef MG_UDP_BATCH
+#define MG_UDP_BATCH 32
+#endif
 
 #define MG_COPY_COMMON_CONNECTION_OPTIONS(dst, src) \
   memcpy(dst, src, sizeof(*dst));
@@ -2243,17 +2306,21 @@ size_t mg_match_prefix(const char *pattern, int pattern_len, const char *str) {
 /* Which flags can be pre-set by the user at connection creation time. */
 #define _MG_ALLOWED_CONNECT_FLAGS_MASK                                   \
   (MG_F_USER_1 | MG_F_USER_2 | MG_F_USER_3 | MG_F_USER_4 | MG_F_USER_5 | \
-   MG_F_USER_6 | MG_F_WEBSOCKET_NO_DEFRAG | MG_F_ENABLE_BROADCAST)
+   MG_F_USER_6 | MG_F_WEBSOCKET_NO_DEFRAG | MG_F_ENABLE_BROADCAST |     \
+   MG_F_REUSE_PORT | MG_F_EAGER_SEND | MG_F_NO_POLL)
 /* Which flags should be modifiable by user's callbacks. */
 #define _MG_CALLBACK_MODIFIABLE_FLAGS_MASK                               \
   (MG_F_USER_1 | MG_F_USER_2 | MG_F_USER_3 | MG_F_USER_4 | MG_F_USER_5 | \
    MG_F_USER_6 | MG_F_WEBSOCKET_NO_DEFRAG | MG_F_SEND_AND_CLOSE |        \
-   MG_F_CLOSE_IMMEDIATELY | MG_F_IS_WEBSOCKET | MG_F_DELETE_CHUNK)
+   MG_F_CLOSE_IMMEDIATELY | MG_F_IS_WEBSOCKET | MG_F_DELETE_CHUNK |      \
+   MG_F_EAGER_SEND | MG_F_NO_POLL | MG_F_WANT_POLL | MG_F_SEND_MORE)
 
 #ifndef intptr_t
 #define intptr_t long
 #endif
 
+static void mg_poll_set_remove(struct mg_connection *nc);
+
 MG_INTERNAL void mg_add_conn(struct mg_mgr *mgr, struct mg_connection *c) {
   DBG(("%p %p", mgr, c));
   c->mgr = mgr;
@@ -2264,6 +2331,7 @@ MG_INTERNAL void mg_add_conn(struct mg_mgr *mgr, struct mg_connection *c) {
   if (c->sock != INVALID_SOCKET) {
     c->iface->vtable->add_conn(c);
   }
+  mg_poll_set_add(c);
 }
 
 MG_INTERNAL void mg_remove_conn(struct mg_connection *conn) {
@@ -2271,18 +2339,83 @@ MG_INTERNAL void mg_remove_conn(struct mg_connection *conn) {
   if (conn->prev) conn->prev->next = conn->next;
   if (conn->next) conn->next->prev = conn->prev;
   conn->prev = conn->next = NULL;
+  mg_poll_set_remove(conn);
   conn->iface->vtable->remove_conn(conn);
 }
 
+/*
+ * Puts a connection of the manager on the set the poll loop visits. Those
+ * without MG_F_NO_POLL stay there, the others until mg_poll_set_prune().
+ */
+MG_INTERNAL void mg_poll_set_add(struct mg_connection *nc) {
+  struct mg_mgr *mgr = nc->mgr;
+  if (nc->poll_pprev != NULL) return;
+  if (nc->prev == NULL && mgr->active_connections != nc) return; /* Gone */
+  nc->poll_next = mgr->poll_set;
+  if (nc->poll_next != NULL) nc->poll_next->poll_pprev = &nc->poll_next;
+  nc->poll_pprev = &mgr->poll_set;
+  mgr->poll_set = nc;
+}
+
+static void mg_poll_set_remove(struct mg_connection *nc) {
+  if (nc->poll_pprev == NULL) return;
+  *nc->poll_pprev = nc->poll_next;
+  if (nc->poll_next != NULL) nc->poll_next->poll_pprev = nc->poll_pprev;
+  nc->poll_next = NULL;
+  nc->poll_pprev = NULL;
+}
+
+/*
+ * Takes a MG_F_NO_POLL connection off the poll set if it has nothing left for
+ * the poll loop to do. Ifaces call it once they have caught up with the
+ * connection's state, before waiting.
+ */
+MG_INTERNAL void mg_poll_set_prune(struct mg_connection *nc) {
+  if ((nc->flags & (MG_F_NO_POLL | MG_F_WANT_POLL | MG_F_SSL |
+                    MG_F_CONNECTING | MG_F_CLOSE_IMMEDIATELY |
+                    MG_F_SEND_AND_CLOSE | MG_F_RECV_AND_CLOSE)) !=
+      MG_F_NO_POLL) {
+    return;
+  }
+  /* Replies of UDP listener peers are flushed from the sweep */
+  if ((nc->flags & MG_F_UDP) && nc->listener != NULL &&
+      nc->send_mbuf.len > 0) {
+    return;
+  }
+  mg_poll_set_remove(nc);
+}
+
+/*
+ * Whether the poll loop has work for the connection that must not wait for
+ * I/O, e.g. a close or MG_EV_POLL asked for by a timer callback: timers run
+ * after the iface has polled. Ifaces don't block then.
+ */
+static int mg_poll_set_urgent(const struct mg_connection *nc) {
+  return (nc->flags & (MG_F_WANT_POLL | MG_F_CLOSE_IMMEDIATELY)) != 0;
+}
+
+void mg_want_poll(struct mg_connection *nc) {
+  nc->flags |= MG_F_WANT_POLL;
+  mg_poll_set_add(nc);
+}
+
 MG_INTERNAL void mg_call(struct mg_connection *nc,
                          mg_event_handler_t ev_handler, void *user_data, int ev,
                          void *ev_data) {
+  int eager = 0;
   if (ev_handler == NULL) {
     /*
      * If protocol handler is specified, call it. Otherwise, call user-specified
      * event handler.
      */
     ev_handler = nc->proto_handler ? nc->proto_handler : nc->handler;
+    /*
+     * Outermost call for the event, see MG_F_EAGER_SEND. MG_EV_SEND comes from
+     * a write already, the poll loop continues that one.
+     */
+    eager = (nc->flags & (MG_F_EAGER_SEND | MG_F_UDP)) == MG_F_EAGER_SEND &&
+            ev != MG_EV_SEND && ev != MG_EV_CLOSE &&
+            nc->sock != INVALID_SOCKET && mg_send_queued(nc) == 0;
   }
   if (ev != MG_EV_POLL) {
     DBG(("%p %s ev=%d ev_data=%p flags=0x%lx rmbl=%d smbl=%d", nc,
@@ -2305,6 +2438,8 @@ MG_INTERNAL void mg_call(struct mg_connection *nc,
                   (nc->flags & _MG_CALLBACK_MODIFIABLE_FLAGS_MASK);
     }
   }
+  if (eager && mg_send_queued(nc) > 0) mg_if_can_send_cb(nc);
+  if (ev != MG_EV_CLOSE) mg_poll_set_add(nc);
   if (ev != MG_EV_POLL) nc->mgr->num_calls++;
   if (ev != MG_EV_POLL) {
     DBG(("%p after %s flags=0x%lx rmbl=%d smbl=%d", nc,
@@ -2316,14 +2451,6 @@ MG_INTERNAL void mg_call(struct mg_connection *nc,
 #endif
 }
 
-MG_INTERNAL void mg_timer(struct mg_connection *c, double now) {
-  if (c->ev_timer_time > 0 && now >= c->ev_timer_time) {
-    double old_value = c->ev_timer_time;
-    c->ev_timer_time = 0;
-    mg_call(c, NULL, c->user_data, MG_EV_TIMER, &old_value);
-  }
-}
-
 MG_INTERNAL size_t recv_avail_size(struct mg_connection *conn, size_t max) {
   size_t avail;
   if (conn->recv_mbuf_limit < conn->recv_mbuf.len) return 0;
@@ -2338,7 +2465,7 @@ int mg_if_poll(struct mg_connection *nc, double now) {
     mg_close_conn(nc);
     return 0;
   } else if (nc->flags & MG_F_SEND_AND_CLOSE) {
-    if (nc->send_mbuf.len == 0) {
+    if (mg_send_queued(nc) == 0) {
       nc->flags |= MG_F_CLOSE_IMMEDIATELY;
       mg_close_conn(nc);
       return 0;
@@ -2359,30 +2486,288 @@ int mg_if_poll(struct mg_connection *nc, double now) {
     } while (recved > 0);
   }
 #endif /* MG_ENABLE_SSL */
-  mg_timer(nc, now);
-  {
+  if (!(nc->flags & MG_F_NO_POLL) || (nc->flags & MG_F_WANT_POLL)) {
     time_t now_t = (time_t) now;
+    nc->flags &= ~MG_F_WANT_POLL;
     mg_call(nc, NULL, nc->user_data, MG_EV_POLL, &now_t);
   }
   return 1;
 }
 
+/* Takes an object off the free list, NULL if it's empty. */
+static void *mg_pool_get(struct mg_pool *pool) {
+  void *p = pool->free_list;
+  if (p != NULL) {
+    pool->free_list = *(void **) p;
+    pool->num_free--;
+    pool->hits++;
+  } else {
+    pool->misses++;
+  }
+  return p;
+}
+
+/* Puts an object on the free list, returns 0 if the list is full. */
+static int mg_pool_put(struct mg_pool *pool, void *p) {
+  int max = pool->max_free > 0 ? pool->max_free : MG_POOL_MAX_FREE;
+  if (pool->num_free >= max) return 0;
+  *(void **) p = pool->free_list;
+  pool->free_list = p;
+  pool->num_free++;
+  return 1;
+}
+
+/* Returns a zeroed object of `size` bytes, as MG_CALLOC does. */
+MG_INTERNAL void *mg_pool_alloc(struct mg_pool *pool, size_t size) {
+  void *p = mg_pool_get(pool);
+  pool->obj_size = size;
+  if (p != NULL) {
+    memset(p, 0, size);
+  } else {
+    p = MG_CALLOC(1, size);
+  }
+  return p;
+}
+
+MG_INTERNAL void mg_pool_free(struct mg_pool *pool, void *p) {
+  if (p != NULL && !mg_pool_put(pool, p)) MG_FREE(p);
+}
+
+static void mg_pool_destroy(struct mg_pool *pool, void (*free_fn)(void *)) {
+  void *p;
+  while ((p = mg_pool_get(pool)) != NULL) free_fn(p);
+}
+
+/*
+ * I/O buffers end up in mbufs, which may realloc() or free() them: they must
+ * come from the mbuf allocator.
+ */
+#ifndef MBUF_REALLOC
+#define MBUF_REALLOC realloc
+#endif
+#ifndef MBUF_FREE
+#define MBUF_FREE free
+#endif
+
+static void mg_pool_free_fn(void *p) {
+  MG_FREE(p);
+}
+
+static void mg_io_buf_free_fn(void *p) {
+  MBUF_FREE(p);
+}
+
+static size_t mg_io_buf_class_size(int cls) {
+  return (size_t) MG_IO_BUF_SIZE << (2 * cls);
+}
+
+static void mg_io_buf_pools_init(struct mg_mgr *mgr) {
+  int i;
+  /* Each class keeps about the same number of bytes around */
+  for (i = 0; i < MG_NUM_IO_BUF_CLASSES; i++) {
+    mgr->io_buf_pools[i].max_free = (MG_POOL_MAX_FREE >> (2 * i)) + 1;
+    mgr->io_buf_pools[i].obj_size = mg_io_buf_class_size(i);
+  }
+}
+
+static void mg_io_buf_put(struct mg_mgr *mgr, char *buf, size_t size) {
+  int cls;
+  if (buf == NULL) return;
+  for (cls = 0; cls < MG_NUM_IO_BUF_CLASSES; cls++) {
+    if (size == mg_io_buf_class_size(cls)) break;
+  }
+  /* Buffers realloc()-ed by mbuf code to other sizes go back to the heap */
+  if (cls == MG_NUM_IO_BUF_CLASSES ||
+      !mg_pool_put(&mgr->io_buf_pools[cls], buf)) {
+    MBUF_FREE(buf);
+  }
+}
+
+/*
+ * Makes room for `len` more bytes in a connection's mbuf. Up to the largest
+ * class, buffers are swapped for pooled ones of the next class size instead
+ * of being realloc()-ed.
+ */
+MG_INTERNAL void mg_io_buf_reserve(struct mg_mgr *mgr, struct mbuf *mb,
+                                   size_t len) {
+  size_t need = mb->len + len;
+  char *buf;
+  int cls;
+  if (need <= mb->size) return;
+  if (need <= mb->size + mb->off) {
+    mbuf_resize(mb, mb->size + mb->off); /* Only moves the data down */
+    return;
+  }
+  for (cls = 0; cls < MG_NUM_IO_BUF_CLASSES; cls++) {
+    if (need <= mg_io_buf_class_size(cls)) break;
+  }
+  if (cls == MG_NUM_IO_BUF_CLASSES) {
+    mbuf_reserve(mb, len);
+    return;
+  }
+  buf = (char *) mg_pool_get(&mgr->io_buf_pools[cls]);
+  if (buf == NULL) buf = (char *) MBUF_REALLOC(NULL, mg_io_buf_class_size(cls));
+  if (buf == NULL) return;
+  if (mb->len > 0) memcpy(buf, mb->buf, mb->len);
+  mg_io_buf_put(mgr, mb->buf - mb->off, mb->size + mb->off);
+  mb->buf = buf;
+  mb->size = mg_io_buf_class_size(cls);
+  mb->off = 0;
+}
+
+/* Gives the mbuf's buffer back to the pool, discarding the data in it. */
+MG_INTERNAL void mg_io_buf_release(struct mg_mgr *mgr, struct mbuf *mb) {
+  mg_io_buf_put(mgr, mb->buf - mb->off, mb->size + mb->off);
+  mb->buf = NULL;
+  mb->len = mb->size = mb->off = 0;
+}
+
+static void mg_send_ref_done(struct mg_connection *nc,
+                             struct mg_send_ref *ref);
+
+/*
+ * UDP "connections" of a listener, hashed by peer address so that datagram
+ * demux does not depend on the number of connections in the manager.
+ */
+struct mg_udp_peers {
+  struct mg_connection **buckets;
+  size_t num_buckets; /* Power of 2 */
+  size_t num_peers;
+};
+
+static size_t mg_udp_peer_hash(const union socket_address *sa) {
+  const unsigned char *p = (const unsigned char *) &sa->sin.sin_addr;
+  size_t i, len = sizeof(sa->sin.sin_addr);
+  uint32_t h = 2166136261U ^ sa->sa.sa_family; /* FNV-1a */
+#if MG_ENABLE_IPV6
+  if (sa->sa.sa_family == AF_INET6) {
+    p = (const unsigned char *) &sa->sin6.sin6_addr;
+    len = sizeof(sa->sin6.sin6_addr);
+  }
+#endif
+  h = (h ^ (sa->sin.sin_port & 0xff)) * 16777619U;
+  h = (h ^ (sa->sin.sin_port >> 8)) * 16777619U;
+  for (i = 0; i < len; i++) h = (h ^ p[i]) * 16777619U;
+  return h;
+}
+
+static int mg_udp_peer_eq(const union socket_address *a,
+                          const union socket_address *b) {
+  if (a->sa.sa_family != b->sa.sa_family) return 0;
+#if MG_ENABLE_IPV6
+  if (a->sa.sa_family == AF_INET6) {
+    return a->sin6.sin6_port == b->sin6.sin6_port &&
+           memcmp(&a->sin6.sin6_addr, &b->sin6.sin6_addr,
+                  sizeof(a->sin6.sin6_addr)) == 0;
+  }
+#endif
+  return a->sin.sin_port == b->sin.sin_port &&
+         a->sin.sin_addr.s_addr == b->sin.sin_addr.s_addr;
+}
+
+static struct mg_connection *mg_udp_peer_find(struct mg_connection *lc,
+                                              const union socket_address *sa) {
+  struct mg_udp_peers *t = lc->udp_peers;
+  struct mg_connection *nc = NULL;
+  if (t != NULL) {
+    nc = t->buckets[mg_udp_peer_hash(sa) & (t->num_buckets - 1)];
+    while (nc != NULL && !mg_udp_peer_eq(&nc->sa, sa)) nc = nc->udp_peer_next;
+  }
+  return nc;
+}
+
+static void mg_udp_peer_link(struct mg_connection **bucket,
+                             struct mg_connection *nc) {
+  nc->udp_peer_next = *bucket;
+  nc->udp_peer_pprev = bucket;
+  if (*bucket != NULL) (*bucket)->udp_peer_pprev = &nc->udp_peer_next;
+  *bucket = nc;
+}
+
+/* Adds nc to the table of its listener. Returns 0 if out of memory. */
+static int mg_udp_peer_add(struct mg_connection *lc, struct mg_connection *nc) {
+  struct mg_udp_peers *t = lc->udp_peers;
+  size_t h = mg_udp_peer_hash(&nc->sa);
+  if (t == NULL) {
+    t = lc->udp_peers = (struct mg_udp_peers *) MG_CALLOC(1, sizeof(*t));
+    if (t == NULL) return 0;
+  }
+  if (t->num_peers >= t->num_buckets) {
+    size_t i, n = (t->num_buckets > 0 ? t->num_buckets * 2 : 16);
+    struct mg_connection **b, *c, *next;
+    b = (struct mg_connection **) MG_CALLOC(n, sizeof(*b));
+    if (b == NULL) return 0;
+    for (i = 0; i < t->num_buckets; i++) {
+      for (c = t->buckets[i]; c != NULL; c = next) {
+        next = c->udp_peer_next;
+        mg_udp_peer_link(&b[mg_udp_peer_hash(&c->sa) & (n - 1)], c);
+      }
+    }
+    MG_FREE(t->buckets);
+    t->buckets = b;
+    t->num_buckets = n;
+  }
+  mg_udp_peer_link(&t->buckets[h & (t->num_buckets - 1)], nc);
+  t->num_peers++;
+  return 1;
+}
+
+static void mg_udp_peer_remove(struct mg_connection *nc) {
+  if (nc->udp_peer_pprev == NULL) return;
+  *nc->udp_peer_pprev = nc->udp_peer_next;
+  if (nc->udp_peer_next != NULL) {
+    nc->udp_peer_next->udp_peer_pprev = nc->udp_peer_pprev;
+  }
+  nc->udp_peer_next = NULL;
+  nc->udp_peer_pprev = NULL;
+  /* The listener still has a table while peers are linked to it */
+  nc->listener->udp_peers->num_peers--;
+}
+
+/* Detaches the peers that are still around, they outlive the listener. */
+static void mg_udp_peers_free(struct mg_connection *lc) {
+  struct mg_udp_peers *t = lc->udp_peers;
+  struct mg_connection *c, *next;
+  size_t i;
+  for (i = 0; i < t->num_buckets; i++) {
+    for (c = t->buckets[i]; c != NULL; c = next) {
+      next = c->udp_peer_next;
+      c->udp_peer_next = NULL;
+      c->udp_peer_pprev = NULL;
+    }
+  }
+  MG_FREE(t->buckets);
+  MG_FREE(t);
+  lc->udp_peers = NULL;
+}
+
 void mg_destroy_conn(struct mg_connection *conn, int destroy_if) {
   if (conn->sock != INVALID_SOCKET) { /* Don't print timer-only conns */
     LOG(LL_DEBUG, ("%p 0x%lx %d", conn, conn->flags, destroy_if));
   }
   if (destroy_if) conn->iface->vtable->destroy_conn(conn);
+  mg_udp_peer_remove(conn);
+  if (conn->udp_peers != NULL) mg_udp_peers_free(conn);
+#if MG_ENABLE_MSG_QUEUE
+  mg_conn_id_remove(conn);
+#endif
+  while (conn->timers != NULL) mg_timer_cancel(conn->timers);
+  MG_FREE(conn->ev_timer);
+  mg_set_idle(conn, 0);
   if (conn->proto_data != NULL && conn->proto_data_destructor != NULL) {
     conn->proto_data_destructor(conn->proto_data);
   }
 #if MG_ENABLE_SSL
   mg_ssl_if_conn_free(conn);
 #endif
-  mbuf_free(&conn->recv_mbuf);
-  mbuf_free(&conn->send_mbuf);
+  MG_FREE(conn->sock_opts);
+  mg_io_buf_release(conn->mgr, &conn->recv_mbuf);
+  mg_io_buf_release(conn->mgr, &conn->send_mbuf);
+  while (conn->send_refs.head != NULL) {
+    mg_send_ref_done(conn, conn->send_refs.head);
+  }
 
-  memset(conn, 0, sizeof(*conn));
-  MG_FREE(conn);
+  mg_pool_free(&conn->mgr->conn_pool, conn);
 }
 
 void mg_close_conn(struct mg_connection *conn) {
@@ -2422,6 +2807,16 @@ void mg_mgr_init_opt(struct mg_mgr *m, void *user_data,
   m->ctl[0] = m->ctl[1] = INVALID_SOCKET;
 #endif
   m->user_data = user_data;
+  mg_timer_wheel_init(m);
+  mg_io_buf_pools_init(m);
+#if MG_ENABLE_MSG_QUEUE
+  mg_msg_queue_init(m);
+#endif
+#if MG_ENABLE_HTTP
+  m->idle[MG_HTTP_IDLE_HEADER].timeout = MG_HTTP_HEADER_TIMEOUT;
+  m->idle[MG_HTTP_IDLE_BODY].timeout = MG_HTTP_BODY_TIMEOUT;
+  m->idle[MG_HTTP_IDLE_KEEP_ALIVE].timeout = MG_HTTP_KEEP_ALIVE_TIMEOUT;
+#endif
 
 #ifdef _WIN32
   {
@@ -2477,7 +2872,9 @@ void mg_mgr_free(struct mg_mgr *m) {
 
 #if MG_ENABLE_BROADCAST
   if (m->ctl[0] != INVALID_SOCKET) closesocket(m->ctl[0]);
-  if (m->ctl[1] != INVALID_SOCKET) closesocket(m->ctl[1]);
+  if (m->ctl[1] != INVALID_SOCKET && m->ctl[1] != m->ctl[0]) {
+    closesocket(m->ctl[1]);
+  }
   m->ctl[0] = m->ctl[1] = INVALID_SOCKET;
 #endif
 
@@ -2496,6 +2893,19 @@ void mg_mgr_free(struct mg_mgr *m) {
     MG_FREE(m->ifaces);
   }
 
+  mg_timer_wheel_free(m);
+#if MG_ENABLE_MSG_QUEUE
+  mg_msg_queue_free(m);
+#endif
+  mg_pool_destroy(&m->conn_pool, mg_pool_free_fn);
+  mg_pool_destroy(&m->proto_data_pool, mg_pool_free_fn);
+  mg_pool_destroy(&m->send_ref_pool, mg_pool_free_fn);
+  {
+    int i;
+    for (i = 0; i < MG_NUM_IO_BUF_CLASSES; i++) {
+      mg_pool_destroy(&m->io_buf_pools[i], mg_io_buf_free_fn);
+    }
+  }
   MG_FREE((char *) m->nameserver);
 }
 
@@ -2505,10 +2915,50 @@ int mg_mgr_poll(struct mg_mgr *m, int timeout_ms) {
   for (i = 0; i < m->num_ifaces; i++) {
     m->ifaces[i]->vtable->poll(m->ifaces[i], timeout_ms);
   }
+#if MG_ENABLE_MSG_QUEUE
+  mg_msg_queue_run(m);
+#endif
+  mg_timer_run(m, mg_time());
+  mg_idle_run(m, mg_time());
 
   return (m->num_calls - num_calls_before);
 }
 
+static unsigned long mg_pool_bytes(const struct mg_pool *pool) {
+  return (unsigned long) pool->num_free * pool->obj_size;
+}
+
+void mg_mgr_mem_stats(struct mg_mgr *mgr, struct mg_mem_stats *st) {
+  struct mg_connection *nc;
+  struct mg_send_ref *ref;
+  int i, parked;
+  memset(st, 0, sizeof(*st));
+  for (nc = mgr->active_connections; nc != NULL; nc = nc->next) {
+    /* What comes and goes with the traffic */
+    unsigned long n = nc->recv_mbuf.size + nc->recv_mbuf.off +
+                      nc->send_mbuf.size + nc->send_mbuf.off;
+    for (ref = nc->send_refs.head; ref != NULL; ref = ref->next) {
+      n += sizeof(*ref);
+    }
+    if (nc->proto_data != NULL) n += mgr->proto_data_pool.obj_size;
+    parked = (n == 0);
+    n += sizeof(*nc);
+    if (nc->sock_opts != NULL) n += sizeof(*nc->sock_opts);
+    st->num_conns++;
+    st->conn_bytes += n;
+    if (parked) {
+      st->num_parked++;
+      st->parked_bytes += n;
+    }
+  }
+  st->pool_bytes = mg_pool_bytes(&mgr->conn_pool) +
+                   mg_pool_bytes(&mgr->proto_data_pool) +
+                   mg_pool_bytes(&mgr->send_ref_pool);
+  for (i = 0; i < MG_NUM_IO_BUF_CLASSES; i++) {
+    st->pool_bytes += mg_pool_bytes(&mgr->io_buf_pools[i]);
+  }
+}
+
 int mg_vprintf(struct mg_connection *nc, const char *fmt, va_list ap) {
   char mem[MG_VPRINTF_BUFFER_SIZE], *buf = mem;
   int len;
@@ -2575,7 +3025,8 @@ MG_INTERNAL struct mg_connection *mg_create_connection_base(
     struct mg_add_sock_opts opts) {
   struct mg_connection *conn;
 
-  if ((conn = (struct mg_connection *) MG_CALLOC(1, sizeof(*conn))) != NULL) {
+  conn = (struct mg_connection *) mg_pool_alloc(&mgr->conn_pool, sizeof(*conn));
+  if (conn != NULL) {
     conn->sock = INVALID_SOCKET;
     conn->handler = callback;
     conn->mgr = mgr;
@@ -2603,7 +3054,7 @@ MG_INTERNAL struct mg_connection *mg_create_connection(
   struct mg_connection *conn = mg_create_connection_base(mgr, callback, opts);
 
   if (conn != NULL && !conn->iface->vtable->create_conn(conn)) {
-    MG_FREE(conn);
+    mg_pool_free(&mgr->conn_pool, conn);
     conn = NULL;
   }
   if (conn == NULL) {
@@ -2745,6 +3196,7 @@ struct mg_connection *mg_if_accept_new_conn(struct mg_connection *lc) {
   nc->recv_mbuf_limit = lc->recv_mbuf_limit;
   nc->iface = lc->iface;
   if (lc->flags & MG_F_SSL) nc->flags |= MG_F_SSL;
+  nc->flags |= lc->flags & (MG_F_EAGER_SEND | MG_F_NO_POLL);
   mg_add_conn(nc->mgr, nc);
   LOG(LL_DEBUG, ("%p %p %d %#x", lc, nc, (int) nc->sock, (int) nc->flags));
   return nc;
@@ -2773,7 +3225,113 @@ void mg_if_accept_tcp_cb(struct mg_connection *nc, union socket_address *sa,
 
 void mg_send(struct mg_connection *nc, const void *buf, int len) {
   nc->last_io_time = (time_t) mg_time();
+  if (len > 0) mg_io_buf_reserve(nc->mgr, &nc->send_mbuf, len);
   mbuf_append(&nc->send_mbuf, buf, len);
+  mg_poll_set_add(nc);
+}
+
+void mg_send_ref(struct mg_connection *nc, const void *buf, size_t len,
+                 void (*free_cb)(void *buf)) {
+  struct mg_send_chain *chain = &nc->send_refs;
+  struct mg_send_ref *ref = NULL;
+  if (len > 0 && nc->iface->vtable->tcp_sendv != NULL &&
+      !(nc->flags & (MG_F_UDP | MG_F_SSL | MG_F_LISTENING))) {
+    ref = (struct mg_send_ref *) mg_pool_alloc(&nc->mgr->send_ref_pool,
+                                               sizeof(*ref));
+  }
+  if (ref == NULL) {
+    mg_send(nc, buf, (int) len);
+    if (free_cb != NULL) free_cb((void *) buf);
+    return;
+  }
+  nc->last_io_time = (time_t) mg_time();
+  ref->pos = nc->send_mbuf.len - chain->mbuf_pos;
+  ref->buf = (const char *) buf;
+  ref->len = len;
+  ref->data = (void *) buf;
+  ref->free_cb = free_cb;
+  if (chain->tail != NULL) {
+    chain->tail->next = ref;
+  } else {
+    chain->head = ref;
+  }
+  chain->tail = ref;
+  chain->mbuf_pos = nc->send_mbuf.len;
+  chain->len += len;
+  mg_poll_set_add(nc);
+}
+
+size_t mg_send_queued(const struct mg_connection *nc) {
+  return nc->send_mbuf.len + nc->send_refs.len;
+}
+
+/* Unlinks the head of the send chain and frees it. */
+static void mg_send_ref_done(struct mg_connection *nc,
+                             struct mg_send_ref *ref) {
+  struct mg_send_chain *chain = &nc->send_refs;
+  chain->head = ref->next;
+  if (chain->head == NULL) {
+    chain->tail = NULL;
+    chain->mbuf_pos = 0;
+  } else {
+    chain->mbuf_pos -= ref->pos;
+  }
+  chain->len -= ref->len;
+  if (ref->free_cb != NULL) ref->free_cb(ref->data);
+  mg_pool_free(&nc->mgr->send_ref_pool, ref);
+}
+
+/* Max buffers handed to a single tcp_sendv() */
+#ifndef MG_SEND_IOV_MAX
+#define MG_SEND_IOV_MAX 32
+#endif
+
+/*
+ * Sends as much of send_mbuf and the chain as tcp_sendv() takes, in the
+ * order they were queued.
+ */
+static int mg_send_chain_flush(struct mg_connection *nc) {
+  struct mg_str bufs[MG_SEND_IOV_MAX];
+  struct mg_send_ref *ref = nc->send_refs.head;
+  const char *mb = nc->send_mbuf.buf;
+  size_t left = nc->send_mbuf.len, n;
+  int num_bufs = 0, res;
+
+  while (num_bufs < MG_SEND_IOV_MAX) {
+    n = (ref != NULL && ref->pos < left ? ref->pos : left);
+    if (n > 0) {
+      bufs[num_bufs++] = mg_mk_str_n(mb, n);
+      mb += n;
+      left -= n;
+    }
+    if (ref == NULL || num_bufs == MG_SEND_IOV_MAX) break;
+    bufs[num_bufs++] = mg_mk_str_n(ref->buf, ref->len);
+    ref = ref->next;
+  }
+  res = nc->iface->vtable->tcp_sendv(nc, bufs, num_bufs);
+
+  /* Consume what was sent, mbuf bytes in front of each reference first */
+  for (n = (res > 0 ? (size_t) res : 0), left = 0; n > 0;) {
+    size_t k;
+    ref = nc->send_refs.head;
+    if (ref == NULL) {
+      left += n;
+      break;
+    }
+    k = (ref->pos < n ? ref->pos : n);
+    ref->pos -= k;
+    nc->send_refs.mbuf_pos -= k;
+    left += k;
+    n -= k;
+    k = (ref->len < n ? ref->len : n);
+    ref->buf += k;
+    ref->len -= k;
+    nc->send_refs.len -= k;
+    n -= k;
+    if (ref->len == 0) mg_send_ref_done(nc, ref);
+  }
+  mbuf_remove(&nc->send_mbuf, left);
+  return res;
 }
 
 static int mg_recv_tcp(struct mg_connection *nc, char *buf, size_t len);
@@ -2793,11 +3351,13 @@ static int mg_do_recv(struct mg_connection *nc) {
       res = -2;
       break;
     }
-    if (nc->recv_mbuf.size < nc->recv_mbuf.len + len) {
-      mbuf_resize(&nc->recv_mbuf, nc->recv_mbuf.len + len);
-    }
+    mg_io_buf_reserve(nc->mgr, &nc->recv_mbuf, len);
     buf = nc->recv_mbuf.buf + nc->recv_mbuf.len;
-    len = nc->recv_mbuf.size - nc->recv_mbuf.len;
+    len = recv_avail_size(nc, nc->recv_mbuf.size - nc->recv_mbuf.len);
+    if (len == 0) {
+      res = -1; /* Out of memory */
+      break;
+    }
     if (nc->flags & MG_F_UDP) {
       res = mg_recv_udp(nc, buf, len);
     } else {
@@ -2845,12 +3405,112 @@ static int mg_recv_tcp(struct mg_connection *nc, char *buf, size_t len) {
       mg_hexdump_connection(nc, nc->mgr->hexdump_file, buf, n, MG_EV_RECV);
     }
 #endif
-    mbuf_trim(&nc->recv_mbuf);
     mg_call(nc, NULL, nc->user_data, MG_EV_RECV, &n);
   } else if (n < 0) {
     nc->flags |= MG_F_CLOSE_IMMEDIATELY;
   }
-  mbuf_trim(&nc->recv_mbuf);
+  /* Handler has consumed everything, don't sit on the buffer */
+  if (nc->recv_mbuf.len == 0) mg_io_buf_release(nc->mgr, &nc->recv_mbuf);
+  return n;
+}
+
+/*
+ * Returns the connection of a listener `lc` for datagrams from `sa`,
+ * creating it if this is a new peer. NULL if out of memory.
+ */
+static struct mg_connection *mg_udp_peer_get(struct mg_connection *lc,
+                                             union socket_address *sa) {
+  struct mg_connection *nc = mg_udp_peer_find(lc, sa);
+  if (nc == NULL) {
+    struct mg_add_sock_opts opts;
+    memset(&opts, 0, sizeof(opts));
+    /* Create fake connection w/out sock initialization */
+    nc = mg_create_connection_base(lc->mgr, lc->handler, opts);
+    if (nc != NULL) {
+      nc->sock = lc->sock;
+      nc->listener = lc;
+      nc->sa = *sa;
+      nc->proto_handler = lc->proto_handler;
+      nc->user_data = lc->user_data;
+      nc->recv_mbuf_limit = lc->recv_mbuf_limit;
+      nc->flags = MG_F_UDP;
+      /*
+       * Long-lived UDP "connections" i.e. interactions that involve more
+       * than one request and response are rare, most are transactional:
+       * response is sent and the "connection" is closed. Or - should be.
+       * But users (including ourselves) tend to forget about that part,
+       * because UDP is connectionless and one does not think about
+       * processing a UDP request as handling a connection that needs to be
+       * closed. Thus, we begin with SEND_AND_CLOSE flag set, which should
+       * be a reasonable default for most use cases, but it is possible to
+       * turn it off the connection should be kept alive after processing.
+       */
+      nc->flags |= MG_F_SEND_AND_CLOSE;
+      if (mg_udp_peer_add(lc, nc)) {
+        mg_add_conn(lc->mgr, nc);
+        mg_call(nc, NULL, nc->user_data, MG_EV_ACCEPT, &nc->sa);
+      } else {
+        mg_destroy_conn(nc, 0 /* destroy_if */);
+        nc = NULL;
+      }
+    }
+  }
+  return nc;
+}
+
+/* Delivers a datagram received on `lc` to `nc`, which is lc or its peer. */
+static void mg_recv_udp_deliver(struct mg_connection *lc,
+                                struct mg_connection *nc, char *buf, int n) {
+  DBG(("%p <- %d bytes from %s:%d", nc, n, inet_ntoa(nc->sa.sin.sin_addr),
+       ntohs(nc->sa.sin.sin_port)));
+  if (nc == lc) {
+    nc->recv_mbuf.len += n;
+  } else {
+    mg_io_buf_reserve(nc->mgr, &nc->recv_mbuf, n);
+    mbuf_append(&nc->recv_mbuf, buf, n);
+  }
+  lc->last_io_time = nc->last_io_time = (time_t) mg_time();
+#if !defined(NO_LIBC) && MG_ENABLE_HEXDUMP
+  if (nc->mgr && nc->mgr->hexdump_file != NULL) {
+    mg_hexdump_connection(nc, nc->mgr->hexdump_file, buf, n, MG_EV_RECV);
+  }
+#endif
+  if (n != 0) {
+    mg_call(nc, NULL, nc->user_data, MG_EV_RECV, &n);
+  }
+}
+
+/*
+ * Drains up to MG_UDP_BATCH datagrams of up to MG_UDP_IO_SIZE bytes (or
+ * `len`, if less room is left under the recv limit) from a listener with one
+ * udp_recv_batch(). lc->recv_mbuf holds them while they are handed out to the
+ * peers; the batch is capped to fit the largest pooled I/O buffer, so that
+ * this takes no heap calls.
+ */
+static int mg_recv_udp_batch(struct mg_connection *lc, size_t len) {
+  struct mg_udp_msg msgs[MG_UDP_BATCH];
+  size_t slot = len < MG_UDP_IO_SIZE ? len : MG_UDP_IO_SIZE, avail;
+  size_t max_msgs = mg_io_buf_class_size(MG_NUM_IO_BUF_CLASSES - 1) / slot;
+  int i, num_msgs = MG_UDP_BATCH, n = 0;
+  if (max_msgs == 0) max_msgs = 1;
+  if ((size_t) num_msgs > max_msgs) num_msgs = (int) max_msgs;
+  mg_io_buf_reserve(lc->mgr, &lc->recv_mbuf, num_msgs * slot);
+  avail = lc->recv_mbuf.size - lc->recv_mbuf.len;
+  if (avail < num_msgs * slot) num_msgs = (int) (avail / slot);
+  for (i = 0; i < num_msgs; i++) {
+    msgs[i].buf = lc->recv_mbuf.buf + lc->recv_mbuf.len + i * slot;
+    msgs[i].len = slot;
+  }
+  num_msgs = lc->iface->vtable->udp_recv_batch(lc, msgs, num_msgs);
+  if (num_msgs < 0) {
+    lc->flags |= MG_F_CLOSE_IMMEDIATELY;
+    return -1;
+  }
+  for (i = 0; i < num_msgs; i++) {
+    struct mg_connection *nc = mg_udp_peer_get(lc, &msgs[i].sa);
+    if (nc != NULL) mg_recv_udp_deliver(lc, nc, msgs[i].buf, (int) msgs[i].len);
+    n += (int) msgs[i].len;
+  }
   return n;
 }
 
@@ -2859,77 +3519,47 @@ static int mg_recv_udp(struct mg_connection *nc, char *buf, size_t len) {
   struct mg_connection *lc = nc;
   union socket_address sa;
   size_t sa_len = sizeof(sa);
+  if ((nc->flags & MG_F_LISTENING) && len > 0 &&
+      nc->iface->vtable->udp_recv_batch != NULL) {
+    n = mg_recv_udp_batch(lc, len);
+    goto out;
+  }
   n = nc->iface->vtable->udp_recv(lc, buf, len, &sa, &sa_len);
   if (n < 0) {
     lc->flags |= MG_F_CLOSE_IMMEDIATELY;
     goto out;
   }
   if (nc->flags & MG_F_LISTENING) {
-    /*
-     * Do we have an existing connection for this source?
-     * This is very inefficient for long connection lists.
-     */
-    lc = nc;
-    for (nc = mg_next(lc->mgr, NULL); nc != NULL; nc = mg_next(lc->mgr, nc)) {
-      if (memcmp(&nc->sa.sa, &sa.sa, sa_len) == 0 && nc->listener == lc) {
-        break;
-      }
-    }
-    if (nc == NULL) {
-      struct mg_add_sock_opts opts;
-      memset(&opts, 0, sizeof(opts));
-      /* Create fake connection w/out sock initialization */
-      nc = mg_create_connection_base(lc->mgr, lc->handler, opts);
-      if (nc != NULL) {
-        nc->sock = lc->sock;
-        nc->listener = lc;
-        nc->sa = sa;
-        nc->proto_handler = lc->proto_handler;
-        nc->user_data = lc->user_data;
-        nc->recv_mbuf_limit = lc->recv_mbuf_limit;
-        nc->flags = MG_F_UDP;
-        /*
-         * Long-lived UDP "connections" i.e. interactions that involve more
-         * than one request and response are rare, most are transactional:
-         * response is sent and the "connection" is closed. Or - should be.
-         * But users (including ourselves) tend to forget about that part,
-         * because UDP is connectionless and one does not think about
-         * processing a UDP request as handling a connection that needs to be
-         * closed. Thus, we begin with SEND_AND_CLOSE flag set, which should
-         * be a reasonable default for most use cases, but it is possible to
-         * turn it off the connection should be kept alive after processing.
-         */
-        nc->flags |= MG_F_SEND_AND_CLOSE;
-        mg_add_conn(lc->mgr, nc);
-        mg_call(nc, NULL, nc->user_data, MG_EV_ACCEPT, &nc->sa);
-      }
-    }
-  }
-  if (nc != NULL) {
-    DBG(("%p <- %d bytes from %s:%d", nc, n, inet_ntoa(nc->sa.sin.sin_addr),
-         ntohs(nc->sa.sin.sin_port)));
-    if (nc == lc) {
-      nc->recv_mbuf.len += n;
-    } else {
-      mbuf_append(&nc->recv_mbuf, buf, n);
-    }
-    mbuf_trim(&lc->recv_mbuf);
-    lc->last_io_time = nc->last_io_time = (time_t) mg_time();
-#if !defined(NO_LIBC) && MG_ENABLE_HEXDUMP
-    if (nc->mgr && nc->mgr->hexdump_file != NULL) {
-      mg_hexdump_connection(nc, nc->mgr->hexdump_file, buf, n, MG_EV_RECV);
-    }
-#endif
-    if (n != 0) {
-      mg_call(nc, NULL, nc->user_data, MG_EV_RECV, &n);
-    }
+    /* Do we have an existing connection for this source? */
+    nc = mg_udp_peer_get(lc, &sa);
   }
+  if (nc != NULL) mg_recv_udp_deliver(lc, nc, buf, n);
 
 out:
-  mbuf_free(&lc->recv_mbuf);
+  mg_io_buf_release(lc->mgr, &lc->recv_mbuf);
   return n;
 }
 
+/*
+ * Accounts for `n` bytes sent from send_mbuf, which starts at `buf`.
+ * NULL `buf`: the bytes are already gone from send_mbuf.
+ */
+static void mg_if_sent(struct mg_connection *nc, const char *buf, int n) {
+#if !defined(NO_LIBC) && MG_ENABLE_HEXDUMP
+  if (n > 0 && buf != NULL && nc->mgr && nc->mgr->hexdump_file != NULL) {
+    mg_hexdump_connection(nc, nc->mgr->hexdump_file, buf, n, MG_EV_SEND);
+  }
+#endif
+  if (n < 0) {
+    nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+  } else if (n > 0) {
+    nc->last_io_time = (time_t) mg_time();
+    if (buf != NULL) mbuf_remove(&nc->send_mbuf, n);
+    if (nc->send_mbuf.len == 0) mg_io_buf_release(nc->mgr, &nc->send_mbuf);
+  }
+  if (n != 0) mg_call(nc, NULL, nc->user_data, MG_EV_SEND, &n);
+}
+
 void mg_if_can_send_cb(struct mg_connection *nc) {
   int n = 0;
   const char *buf = nc->send_mbuf.buf;
@@ -2964,7 +3594,11 @@ void mg_if_can_send_cb(struct mg_connection *nc) {
     }
   } else
 #endif
-      if (len > 0) {
+      if (nc->send_refs.head != NULL) {
+    n = mg_send_chain_flush(nc);
+    DBG(("%p -> %d bytes (chain)", nc, n));
+    buf = NULL; /* Not contiguous, the hexdump is skipped */
+  } else if (len > 0) {
     if (nc->flags & MG_F_UDP) {
       n = nc->iface->vtable->udp_send(nc, buf, len);
     } else {
@@ -2973,19 +3607,11 @@ void mg_if_can_send_cb(struct mg_connection *nc) {
     DBG(("%p -> %d bytes", nc, n));
   }
 
-#if !defined(NO_LIBC) && MG_ENABLE_HEXDUMP
-  if (n > 0 && nc->mgr && nc->mgr->hexdump_file != NULL) {
-    mg_hexdump_connection(nc, nc->mgr->hexdump_file, buf, n, MG_EV_SEND);
-  }
-#endif
-  if (n < 0) {
-    nc->flags |= MG_F_CLOSE_IMMEDIATELY;
-  } else if (n > 0) {
-    nc->last_io_time = (time_t) mg_time();
-    mbuf_remove(&nc->send_mbuf, n);
-    mbuf_trim(&nc->send_mbuf);
-  }
-  if (n != 0) mg_call(nc, NULL, nc->user_data, MG_EV_SEND, &n);
+  mg_if_sent(nc, buf, n);
+}
+
+void mg_if_sent_cb(struct mg_connection *nc, int num_sent) {
+  mg_if_sent(nc, nc->send_mbuf.buf, num_sent);
 }
 
 /*
@@ -3042,6 +3668,7 @@ static void resolve_cb(struct mg_dns_message *msg, void *data,
   int failure = -1;
 
   nc->flags &= ~MG_F_RESOLVING;
+  mg_timer_unpark(nc);
   if (msg != NULL) {
     /*
      * Take the first DNS A answer and run...
@@ -3093,6 +3720,15 @@ void mg_ev_handler_empty(struct mg_connection *c, int ev,
 #endif
 }
 
+/* Keeps a copy of the socket options for when the socket is opened */
+static void mg_set_sock_opts(struct mg_connection *nc,
+                             const struct mg_sock_opts *opts) {
+  static const struct mg_sock_opts none;
+  if (memcmp(opts, &none, sizeof(none)) == 0) return;
+  nc->sock_opts = (struct mg_sock_opts *) MG_MALLOC(sizeof(*opts));
+  if (nc->sock_opts != NULL) *nc->sock_opts = *opts;
+}
+
 struct mg_connection *mg_connect_opt(struct mg_mgr *mgr, const char *address,
                                      MG_CB(mg_event_handler_t callback,
                                            void *user_data),
@@ -3120,6 +3756,7 @@ struct mg_connection *mg_connect_opt(struct mg_mgr *mgr, const char *address,
 
   nc->flags |= opts.flags & _MG_ALLOWED_CONNECT_FLAGS_MASK;
   nc->flags |= (proto == SOCK_DGRAM) ? MG_F_UDP : 0;
+  mg_set_sock_opts(nc, &opts.sock_opts);
 #if MG_ENABLE_CALLBACK_USERDATA
   nc->user_data = user_data;
 #else
@@ -3235,6 +3872,8 @@ struct mg_connection *mg_bind_opt(struct mg_mgr *mgr, const char *address,
 
   nc->sa = sa;
   nc->flags |= MG_F_LISTENING;
+  nc->accept_budget = opts.accept_budget;
+  mg_set_sock_opts(nc, &opts.sock_opts);
   if (proto == SOCK_DGRAM) nc->flags |= MG_F_UDP;
 
 #if MG_ENABLE_SSL
@@ -3284,9 +3923,245 @@ struct mg_connection *mg_next(struct mg_mgr *s, struct mg_connection *conn) {
   return conn == NULL ? s->active_connections : conn->next;
 }
 
+#if MG_ENABLE_MSG_QUEUE
+/* Capacity of the mg_post() queue, a power of 2 */
+#ifndef MG_MSG_QUEUE_SIZE
+#define MG_MSG_QUEUE_SIZE 1024
+#endif
+
+/* Max messages delivered per mg_mgr_poll() */
+#ifndef MG_MSG_QUEUE_BATCH
+#define MG_MSG_QUEUE_BATCH 256
+#endif
+
+struct mg_msg_cell {
+  size_t seq; /* Position the cell is free for (pos), or holds a message for
+                 (pos + 1), see mg_post() */
+  unsigned long conn_id;
+  mg_event_handler_t cb;
+  void *data;
+  void (*free_cb)(void *data);
+};
+
+/*
+ * Bounded MPSC queue after D. Vyukov: producers claim a position by bumping
+ * `tail` with CAS, the IO thread consumes from `head`. The sequence number of
+ * each cell tells whose turn it is, so there are no locks.
+ */
+struct mg_msg_queue {
+  size_t tail;                   /* Next position to claim, producers */
+  int signaled;                  /* A wakeup is pending on mgr->ctl */
+  char pad[64];                  /* Keep the two sides on separate lines */
+  size_t head;                   /* Next position to consume, IO thread */
+  struct mg_msg_cell cells[MG_MSG_QUEUE_SIZE];
+};
+
+/* Connections that have an id, hashed by it */
+struct mg_conn_ids {
+  struct mg_connection **buckets;
+  size_t num_buckets; /* Power of 2 */
+  size_t num_conns;
+  unsigned long last_id;
+};
+
+MG_INTERNAL void mg_msg_queue_init(struct mg_mgr *mgr) {
+  struct mg_msg_queue *q =
+      (struct mg_msg_queue *) MG_CALLOC(1, sizeof(*mgr->msgs));
+  size_t i;
+  if (q == NULL) return;
+  for (i = 0; i < MG_MSG_QUEUE_SIZE; i++) q->cells[i].seq = i;
+  mgr->msgs = q;
+}
+
+/* Interrupts the IO thread's mg_mgr_poll() */
+static void mg_msg_queue_wake(struct mg_mgr *mgr) {
+  size_t dummy = 0;
+  if (mgr->ctl[0] == INVALID_SOCKET) return;
+  if (mgr->ctl[0] == mgr->ctl[1]) {
+    uint64_t one = 1; /* eventfd */
+    dummy = write(mgr->ctl[0], &one, sizeof(one));
+  } else {
+    dummy = MG_SEND_FUNC(mgr->ctl[0], "", 1, 0);
+  }
+  (void) dummy; /* https://gcc.gnu.org/bugzilla/show_bug.cgi?id=25509 */
+}
+
+int mg_post(struct mg_mgr *mgr, unsigned long conn_id, mg_event_handler_t cb,
+            void *data, void (*free_cb)(void *data)) {
+  struct mg_msg_queue *q = mgr->msgs;
+  struct mg_msg_cell *cell;
+  size_t pos, seq;
+  if (q == NULL) return 0;
+  pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+  for (;;) {
+    cell = &q->cells[pos & (MG_MSG_QUEUE_SIZE - 1)];
+    seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    if (seq == pos) {
+      if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if ((ptrdiff_t)(seq - pos) < 0) {
+      return 0; /* Still holds the message from a lap ago: full */
+    } else {
+      pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    }
+  }
+  cell->conn_id = conn_id;
+  cell->cb = cb;
+  cell->data = data;
+  cell->free_cb = free_cb;
+  __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+  if (!__atomic_exchange_n(&q->signaled, 1, __ATOMIC_SEQ_CST)) {
+    mg_msg_queue_wake(mgr);
+  }
+  return 1;
+}
+
+static struct mg_connection *mg_conn_id_find(struct mg_mgr *mgr,
+                                             unsigned long id) {
+  struct mg_conn_ids *t = mgr->conn_ids;
+  struct mg_connection *nc = NULL;
+  if (t != NULL) {
+    nc = t->buckets[id & (t->num_buckets - 1)];
+    while (nc != NULL && nc->id != id) nc = nc->id_next;
+  }
+  return nc;
+}
+
+unsigned long mg_conn_id(struct mg_connection *nc) {
+  struct mg_conn_ids *t = nc->mgr->conn_ids;
+  struct mg_connection **b;
+  if (nc->id != 0) return nc->id;
+  if (t == NULL) {
+    t = nc->mgr->conn_ids = (struct mg_conn_ids *) MG_CALLOC(1, sizeof(*t));
+    if (t == NULL) return 0;
+  }
+  if (t->num_conns >= t->num_buckets) {
+    size_t i, n = (t->num_buckets > 0 ? t->num_buckets * 2 : 64);
+    struct mg_connection *c, *next;
+    b = (struct mg_connection **) MG_CALLOC(n, sizeof(*b));
+    if (b == NULL) return 0;
+    for (i = 0; i < t->num_buckets; i++) {
+      for (c = t->buckets[i]; c != NULL; c = next) {
+        next = c->id_next;
+        c->id_next = b[c->id & (n - 1)];
+        b[c->id & (n - 1)] = c;
+      }
+    }
+    MG_FREE(t->buckets);
+    t->buckets = b;
+    t->num_buckets = n;
+  }
+  if (++t->last_id == 0) t->last_id++;
+  nc->id = t->last_id;
+  b = &t->buckets[nc->id & (t->num_buckets - 1)];
+  nc->id_next = *b;
+  *b = nc;
+  t->num_conns++;
+  return nc->id;
+}
+
+MG_INTERNAL void mg_conn_id_remove(struct mg_connection *nc) {
+  struct mg_conn_ids *t = nc->mgr->conn_ids;
+  struct mg_connection **p;
+  if (nc->id == 0 || t == NULL) return;
+  p = &t->buckets[nc->id & (t->num_buckets - 1)];
+  while (*p != NULL && *p != nc) p = &(*p)->id_next;
+  if (*p == nc) {
+    *p = nc->id_next;
+    t->num_conns--;
+  }
+  nc->id = 0;
+  nc->id_next = NULL;
+}
+
+static void mg_msg_deliver(struct mg_mgr *mgr, struct mg_msg_cell *msg) {
+  struct mg_connection *nc, *tmp;
+  if (msg->conn_id != 0) {
+    nc = mg_conn_id_find(mgr, msg->conn_id);
+    if (nc != NULL && !(nc->flags & MG_F_CLOSE_IMMEDIATELY)) {
+      msg->cb(nc, MG_EV_POLL, msg->data MG_UD_ARG(nc->user_data));
+      mg_poll_set_add(nc); /* The callback may have changed its flags */
+    }
+  } else {
+    for (nc = mgr->active_connections; nc != NULL; nc = tmp) {
+      tmp = nc->next;
+      msg->cb(nc, MG_EV_POLL, msg->data MG_UD_ARG(nc->user_data));
+      mg_poll_set_add(nc);
+    }
+  }
+  if (msg->free_cb != NULL) msg->free_cb(msg->data);
+}
+
+/* Delivers up to MG_MSG_QUEUE_BATCH queued messages, in the IO thread. */
+MG_INTERNAL void mg_msg_queue_run(struct mg_mgr *mgr) {
+  struct mg_msg_queue *q = mgr->msgs;
+  struct mg_msg_cell msg, *cell;
+  int n;
+  if (q == NULL) return;
+  /* Before draining, so that anything posted from now on wakes us again */
+  __atomic_store_n(&q->signaled, 0, __ATOMIC_SEQ_CST);
+  for (n = 0; n < MG_MSG_QUEUE_BATCH; n++) {
+    cell = &q->cells[q->head & (MG_MSG_QUEUE_SIZE - 1)];
+    if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != q->head + 1) break;
+    msg = *cell;
+    __atomic_store_n(&cell->seq, q->head + MG_MSG_QUEUE_SIZE,
+                     __ATOMIC_RELEASE);
+    q->head++;
+    mg_msg_deliver(mgr, &msg);
+  }
+  if (n == MG_MSG_QUEUE_BATCH &&
+      !__atomic_exchange_n(&q->signaled, 1, __ATOMIC_SEQ_CST)) {
+    mg_msg_queue_wake(mgr); /* More to do, don't let the next poll sleep */
+  }
+}
+
+/* Drops undelivered messages, then frees the queue and the id table. */
+MG_INTERNAL void mg_msg_queue_free(struct mg_mgr *mgr) {
+  struct mg_msg_queue *q = mgr->msgs;
+  if (q != NULL) {
+    struct mg_msg_cell *cell;
+    for (;; q->head++) {
+      cell = &q->cells[q->head & (MG_MSG_QUEUE_SIZE - 1)];
+      if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != q->head + 1) break;
+      if (cell->free_cb != NULL) cell->free_cb(cell->data);
+    }
+    MG_FREE(q);
+    mgr->msgs = NULL;
+  }
+  if (mgr->conn_ids != NULL) {
+    MG_FREE(mgr->conn_ids->buckets);
+    MG_FREE(mgr->conn_ids);
+    mgr->conn_ids = NULL;
+  }
+}
+
+static void mg_broadcast_free_cb(void *data) {
+  MG_FREE(data);
+}
+#endif /* MG_ENABLE_MSG_QUEUE */
+
 #if MG_ENABLE_BROADCAST
 void mg_broadcast(struct mg_mgr *mgr, mg_event_handler_t cb, void *data,
                   size_t len) {
+#if MG_ENABLE_MSG_QUEUE
+  void *copy;
+  if (data == NULL || (copy = MG_MALLOC(len > 0 ? len : 1)) == NULL) return;
+  memcpy(copy, data, len);
+  while (!mg_post(mgr, 0, cb, copy, mg_broadcast_free_cb)) {
+    if (mgr->msgs == NULL) {
+      MG_FREE(copy);
+      return;
+    }
+    /* Full, the IO thread is behind */
+#ifdef _WIN32
+    Sleep(1);
+#else
+    usleep(1000);
+#endif
+  }
+#else
   struct ctl_msg ctl_msg;
 
   /*
@@ -3307,6 +4182,7 @@ void mg_broadcast(struct mg_mgr *mgr, mg_event_handler_t cb, void *data,
     dummy = MG_RECV_FUNC(mgr->ctl[0], (char *) &len, 1, 0);
     (void) dummy; /* https://gcc.gnu.org/bugzilla/show_bug.cgi?id=25509 */
   }
+#endif
 }
 #endif /* MG_ENABLE_BROADCAST */
 
@@ -3360,22 +4236,6 @@ void mg_forward(struct mg_connection *from, struct mg_connection *to) {
   mbuf_remove(&from->recv_mbuf, from->recv_mbuf.len);
 }
 
-double mg_set_timer(struct mg_connection *c, double timestamp) {
-  double result = c->ev_timer_time;
-  c->ev_timer_time = timestamp;
-  /*
-   * If this connection is resolving, it's not in the list of active
-   * connections, so not processed yet. It has a DNS resolver connection
-   * linked to it. Set up a timer for the DNS connection.
-   */
-  DBG(("%p %p %d -> %lu", c, c->priv_2, (c->flags & MG_F_RESOLVING ? 1 : 0),
-       (unsigned long) timestamp));
-  if ((c->flags & MG_F_RESOLVING) && c->priv_2 != NULL) {
-    mg_set_timer((struct mg_connection *) c->priv_2, timestamp);
-  }
-  return result;
-}
-
 void mg_sock_set(struct mg_connection *nc, sock_t sock) {
   if (sock != INVALID_SOCKET) {
     nc->iface->vtable->sock_set(nc, sock);
@@ -3415,6 +4275,368 @@ double mg_time(void) {
   return cs_time();
 }
 #ifdef MG_MODULE_LINES
+#line 1 "mongoose/src/mg_timer.c"
+#endif
+
+/* Amalgamated: #include "mg_internal.h" */
+
+/*
+ * Hierarchical timing wheel: MG_TIMER_LEVELS levels of MG_TIMER_SLOTS slots,
+ * level N slots being MG_TIMER_SLOTS^N ticks wide. A timer goes to the lowest
+ * level whose span covers its distance from `cur`, and is moved down
+ * ("cascaded") when `cur` reaches its slot. Arming and cancelling are O(1);
+ * advancing skips empty level 0 slots using the occupancy bitmaps.
+ */
+#define MG_TIMER_LEVELS 4
+#define MG_TIMER_SLOT_BITS 6
+#define MG_TIMER_SLOTS (1 << MG_TIMER_SLOT_BITS)
+#define MG_TIMER_SLOT_MASK (MG_TIMER_SLOTS - 1)
+#define MG_TIMER_SPAN(level) ((uint64_t) 1 << (MG_TIMER_SLOT_BITS * (level)))
+#define MG_TIMER_DUE (-1) /* mg_timer::slot of expired timers */
+#define MG_TIMER_PARKED (-2) /* mg_timer::slot of timers held for DNS */
+
+struct mg_timer_wheel {
+  uint64_t cur; /* Next tick to process, all earlier ones are done */
+  uint64_t occupied[MG_TIMER_LEVELS]; /* Bit per non-empty slot */
+  struct mg_timer *slots[MG_TIMER_LEVELS][MG_TIMER_SLOTS];
+  struct mg_timer *due; /* Expired timers, being dispatched */
+  struct mg_timer *parked; /* Expired while their connection resolves */
+  int num_timers;
+};
+
+static uint64_t mg_timer_tick(double t) {
+  return (uint64_t)(t * 1000 / MG_TIMER_TICK_MS);
+}
+
+static int mg_timer_ctz(uint64_t v) {
+#ifdef __GNUC__
+  return __builtin_ctzll(v);
+#else
+  int n = 0;
+  while (!(v & 1)) v >>= 1, n++;
+  return n;
+#endif
+}
+
+static void mg_timer_link(struct mg_timer **head, struct mg_timer *t) {
+  t->next = *head;
+  if (t->next != NULL) t->next->pprev = &t->next;
+  t->pprev = head;
+  *head = t;
+}
+
+static void mg_timer_place(struct mg_timer_wheel *w, struct mg_timer *t) {
+  uint64_t expires = t->expires < w->cur ? w->cur : t->expires;
+  uint64_t delta = expires - w->cur;
+  int level = 0, idx;
+  while (level < MG_TIMER_LEVELS - 1 && delta >= MG_TIMER_SPAN(level + 1)) {
+    level++;
+  }
+  if (delta >= MG_TIMER_SPAN(MG_TIMER_LEVELS)) {
+    /* Too far out, park it in the last slot, it gets re-placed from there */
+    expires = w->cur + MG_TIMER_SPAN(MG_TIMER_LEVELS) - 1;
+  }
+  idx = (int) (expires >> (MG_TIMER_SLOT_BITS * level)) & MG_TIMER_SLOT_MASK;
+  mg_timer_link(&w->slots[level][idx], t);
+  w->occupied[level] |= (uint64_t) 1 << idx;
+  t->slot = level * MG_TIMER_SLOTS + idx;
+}
+
+static void mg_timer_unlink(struct mg_timer_wheel *w, struct mg_timer *t) {
+  *t->pprev = t->next;
+  if (t->next != NULL) t->next->pprev = t->pprev;
+  if (t->slot >= 0) {
+    int level = t->slot / MG_TIMER_SLOTS, idx = t->slot % MG_TIMER_SLOTS;
+    if (w->slots[level][idx] == NULL) {
+      w->occupied[level] &= ~((uint64_t) 1 << idx);
+    }
+  }
+  t->next = NULL;
+  t->pprev = NULL;
+}
+
+static void mg_timer_arm(struct mg_connection *nc, struct mg_timer *t,
+                         double deadline, mg_event_handler_t cb) {
+  struct mg_timer_wheel *w = nc->mgr->timers;
+  double ms = deadline * 1000;
+  t->nc = nc;
+  t->cb = cb;
+  t->deadline = deadline;
+  /* Round up, the timer must not fire before its deadline */
+  t->expires = (uint64_t)(ms / MG_TIMER_TICK_MS);
+  if ((double) t->expires * MG_TIMER_TICK_MS < ms) t->expires++;
+  mg_timer_place(w, t);
+  t->conn_next = nc->timers;
+  if (t->conn_next != NULL) t->conn_next->conn_pprev = &t->conn_next;
+  t->conn_pprev = &nc->timers;
+  nc->timers = t;
+  w->num_timers++;
+}
+
+/* Takes an armed timer off the wheel and off its connection. */
+static void mg_timer_disarm(struct mg_timer *t) {
+  struct mg_timer_wheel *w = t->nc->mgr->timers;
+  mg_timer_unlink(w, t);
+  *t->conn_pprev = t->conn_next;
+  if (t->conn_next != NULL) t->conn_next->conn_pprev = t->conn_pprev;
+  t->conn_next = NULL;
+  t->conn_pprev = NULL;
+  w->num_timers--;
+}
+
+struct mg_timer *mg_timer_add(struct mg_connection *nc, int ms,
+                              mg_event_handler_t cb) {
+  struct mg_timer *t;
+  if (nc->mgr->timers == NULL) return NULL;
+  t = (struct mg_timer *) MG_CALLOC(1, sizeof(*t));
+  if (t != NULL) {
+    mg_timer_arm(nc, t, mg_time() + ms / 1000.0, cb);
+  }
+  return t;
+}
+
+void mg_timer_cancel(struct mg_timer *t) {
+  struct mg_connection *nc;
+  if (t == NULL || t->pprev == NULL) return;
+  nc = t->nc;
+  mg_timer_disarm(t);
+  if (t != nc->ev_timer) MG_FREE(t);
+}
+
+double mg_set_timer(struct mg_connection *c, double timestamp) {
+  double result = c->ev_timer_time;
+  mg_timer_cancel(c->ev_timer);
+  c->ev_timer_time = timestamp;
+  if (timestamp > 0 && c->mgr->timers != NULL) {
+    /* Allocated on first use and kept, most connections never need it */
+    if (c->ev_timer == NULL) {
+      c->ev_timer = (struct mg_timer *) MG_CALLOC(1, sizeof(*c->ev_timer));
+    }
+    if (c->ev_timer != NULL) mg_timer_arm(c, c->ev_timer, timestamp, NULL);
+  }
+  /*
+   * If this connection is resolving, it's not in the list of active
+   * connections, so not processed yet. It has a DNS resolver connection
+   * linked to it. Set up a timer for the DNS connection.
+   */
+  DBG(("%p %p %d -> %lu", c, c->priv_2, (c->flags & MG_F_RESOLVING ? 1 : 0),
+       (unsigned long) timestamp));
+  if ((c->flags & MG_F_RESOLVING) && c->priv_2 != NULL) {
+    mg_set_timer((struct mg_connection *) c->priv_2, timestamp);
+  }
+  return result;
+}
+
+/* Moves the timers of a higher level slot to where they belong now. */
+static void mg_timer_cascade(struct mg_timer_wheel *w, int level) {
+  int idx = (int) (w->cur >> (MG_TIMER_SLOT_BITS * level)) & MG_TIMER_SLOT_MASK;
+  struct mg_timer *t = w->slots[level][idx];
+  w->slots[level][idx] = NULL;
+  w->occupied[level] &= ~((uint64_t) 1 << idx);
+  while (t != NULL) {
+    struct mg_timer *next = t->next;
+    mg_timer_place(w, t);
+    t = next;
+  }
+}
+
+/*
+ * Processes ticks up to and including `target`, stopping after the first one
+ * that has expired timers. Returns 0 if there were none.
+ */
+static int mg_timer_advance(struct mg_timer_wheel *w, uint64_t target) {
+  while (w->cur <= target) {
+    int idx = (int) (w->cur & MG_TIMER_SLOT_MASK), level;
+    uint64_t rest, skip;
+    struct mg_timer *t;
+    if (idx == 0) {
+      for (level = MG_TIMER_LEVELS - 1; level > 0; level--) {
+        if ((w->cur & (MG_TIMER_SPAN(level) - 1)) == 0) {
+          mg_timer_cascade(w, level);
+        }
+      }
+    }
+    if (w->slots[0][idx] != NULL) {
+      w->due = w->slots[0][idx];
+      w->due->pprev = &w->due;
+      w->slots[0][idx] = NULL;
+      w->occupied[0] &= ~((uint64_t) 1 << idx);
+      for (t = w->due; t != NULL; t = t->next) t->slot = MG_TIMER_DUE;
+      w->cur++;
+      return 1;
+    }
+    w->cur++;
+    /* Jump to the next non-empty slot, or to the next cascade */
+    idx = (int) (w->cur & MG_TIMER_SLOT_MASK);
+    if (idx == 0 || w->cur > target) continue;
+    rest = w->occupied[0] >> idx;
+    skip = rest != 0 ? (uint64_t) mg_timer_ctz(rest)
+                     : (uint64_t)(MG_TIMER_SLOTS - idx);
+    if (skip > target + 1 - w->cur) skip = target + 1 - w->cur;
+    w->cur += skip;
+  }
+  return 0;
+}
+
+/* Delivers MG_EV_TIMER for all timers that are due at `now`. */
+MG_INTERNAL void mg_timer_run(struct mg_mgr *mgr, double now) {
+  struct mg_timer_wheel *w = mgr->timers;
+  uint64_t target = mg_timer_tick(now);
+  struct mg_timer *t;
+
+  if (w == NULL || target < w->cur) return;
+  if (w->num_timers == 0) {
+    w->cur = target + 1; /* Nothing to cascade or expire */
+    return;
+  }
+
+  /* Tick by tick, so that timers fire in order */
+  while (mg_timer_advance(w, target)) {
+    while ((t = w->due) != NULL) {
+      struct mg_connection *nc = t->nc;
+      mg_event_handler_t cb = t->cb;
+      double deadline = t->deadline;
+      if (nc->flags & MG_F_RESOLVING) {
+        /*
+         * Not connected yet, the resolver has a timer of its own. Held off
+         * the wheel, so as not to wake up every tick, see mg_timer_unpark().
+         */
+        mg_timer_unlink(w, t);
+        mg_timer_link(&w->parked, t);
+        t->slot = MG_TIMER_PARKED;
+        continue;
+      }
+      mg_timer_disarm(t);
+      if (t == nc->ev_timer) {
+        nc->ev_timer_time = 0;
+      } else {
+        MG_FREE(t);
+      }
+      if (nc->flags & MG_F_CLOSE_IMMEDIATELY) continue;
+      mg_call(nc, cb, nc->user_data, MG_EV_TIMER, &deadline);
+    }
+  }
+}
+
+/* Puts timers that expired during name resolution back, due on the next tick */
+MG_INTERNAL void mg_timer_unpark(struct mg_connection *nc) {
+  struct mg_timer *t;
+  for (t = nc->timers; t != NULL; t = t->conn_next) {
+    if (t->slot != MG_TIMER_PARKED) continue;
+    mg_timer_unlink(nc->mgr->timers, t);
+    mg_timer_place(nc->mgr->timers, t);
+  }
+}
+
+MG_INTERNAL void mg_timer_wheel_init(struct mg_mgr *mgr) {
+  mgr->timers = (struct mg_timer_wheel *) MG_CALLOC(1, sizeof(*mgr->timers));
+  if (mgr->timers != NULL) mgr->timers->cur = mg_timer_tick(mg_time());
+}
+
+MG_INTERNAL void mg_timer_wheel_free(struct mg_mgr *mgr) {
+  MG_FREE(mgr->timers);
+  mgr->timers = NULL;
+}
+
+static double mg_timer_wheel_next(const struct mg_timer_wheel *w) {
+  uint64_t next = 0;
+  int level;
+
+  if (w == NULL || w->num_timers == 0) return 0;
+  if (w->due != NULL) return mg_time();
+  for (level = 0; level < MG_TIMER_LEVELS; level++) {
+    int shift = MG_TIMER_SLOT_BITS * level, first, dist;
+    int pos = (int) (w->cur >> shift) & MG_TIMER_SLOT_MASK;
+    uint64_t occupied = w->occupied[level], rest, tick;
+    if (occupied == 0) continue;
+    /*
+     * Level 0 slots hold exact expiry ticks. Higher level slots are cascaded
+     * at their start, which gives a lower bound: the slot at `pos` is still
+     * pending if `cur` is at its start, otherwise it's up on the next round.
+     */
+    first = pos;
+    if (level > 0 && (w->cur & (MG_TIMER_SPAN(level) - 1)) != 0) first++;
+    rest = first < MG_TIMER_SLOTS ? occupied >> first : 0;
+    dist = rest ? first - pos + mg_timer_ctz(rest)
+                : MG_TIMER_SLOTS - pos + mg_timer_ctz(occupied);
+    tick = ((w->cur >> shift) + dist) << shift;
+    if (next == 0 || tick < next) next = tick;
+  }
+  return (double) next * MG_TIMER_TICK_MS / 1000;
+}
+
+/* Idle lists: doubly-linked, appending keeps them ordered by idle time. */
+void mg_set_idle(struct mg_connection *nc, int cls) {
+  struct mg_idle_list *l;
+  if (nc->idle_class > 0) {
+    l = &nc->mgr->idle[nc->idle_class];
+    if (nc->idle_prev != NULL) {
+      nc->idle_prev->idle_next = nc->idle_next;
+    } else {
+      l->head = nc->idle_next;
+    }
+    if (nc->idle_next != NULL) {
+      nc->idle_next->idle_prev = nc->idle_prev;
+    } else {
+      l->tail = nc->idle_prev;
+    }
+    nc->idle_next = nc->idle_prev = NULL;
+  }
+  nc->idle_class = (cls > 0 && cls < MG_NUM_IDLE_CLASSES) ? cls : 0;
+  if (nc->idle_class > 0) {
+    l = &nc->mgr->idle[nc->idle_class];
+    nc->idle_time = (time_t) mg_time();
+    nc->idle_prev = l->tail;
+    if (l->tail != NULL) {
+      l->tail->idle_next = nc;
+    } else {
+      l->head = nc;
+    }
+    l->tail = nc;
+  }
+}
+
+void mg_set_idle_timeout(struct mg_mgr *mgr, int cls, int seconds) {
+  if (cls > 0 && cls < MG_NUM_IDLE_CLASSES) {
+    mgr->idle[cls].timeout = seconds > 0 ? seconds : 0;
+  }
+}
+
+/* idle_time is truncated to seconds, round up so as not to expire early */
+static double mg_idle_deadline(const struct mg_idle_list *l) {
+  return (double) l->head->idle_time + 1 + l->timeout;
+}
+
+/* Closes connections that have been idle for longer than their class allows */
+MG_INTERNAL void mg_idle_run(struct mg_mgr *mgr, double now) {
+  int cls;
+  for (cls = 1; cls < MG_NUM_IDLE_CLASSES; cls++) {
+    struct mg_idle_list *l = &mgr->idle[cls];
+    struct mg_connection *nc;
+    if (l->timeout <= 0) continue;
+    while ((nc = l->head) != NULL && mg_idle_deadline(l) <= now) {
+      LOG(LL_DEBUG, ("%p idle for %d s (class %d), closing", nc,
+                     (int) (now - nc->idle_time), cls));
+      mg_set_idle(nc, 0);
+      nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+      mg_close_conn(nc);
+    }
+  }
+}
+
+double mg_mgr_min_timer(const struct mg_mgr *mgr) {
+  double min_timer = mg_timer_wheel_next(mgr->timers);
+  int cls;
+  for (cls = 1; cls < MG_NUM_IDLE_CLASSES; cls++) {
+    const struct mg_idle_list *l = &mgr->idle[cls];
+    double t;
+    if (l->timeout <= 0 || l->head == NULL) continue;
+    t = mg_idle_deadline(l);
+    if (min_timer == 0 || t < min_timer) min_timer = t;
+  }
+  return min_timer;
+}
+#ifdef MG_MODULE_LINES
 #line 1 "mongoose/src/mg_net_if_socket.h"
 #endif
 
@@ -3503,18 +4725,6 @@ struct mg_iface *mg_find_iface(struct mg_mgr *mgr,
   }
   return NULL;
 }
-
-double mg_mgr_min_timer(const struct mg_mgr *mgr) {
-  double min_timer = 0;
-  struct mg_connection *nc;
-  for (nc = mgr->active_connections; nc != NULL; nc = nc->next) {
-    if (nc->ev_timer_time <= 0) continue;
-    if (min_timer == 0 || nc->ev_timer_time < min_timer) {
-      min_timer = nc->ev_timer_time;
-    }
-  }
-  return min_timer;
-}
 #ifdef MG_MODULE_LINES
 #line 1 "mongoose/src/mg_net_if_null.c"
 #endif
@@ -3652,9 +4862,32 @@ const struct mg_iface_vtable mg_default_iface_vtable = MG_NULL_IFACE_VTABLE;
 /* Amalgamated: #include "mg_internal.h" */
 /* Amalgamated: #include "mg_util.h" */
 
-static sock_t mg_open_listening_socket(union socket_address *sa, int type,
+static sock_t mg_open_listening_socket(struct mg_connection *nc,
+                                       union socket_address *sa, int type,
                                        int proto);
 
+#if defined(__linux__) && !defined(MG_SOCKET_ACCEPT4)
+#define MG_SOCKET_ACCEPT4 1
+/* Not declared under _XOPEN_SOURCE. */
+extern int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen,
+                   int flags);
+#endif
+
+#if defined(__linux__) && !defined(MG_SOCKET_MMSG)
+#define MG_SOCKET_MMSG 1
+#include <sys/syscall.h>
+/* recvmmsg(), sendmmsg() and struct mmsghdr are not under _XOPEN_SOURCE. */
+extern long syscall(long number, ...);
+struct mg_mmsghdr {
+  struct msghdr msg_hdr;
+  unsigned int msg_len;
+};
+#endif
+
+#if MG_ENABLE_MSG_QUEUE && defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
 void mg_set_non_blocking_mode(sock_t sock) {
 #ifdef _WIN32
   unsigned long on = 1;
@@ -3677,6 +4910,62 @@ static int mg_is_error(void) {
       ;
 }
 
+static int mg_setsockopt_int(sock_t sock, int level, int name, int val) {
+  return setsockopt(sock, level, name, (const char *) &val, sizeof(val)) == 0;
+}
+
+/*
+ * Applies `o` to a fresh socket, except the listen() backlog.
+ * Returns the MG_SOCK_OPT_* bits that took effect.
+ */
+static unsigned int mg_sock_opts_set(sock_t sock, const struct mg_sock_opts *o,
+                                     int type, int listening) {
+  unsigned int applied = 0;
+  if (o->sndbuf > 0 && mg_setsockopt_int(sock, SOL_SOCKET, SO_SNDBUF,
+                                         o->sndbuf)) {
+    applied |= MG_SOCK_OPT_SNDBUF;
+  }
+  if (o->rcvbuf > 0 && mg_setsockopt_int(sock, SOL_SOCKET, SO_RCVBUF,
+                                         o->rcvbuf)) {
+    applied |= MG_SOCK_OPT_RCVBUF;
+  }
+  if (type != SOCK_STREAM) return applied;
+  if (o->nodelay != 0 && mg_setsockopt_int(sock, IPPROTO_TCP, TCP_NODELAY,
+                                           o->nodelay > 0)) {
+    applied |= MG_SOCK_OPT_NODELAY;
+  }
+#ifdef TCP_NOTSENT_LOWAT
+  if (o->notsent_lowat > 0 &&
+      mg_setsockopt_int(sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+                        o->notsent_lowat)) {
+    applied |= MG_SOCK_OPT_NOTSENT_LOWAT;
+  }
+#endif
+  if (listening) {
+#ifdef TCP_DEFER_ACCEPT
+    if (o->defer_accept > 0 &&
+        mg_setsockopt_int(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                          o->defer_accept)) {
+      applied |= MG_SOCK_OPT_DEFER_ACCEPT;
+    }
+#endif
+#ifdef TCP_FASTOPEN
+    if (o->fastopen > 0 &&
+        mg_setsockopt_int(sock, IPPROTO_TCP, TCP_FASTOPEN, o->fastopen)) {
+      applied |= MG_SOCK_OPT_FASTOPEN;
+    }
+#endif
+  } else {
+#ifdef TCP_FASTOPEN_CONNECT
+    if (o->fastopen != 0 &&
+        mg_setsockopt_int(sock, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1)) {
+      applied |= MG_SOCK_OPT_FASTOPEN;
+    }
+#endif
+  }
+  return applied;
+}
+
 void mg_socket_if_connect_tcp(struct mg_connection *nc,
                               const union socket_address *sa) {
   int rc, proto = 0;
@@ -3688,6 +4977,10 @@ void mg_socket_if_connect_tcp(struct mg_connection *nc,
 #if !defined(MG_ESP8266)
   mg_set_non_blocking_mode(nc->sock);
 #endif
+  if (nc->sock_opts != NULL) {
+    nc->sock_opts_applied =
+        mg_sock_opts_set(nc->sock, nc->sock_opts, SOCK_STREAM, 0);
+  }
   rc = connect(nc->sock, &sa->sa, sizeof(sa->sin));
   nc->err = rc < 0 && mg_is_error() ? mg_get_errno() : 0;
   DBG(("%p sock %d rc %d errno %d err %d", nc, (int) nc->sock, rc,
@@ -3714,7 +5007,7 @@ void mg_socket_if_connect_udp(struct mg_connection *nc) {
 int mg_socket_if_listen_tcp(struct mg_connection *nc,
                             union socket_address *sa) {
   int proto = 0;
-  sock_t sock = mg_open_listening_socket(sa, SOCK_STREAM, proto);
+  sock_t sock = mg_open_listening_socket(nc, sa, SOCK_STREAM, proto);
   if (sock == INVALID_SOCKET) {
     return (mg_get_errno() ? mg_get_errno() : 1);
   }
@@ -3724,28 +5017,118 @@ int mg_socket_if_listen_tcp(struct mg_connection *nc,
 
 static int mg_socket_if_listen_udp(struct mg_connection *nc,
                                    union socket_address *sa) {
-  sock_t sock = mg_open_listening_socket(sa, SOCK_DGRAM, 0);
+  sock_t sock = mg_open_listening_socket(nc, sa, SOCK_DGRAM, 0);
   if (sock == INVALID_SOCKET) return (mg_get_errno() ? mg_get_errno() : 1);
   mg_sock_set(nc, sock);
   return 0;
 }
 
-static int mg_socket_if_tcp_send(struct mg_connection *nc, const void *buf,
-                                 size_t len) {
-  int n = (int) MG_SEND_FUNC(nc->sock, buf, len, 0);
-  if (n < 0 && !mg_is_error()) n = 0;
-  return n;
+/*
+ * MSG_MORE when more output follows a write of `len` bytes: data left queued
+ * behind it, or MG_F_SEND_MORE. The last write of a burst goes without it
+ * and pushes what the kernel held back.
+ */
+static int mg_socket_if_send_flags(struct mg_connection *nc, size_t len) {
+#ifdef MSG_MORE
+  if ((nc->flags & MG_F_SEND_MORE) || mg_send_queued(nc) > len) {
+    return MSG_MORE;
+  }
+#else
+  (void) nc;
+  (void) len;
+#endif
+  return 0;
 }
 
-static int mg_socket_if_udp_send(struct mg_connection *nc, const void *buf,
+static int mg_socket_if_tcp_send(struct mg_connection *nc, const void *buf,
                                  size_t len) {
-  int n = sendto(nc->sock, buf, len, 0, &nc->sa.sa, sizeof(nc->sa.sin));
+  int n = (int) MG_SEND_FUNC(nc->sock, buf, len,
+                             mg_socket_if_send_flags(nc, len));
   if (n < 0 && !mg_is_error()) n = 0;
   return n;
 }
 
-static int mg_socket_if_tcp_recv(struct mg_connection *nc, void *buf,
-                                 size_t len) {
+static int mg_socket_if_tcp_sendv(struct mg_connection *nc,
+                                  const struct mg_str *bufs, int num_bufs) {
+  int n;
+#ifdef _WIN32
+  n = (int) MG_SEND_FUNC(nc->sock, bufs[0].p, bufs[0].len, 0);
+#else
+  struct iovec iov[MG_SEND_IOV_MAX];
+  struct msghdr msg;
+  size_t len = 0;
+  int i;
+  if (num_bufs > MG_SEND_IOV_MAX) num_bufs = MG_SEND_IOV_MAX;
+  for (i = 0; i < num_bufs; i++) {
+    iov[i].iov_base = (void *) bufs[i].p;
+    iov[i].iov_len = bufs[i].len;
+    len += bufs[i].len;
+  }
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = num_bufs;
+  n = (int) sendmsg(nc->sock, &msg, mg_socket_if_send_flags(nc, len));
+#endif
+  if (n < 0 && !mg_is_error()) n = 0;
+  return n;
+}
+
+static int mg_socket_if_udp_send(struct mg_connection *nc, const void *buf,
+                                 size_t len) {
+  int n = sendto(nc->sock, buf, len, 0, &nc->sa.sa, sizeof(nc->sa.sin));
+  if (n < 0 && !mg_is_error()) n = 0;
+  return n;
+}
+
+#if MG_SOCKET_MMSG
+static void mg_socket_if_mmsg_init(struct mg_mmsghdr *mm, struct iovec *iov,
+                                   struct mg_udp_msg *msgs, int num_msgs,
+                                   socklen_t sa_len) {
+  int i;
+  memset(mm, 0, sizeof(*mm) * num_msgs);
+  for (i = 0; i < num_msgs; i++) {
+    iov[i].iov_base = msgs[i].buf;
+    iov[i].iov_len = msgs[i].len;
+    mm[i].msg_hdr.msg_iov = &iov[i];
+    mm[i].msg_hdr.msg_iovlen = 1;
+    mm[i].msg_hdr.msg_name = &msgs[i].sa;
+    mm[i].msg_hdr.msg_namelen = sa_len;
+  }
+}
+
+static int mg_socket_if_udp_send_batch(struct mg_connection *nc,
+                                       struct mg_udp_msg *msgs, int num_msgs) {
+  struct mg_mmsghdr mm[MG_UDP_BATCH];
+  struct iovec iov[MG_UDP_BATCH];
+  int i, n;
+  if (num_msgs > MG_UDP_BATCH) num_msgs = MG_UDP_BATCH;
+  /* Like mg_socket_if_udp_send() */
+  mg_socket_if_mmsg_init(mm, iov, msgs, num_msgs, sizeof(msgs[0].sa.sin));
+  n = (int) syscall(SYS_sendmmsg, nc->sock, mm, num_msgs, 0);
+  if (n < 0) return mg_is_error() ? -1 : 0;
+  for (i = 0; i < n; i++) msgs[i].len = mm[i].msg_len;
+  return n;
+}
+
+static int mg_socket_if_udp_recv_batch(struct mg_connection *nc,
+                                       struct mg_udp_msg *msgs, int num_msgs) {
+  struct mg_mmsghdr mm[MG_UDP_BATCH];
+  struct iovec iov[MG_UDP_BATCH];
+  int i, n;
+  if (num_msgs > MG_UDP_BATCH) num_msgs = MG_UDP_BATCH;
+  mg_socket_if_mmsg_init(mm, iov, msgs, num_msgs, sizeof(msgs[0].sa));
+  n = (int) syscall(SYS_recvmmsg, nc->sock, mm, num_msgs, 0, NULL);
+  if (n < 0) return mg_is_error() ? -1 : 0;
+  for (i = 0; i < n; i++) msgs[i].len = mm[i].msg_len;
+  return n;
+}
+#else
+#define mg_socket_if_udp_send_batch NULL
+#define mg_socket_if_udp_recv_batch NULL
+#endif
+
+static int mg_socket_if_tcp_recv(struct mg_connection *nc, void *buf,
+                                 size_t len) {
   int n = (int) MG_RECV_FUNC(nc->sock, buf, len, 0);
   if (n == 0) {
     /* Orderly shutdown of the socket, try flushing output. */
@@ -3782,39 +5165,79 @@ void mg_socket_if_destroy_conn(struct mg_connection *nc) {
   nc->sock = INVALID_SOCKET;
 }
 
+/*
+ * Accepts pending connections, up to the listener's budget.
+ * Returns the number of connections accepted.
+ */
 static int mg_accept_conn(struct mg_connection *lc) {
   struct mg_connection *nc;
   union socket_address sa;
-  socklen_t sa_len = sizeof(sa);
-  /* NOTE(lsm): on Windows, sock is always > FD_SETSIZE */
-  sock_t sock = accept(lc->sock, &sa.sa, &sa_len);
-  if (sock == INVALID_SOCKET) {
-    if (mg_is_error()) {
-      DBG(("%p: failed to accept: %d", lc, mg_get_errno()));
+  socklen_t sa_len;
+  sock_t sock;
+  int n = 0;
+  int budget = lc->accept_budget > 0 ? lc->accept_budget : MG_ACCEPT_BUDGET;
+
+  while (n < budget && !(lc->flags & MG_F_CLOSE_IMMEDIATELY)) {
+    sa_len = sizeof(sa);
+#if MG_SOCKET_ACCEPT4
+    sock = accept4(lc->sock, &sa.sa, &sa_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    /* NOTE(lsm): on Windows, sock is always > FD_SETSIZE */
+    sock = accept(lc->sock, &sa.sa, &sa_len);
+#endif
+    if (sock == INVALID_SOCKET) {
+      if (mg_is_error()) {
+        DBG(("%p: failed to accept: %d", lc, mg_get_errno()));
+      }
+      break;
     }
-    return 0;
-  }
-  nc = mg_if_accept_new_conn(lc);
-  if (nc == NULL) {
-    closesocket(sock);
-    return 0;
+    nc = mg_if_accept_new_conn(lc);
+    if (nc == NULL) {
+      closesocket(sock);
+      break;
+    }
+    DBG(("%p conn from %s:%d", nc, inet_ntoa(sa.sin.sin_addr),
+         ntohs(sa.sin.sin_port)));
+    mg_sock_set(nc, sock);
+    mg_if_accept_tcp_cb(nc, &sa, sa_len);
+    n++;
   }
-  DBG(("%p conn from %s:%d", nc, inet_ntoa(sa.sin.sin_addr),
-       ntohs(sa.sin.sin_port)));
-  mg_sock_set(nc, sock);
-  mg_if_accept_tcp_cb(nc, &sa, sa_len);
-  return 1;
+  return n;
+}
+
+/* glibc hides it under _XOPEN_SOURCE, take it from the kernel headers */
+#if defined(__linux__) && !defined(SO_REUSEPORT)
+#include <asm/socket.h>
+#endif
+
+/*
+ * Applies the listener's socket options, then listens on TCP sockets.
+ * The options go first so that accepted sockets can inherit them.
+ */
+static int mg_sock_listen(struct mg_connection *nc, sock_t sock, int type) {
+  int backlog = SOMAXCONN;
+  if (nc->sock_opts != NULL) {
+    nc->sock_opts_applied = mg_sock_opts_set(sock, nc->sock_opts, type, 1);
+    if (nc->sock_opts->backlog > 0) backlog = nc->sock_opts->backlog;
+  }
+  if (type == SOCK_DGRAM) return 0;
+  if (listen(sock, backlog) != 0) return -1;
+  if (backlog != SOMAXCONN) nc->sock_opts_applied |= MG_SOCK_OPT_BACKLOG;
+  return 0;
 }
 
 /* 'sa' must be an initialized address to bind to */
-static sock_t mg_open_listening_socket(union socket_address *sa, int type,
+static sock_t mg_open_listening_socket(struct mg_connection *nc,
+                                       union socket_address *sa, int type,
                                        int proto) {
   socklen_t sa_len =
       (sa->sa.sa_family == AF_INET) ? sizeof(sa->sin) : sizeof(sa->sin6);
   sock_t sock = INVALID_SOCKET;
+  unsigned long flags = nc->flags;
 #if !MG_LWIP
   int on = 1;
 #endif
+  (void) flags;
 
   if ((sock = socket(sa->sa.sa_family, type, proto)) != INVALID_SOCKET &&
 #if !MG_LWIP /* LWIP doesn't support either */
@@ -3836,10 +5259,13 @@ static sock_t mg_open_listening_socket(union socket_address *sa, int type,
        */
       !setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (void *) &on, sizeof(on)) &&
 #endif
+#ifdef SO_REUSEPORT
+      (!(flags & MG_F_REUSE_PORT) ||
+       !setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (void *) &on, sizeof(on))) &&
+#endif
 #endif /* !MG_LWIP */
 
-      !bind(sock, &sa->sa, sa_len) &&
-      (type == SOCK_DGRAM || listen(sock, SOMAXCONN) == 0)) {
+      !bind(sock, &sa->sa, sa_len) && mg_sock_listen(nc, sock, type) == 0) {
 #if !MG_LWIP
     mg_set_non_blocking_mode(sock);
     /* In case port was set to 0, get the real port number */
@@ -3857,7 +5283,11 @@ static sock_t mg_open_listening_socket(union socket_address *sa, int type,
 #define _MG_F_FD_CAN_WRITE 1 << 1
 #define _MG_F_FD_ERROR 1 << 2
 
-void mg_mgr_handle_conn(struct mg_connection *nc, int fd_flags, double now) {
+/*
+ * Dispatches I/O readiness to a connection. Returns 0 if the connection has
+ * been closed (and freed) along the way, 1 otherwise.
+ */
+int mg_mgr_handle_conn(struct mg_connection *nc, int fd_flags, double now) {
   int worth_logging =
       fd_flags != 0 || (nc->flags & (MG_F_WANT_READ | MG_F_WANT_WRITE));
   if (worth_logging) {
@@ -3866,7 +5296,7 @@ void mg_mgr_handle_conn(struct mg_connection *nc, int fd_flags, double now) {
          (int) nc->send_mbuf.len));
   }
 
-  if (!mg_if_poll(nc, now)) return;
+  if (!mg_if_poll(nc, now)) return 0;
 
   if (nc->flags & MG_F_CONNECTING) {
     if (fd_flags != 0) {
@@ -3900,9 +5330,9 @@ void mg_mgr_handle_conn(struct mg_connection *nc, int fd_flags, double now) {
     } else {
       if (nc->flags & MG_F_LISTENING) {
         /*
-         * We're not looping here, and accepting just one connection at
-         * a time. The reason is that eCos does not respect non-blocking
-         * flag on a listening socket and hangs in a loop.
+         * Accepts up to MG_ACCEPT_BUDGET connections, which is 1 where
+         * looping is unsafe: eCos does not respect non-blocking flag on a
+         * listening socket and hangs in a loop.
          */
         mg_accept_conn(nc);
       } else {
@@ -3917,9 +5347,105 @@ void mg_mgr_handle_conn(struct mg_connection *nc, int fd_flags, double now) {
     DBG(("%p after fd=%d nc_flags=0x%lx rmbl=%d smbl=%d", nc, (int) nc->sock,
          nc->flags, (int) nc->recv_mbuf.len, (int) nc->send_mbuf.len));
   }
+  return 1;
+}
+
+/*
+ * Replies of UDP "connections" of listeners, collected during a poll and
+ * sent with one udp_send_batch() per listener socket.
+ */
+struct mg_udp_send_batch {
+  struct mg_connection *conns[MG_UDP_BATCH];
+  int num;
+};
+
+static void mg_udp_send_batch_flush(struct mg_udp_send_batch *b, double now) {
+  struct mg_udp_msg msgs[MG_UDP_BATCH];
+  struct mg_connection *sent[MG_UDP_BATCH];
+  int i, n = 0, num_msgs = 0;
+  /* Handlers may have run since the connections were added, recheck */
+  for (i = 0; i < b->num; i++) {
+    struct mg_connection *nc = b->conns[i];
+    if (nc->flags & MG_F_CLOSE_IMMEDIATELY || nc->send_mbuf.len == 0) continue;
+    msgs[num_msgs].buf = nc->send_mbuf.buf;
+    msgs[num_msgs].len = nc->send_mbuf.len;
+    msgs[num_msgs].sa = nc->sa;
+    sent[num_msgs++] = nc;
+  }
+  if (num_msgs > 0) {
+    n = sent[0]->iface->vtable->udp_send_batch(sent[0], msgs, num_msgs);
+    DBG(("%p -> %d of %d datagrams", sent[0], n, num_msgs));
+  }
+  if (n < 0) {
+    mg_if_sent_cb(sent[0], -1);
+  } else {
+    for (i = 0; i < n; i++) mg_if_sent_cb(sent[i], (int) msgs[i].len);
+  }
+  for (i = 0; i < b->num; i++) mg_mgr_handle_conn(b->conns[i], 0, now);
+  b->num = 0;
+}
+
+/*
+ * Takes over a writable UDP connection of a listener for batched sending.
+ * Returns 0 if it has to be handled as usual.
+ */
+static int mg_udp_send_batch_add(struct mg_udp_send_batch *b,
+                                 struct mg_connection *nc, double now) {
+  if (!(nc->flags & MG_F_UDP) || nc->listener == NULL ||
+      (nc->flags & (MG_F_CLOSE_IMMEDIATELY | MG_F_SSL)) ||
+      nc->send_mbuf.len == 0 || nc->iface->vtable->udp_send_batch == NULL) {
+    return 0;
+  }
+  if (b->num > 0 && b->conns[0]->sock != nc->sock) {
+    mg_udp_send_batch_flush(b, now);
+  }
+  b->conns[b->num++] = nc;
+  if (b->num == MG_UDP_BATCH) mg_udp_send_batch_flush(b, now);
+  return 1;
 }
 
 #if MG_ENABLE_BROADCAST
+/*
+ * Opens mgr->ctl. The message queue only needs a wakeup, which an eventfd
+ * does with one descriptor: it is then stored in both slots.
+ */
+MG_INTERNAL void mg_mgr_ctl_open(struct mg_mgr *mgr) {
+#if MG_ENABLE_MSG_QUEUE
+#ifdef __linux__
+  int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd >= 0) {
+    mgr->ctl[0] = mgr->ctl[1] = fd;
+    return;
+  }
+#endif
+  /*
+   * The IO thread drains the fallback pair until it is empty, which must not
+   * block; a sender that finds it full has a wakeup pending already.
+   */
+  if (mg_socketpair(mgr->ctl, SOCK_DGRAM)) {
+    mg_set_non_blocking_mode(mgr->ctl[0]);
+    mg_set_non_blocking_mode(mgr->ctl[1]);
+  }
+#else
+  mg_socketpair(mgr->ctl, SOCK_DGRAM);
+#endif
+}
+
+#if MG_ENABLE_MSG_QUEUE
+/* Consumes the wakeup, messages are delivered by mg_mgr_poll() */
+static void mg_mgr_handle_ctl_sock(struct mg_mgr *mgr) {
+  char buf[64];
+  size_t dummy;
+  if (mgr->ctl[0] == mgr->ctl[1]) {
+    dummy = read(mgr->ctl[1], buf, sizeof(uint64_t));
+  } else {
+    while (MG_RECV_FUNC(mgr->ctl[1], buf, sizeof(buf), 0) > 0) {
+    }
+    dummy = 0;
+  }
+  (void) dummy; /* https://gcc.gnu.org/bugzilla/show_bug.cgi?id=25509 */
+}
+#else
 static void mg_mgr_handle_ctl_sock(struct mg_mgr *mgr) {
   struct ctl_msg ctl_msg;
   int len = (int) MG_RECV_FUNC(mgr->ctl[1], (char *) &ctl_msg, sizeof(ctl_msg), 0);
@@ -3934,12 +5460,33 @@ static void mg_mgr_handle_ctl_sock(struct mg_mgr *mgr) {
     }
   }
 }
+#endif /* MG_ENABLE_MSG_QUEUE */
 #endif
 
 /* Associate a socket to a connection. */
 void mg_socket_if_sock_set(struct mg_connection *nc, sock_t sock) {
-  mg_set_non_blocking_mode(sock);
-  mg_set_close_on_exec(sock);
+#if MG_SOCKET_ACCEPT4
+  /* Accepted sockets are already non-blocking and close-on-exec. */
+  if (nc->listener == NULL)
+#endif
+  {
+    mg_set_non_blocking_mode(sock);
+    mg_set_close_on_exec(sock);
+  }
+  if (nc->listener != NULL && nc->listener->sock_opts != NULL &&
+      !(nc->flags & MG_F_UDP)) {
+    unsigned int inherited = MG_SOCK_OPT_NODELAY | MG_SOCK_OPT_SNDBUF |
+                             MG_SOCK_OPT_RCVBUF | MG_SOCK_OPT_NOTSENT_LOWAT;
+#ifdef __linux__
+    /* Accepted sockets are clones of the listener, options included */
+    nc->sock_opts_applied = nc->listener->sock_opts_applied & inherited;
+#else
+    struct mg_sock_opts o = *nc->listener->sock_opts;
+    o.fastopen = 0;
+    nc->sock_opts_applied =
+        mg_sock_opts_set(sock, &o, SOCK_STREAM, 0) & inherited;
+#endif
+  }
   nc->sock = sock;
   DBG(("%p %d", nc, (int) sock));
 }
@@ -3948,7 +5495,7 @@ void mg_socket_if_init(struct mg_iface *iface) {
   (void) iface;
   DBG(("%p using select()", iface->mgr));
 #if MG_ENABLE_BROADCAST
-  mg_socketpair(iface->mgr->ctl, SOCK_DGRAM);
+  mg_mgr_ctl_open(iface->mgr);
 #endif
 }
 
@@ -3985,7 +5532,8 @@ time_t mg_socket_if_poll(struct mg_iface *iface, int timeout_ms) {
   struct timeval tv;
   fd_set read_set, write_set, err_set;
   sock_t max_fd = INVALID_SOCKET;
-  int num_fds, num_ev, num_timers = 0;
+  int num_fds, num_ev;
+  struct mg_udp_send_batch udp_batch;
 #ifdef __unix__
   int try_dup = 1;
 #endif
@@ -3993,6 +5541,7 @@ time_t mg_socket_if_poll(struct mg_iface *iface, int timeout_ms) {
   FD_ZERO(&read_set);
   FD_ZERO(&write_set);
   FD_ZERO(&err_set);
+  udp_batch.num = 0;
 #if MG_ENABLE_BROADCAST
   mg_add_to_set(mgr->ctl[1], &read_set, &max_fd);
 #endif
@@ -4001,7 +5550,6 @@ time_t mg_socket_if_poll(struct mg_iface *iface, int timeout_ms) {
    * Note: it is ok to have connections with sock == INVALID_SOCKET in the list,
    * e.g. timer-only "connections".
    */
-  min_timer = 0;
   for (nc = mgr->active_connections, num_fds = 0; nc != NULL; nc = tmp) {
     tmp = nc->next;
 
@@ -4034,194 +5582,1247 @@ time_t mg_socket_if_poll(struct mg_iface *iface, int timeout_ms) {
       }
 
       if (((nc->flags & MG_F_CONNECTING) && !(nc->flags & MG_F_WANT_READ)) ||
-          (nc->send_mbuf.len > 0 && !(nc->flags & MG_F_CONNECTING))) {
+          (mg_send_queued(nc) > 0 && !(nc->flags & MG_F_CONNECTING))) {
         mg_add_to_set(nc->sock, &write_set, &max_fd);
         mg_add_to_set(nc->sock, &err_set, &max_fd);
       }
     }
 
-    if (nc->ev_timer_time > 0) {
-      if (num_timers == 0 || nc->ev_timer_time < min_timer) {
-        min_timer = nc->ev_timer_time;
-      }
-      num_timers++;
+    if (mg_poll_set_urgent(nc)) timeout_ms = 0;
+    mg_poll_set_prune(nc);
+  }
+
+  /*
+   * If there is a timer to be fired earlier than the requested timeout,
+   * adjust the timeout.
+   */
+  min_timer = mg_mgr_min_timer(mgr);
+  if (min_timer > 0) {
+    double timer_timeout_ms = (min_timer - mg_time()) * 1000 + 1 /* rounding */;
+    if (timer_timeout_ms < timeout_ms) {
+      timeout_ms = (int) timer_timeout_ms;
+    }
+  }
+  if (timeout_ms < 0) timeout_ms = 0;
+
+  tv.tv_sec = timeout_ms / 1000;
+  tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+  num_ev = select((int) max_fd + 1, &read_set, &write_set, &err_set, &tv);
+  now = mg_time();
+#if 0
+  DBG(("select @ %ld num_ev=%d of %d, timeout=%d", (long) now, num_ev, num_fds,
+       timeout_ms));
+#endif
+
+#if MG_ENABLE_BROADCAST
+  if (num_ev > 0 && mgr->ctl[1] != INVALID_SOCKET &&
+      FD_ISSET(mgr->ctl[1], &read_set)) {
+    mg_mgr_handle_ctl_sock(mgr);
+  }
+#endif
+
+  for (nc = mgr->active_connections; nc != NULL; nc = tmp) {
+    int fd_flags = 0;
+    if (nc->sock != INVALID_SOCKET) {
+      if (num_ev > 0) {
+        fd_flags = (FD_ISSET(nc->sock, &read_set) &&
+                            (!(nc->flags & MG_F_UDP) || nc->listener == NULL)
+                        ? _MG_F_FD_CAN_READ
+                        : 0) |
+                   (FD_ISSET(nc->sock, &write_set) ? _MG_F_FD_CAN_WRITE : 0) |
+                   (FD_ISSET(nc->sock, &err_set) ? _MG_F_FD_ERROR : 0);
+      }
+#if MG_LWIP
+      /* With LWIP socket emulation layer, we don't get write events for UDP */
+      if ((nc->flags & MG_F_UDP) && nc->listener == NULL) {
+        fd_flags |= _MG_F_FD_CAN_WRITE;
+      }
+#endif
+    }
+    tmp = nc->next;
+    /* Idle MG_F_NO_POLL connection */
+    if (fd_flags == 0 && nc->poll_pprev == NULL) continue;
+    if (fd_flags == _MG_F_FD_CAN_WRITE &&
+        mg_udp_send_batch_add(&udp_batch, nc, now)) {
+      continue;
+    }
+    mg_mgr_handle_conn(nc, fd_flags, now);
+  }
+  mg_udp_send_batch_flush(&udp_batch, now);
+
+  return (time_t) now;
+}
+
+#if MG_ENABLE_BROADCAST
+MG_INTERNAL void mg_socketpair_close(sock_t *sock) {
+  while (1) {
+    if (closesocket(*sock) == -1 && errno == EINTR) continue;
+    break;
+  }
+  *sock = INVALID_SOCKET;
+}
+
+MG_INTERNAL sock_t
+mg_socketpair_accept(sock_t sock, union socket_address *sa, socklen_t sa_len) {
+  sock_t rc;
+  while (1) {
+    if ((rc = accept(sock, &sa->sa, &sa_len)) == INVALID_SOCKET &&
+        errno == EINTR)
+      continue;
+    break;
+  }
+  return rc;
+}
+
+int mg_socketpair(sock_t sp[2], int sock_type) {
+  union socket_address sa, sa2;
+  sock_t sock;
+  socklen_t len = sizeof(sa.sin);
+  int ret = 0;
+
+  sock = sp[0] = sp[1] = INVALID_SOCKET;
+
+  (void) memset(&sa, 0, sizeof(sa));
+  sa.sin.sin_family = AF_INET;
+  sa.sin.sin_addr.s_addr = htonl(0x7f000001); /* 127.0.0.1 */
+  sa2 = sa;
+
+  if ((sock = socket(AF_INET, sock_type, 0)) == INVALID_SOCKET) {
+  } else if (bind(sock, &sa.sa, len) != 0) {
+  } else if (sock_type == SOCK_STREAM && listen(sock, 1) != 0) {
+  } else if (getsockname(sock, &sa.sa, &len) != 0) {
+  } else if ((sp[0] = socket(AF_INET, sock_type, 0)) == INVALID_SOCKET) {
+  } else if (sock_type == SOCK_STREAM && connect(sp[0], &sa.sa, len) != 0) {
+  } else if (sock_type == SOCK_DGRAM &&
+             (bind(sp[0], &sa2.sa, len) != 0 ||
+              getsockname(sp[0], &sa2.sa, &len) != 0 ||
+              connect(sp[0], &sa.sa, len) != 0 ||
+              connect(sock, &sa2.sa, len) != 0)) {
+  } else if ((sp[1] = (sock_type == SOCK_DGRAM ? sock : mg_socketpair_accept(
+                                                            sock, &sa, len))) ==
+             INVALID_SOCKET) {
+  } else {
+    mg_set_close_on_exec(sp[0]);
+    mg_set_close_on_exec(sp[1]);
+    if (sock_type == SOCK_STREAM) mg_socketpair_close(&sock);
+    ret = 1;
+  }
+
+  if (!ret) {
+    if (sp[0] != INVALID_SOCKET) mg_socketpair_close(&sp[0]);
+    if (sp[1] != INVALID_SOCKET) mg_socketpair_close(&sp[1]);
+    if (sock != INVALID_SOCKET) mg_socketpair_close(&sock);
+  }
+
+  return ret;
+}
+#endif /* MG_ENABLE_BROADCAST */
+
+static void mg_sock_get_addr(sock_t sock, int remote,
+                             union socket_address *sa) {
+  socklen_t slen = sizeof(*sa);
+  memset(sa, 0, slen);
+  if (remote) {
+    getpeername(sock, &sa->sa, &slen);
+  } else {
+    getsockname(sock, &sa->sa, &slen);
+  }
+}
+
+void mg_sock_to_str(sock_t sock, char *buf, size_t len, int flags) {
+  union socket_address sa;
+  mg_sock_get_addr(sock, flags & MG_SOCK_STRINGIFY_REMOTE, &sa);
+  mg_sock_addr_to_str(&sa, buf, len, flags);
+}
+
+void mg_socket_if_get_conn_addr(struct mg_connection *nc, int remote,
+                                union socket_address *sa) {
+  if ((nc->flags & MG_F_UDP) && remote) {
+    memcpy(sa, &nc->sa, sizeof(*sa));
+    return;
+  }
+  mg_sock_get_addr(nc->sock, remote, sa);
+}
+
+/* clang-format off */
+#define MG_SOCKET_IFACE_VTABLE                                          \
+  {                                                                     \
+    mg_socket_if_init,                                                  \
+    mg_socket_if_free,                                                  \
+    mg_socket_if_add_conn,                                              \
+    mg_socket_if_remove_conn,                                           \
+    mg_socket_if_poll,                                                  \
+    mg_socket_if_listen_tcp,                                            \
+    mg_socket_if_listen_udp,                                            \
+    mg_socket_if_connect_tcp,                                           \
+    mg_socket_if_connect_udp,                                           \
+    mg_socket_if_tcp_send,                                              \
+    mg_socket_if_udp_send,                                              \
+    mg_socket_if_tcp_recv,                                              \
+    mg_socket_if_udp_recv,                                              \
+    mg_socket_if_create_conn,                                           \
+    mg_socket_if_destroy_conn,                                          \
+    mg_socket_if_sock_set,                                              \
+    mg_socket_if_get_conn_addr,                                         \
+    mg_socket_if_tcp_sendv,                                             \
+    mg_socket_if_udp_recv_batch,                                        \
+    mg_socket_if_udp_send_batch,                                        \
+  }
+/* clang-format on */
+
+const struct mg_iface_vtable mg_socket_iface_vtable = MG_SOCKET_IFACE_VTABLE;
+#if MG_NET_IF == MG_NET_IF_SOCKET
+const struct mg_iface_vtable mg_default_iface_vtable = MG_SOCKET_IFACE_VTABLE;
+#endif
+
+#endif /* MG_ENABLE_NET_IF_SOCKET */
+#ifdef MG_MODULE_LINES
+#line 1 "mongoose/src/mg_net_if_epoll.c"
+#endif
+
+#if MG_ENABLE_NET_IF_EPOLL
+
+#include <sys/epoll.h>
+
+/* Amalgamated: #include "mg_net_if_epoll.h" */
+/* Amalgamated: #include "mg_net_if_socket.h" */
+/* Amalgamated: #include "mg_internal.h" */
+
+#ifndef MG_EPOLL_MAX_EVENTS
+#define MG_EPOLL_MAX_EVENTS 256
+#endif
+
+/*
+ * Per-connection epoll state, kept in `nc->mgr_data`:
+ * the interest currently registered with the kernel plus a "visited" mark
+ * for connections that already had their events dispatched this iteration.
+ */
+#define _MG_EPOLL_F_IN (1 << 0)
+#define _MG_EPOLL_F_OUT (1 << 1)
+#define _MG_EPOLL_F_VISITED (1 << 2)
+
+#define MG_EPOLL_STATE(nc) ((int) (intptr_t)(nc)->mgr_data)
+#define MG_EPOLL_SET_STATE(nc, st) ((nc)->mgr_data = (void *) (intptr_t)(st))
+
+struct mg_epoll_if_data {
+  int epfd;
+  int num_events; /* Number of events in the batch being dispatched */
+  int cur_event;  /* Index of the event being dispatched */
+  struct epoll_event events[MG_EPOLL_MAX_EVENTS];
+};
+
+/* UDP "connections" created by a listener share its socket, skip them. */
+static int mg_epoll_if_is_pollable(struct mg_connection *nc) {
+  return nc->sock != INVALID_SOCKET &&
+         (!(nc->flags & MG_F_UDP) || nc->listener == NULL);
+}
+
+/* Same readiness conditions mg_socket_if_poll() uses to build its fd_sets. */
+static int mg_epoll_if_wanted(struct mg_connection *nc) {
+  int wanted = 0;
+  if (!mg_epoll_if_is_pollable(nc)) return 0;
+  if (nc->recv_mbuf.len < nc->recv_mbuf_limit) wanted |= _MG_EPOLL_F_IN;
+  if (((nc->flags & MG_F_CONNECTING) && !(nc->flags & MG_F_WANT_READ)) ||
+      (mg_send_queued(nc) > 0 && !(nc->flags & MG_F_CONNECTING))) {
+    wanted |= _MG_EPOLL_F_OUT;
+  }
+  return wanted;
+}
+
+/*
+ * Brings kernel-side interest in line with what the connection needs.
+ * epoll_ctl() is only called when the interest set actually changes.
+ * Connections with no interest at all are taken out of the epoll set, so that
+ * EPOLLHUP on e.g. a receive-throttled socket does not keep waking us up.
+ */
+static void mg_epoll_if_update(struct mg_connection *nc) {
+  struct mg_epoll_if_data *d = (struct mg_epoll_if_data *) nc->iface->data;
+  int st = MG_EPOLL_STATE(nc);
+  int cur = st & (_MG_EPOLL_F_IN | _MG_EPOLL_F_OUT);
+  int wanted = mg_epoll_if_wanted(nc);
+  struct epoll_event ev;
+  int op, rc;
+
+  if (cur == wanted) return;
+  if (wanted == 0) {
+    op = EPOLL_CTL_DEL;
+  } else {
+    op = (cur == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD);
+  }
+  memset(&ev, 0, sizeof(ev));
+  ev.events = (wanted & _MG_EPOLL_F_IN ? EPOLLIN | EPOLLRDHUP : 0) |
+              (wanted & _MG_EPOLL_F_OUT ? EPOLLOUT : 0);
+  ev.data.ptr = nc;
+  rc = epoll_ctl(d->epfd, op, nc->sock, &ev);
+  if (rc != 0 && ((op == EPOLL_CTL_MOD && errno == ENOENT) ||
+                  (op == EPOLL_CTL_ADD && errno == EEXIST))) {
+    /* The cache is wrong about the fd being in the set, the kernel is not */
+    op = (op == EPOLL_CTL_MOD ? EPOLL_CTL_ADD : EPOLL_CTL_MOD);
+    rc = epoll_ctl(d->epfd, op, nc->sock, &ev);
+  }
+  if (rc != 0 && !(op == EPOLL_CTL_DEL && errno == ENOENT)) {
+    DBG(("%p epoll_ctl(%d, %d) failed: %d", nc, op, (int) nc->sock,
+         mg_get_errno()));
+    /* Keep what is cached, the connection stays on the poll set to retry */
+    wanted = cur;
+  }
+  MG_EPOLL_SET_STATE(nc, (st & ~(_MG_EPOLL_F_IN | _MG_EPOLL_F_OUT)) | wanted);
+}
+
+static void mg_epoll_if_free(struct mg_iface *iface);
+
+static void mg_epoll_if_init(struct mg_iface *iface) {
+  struct mg_epoll_if_data *d =
+      (struct mg_epoll_if_data *) MG_CALLOC(1, sizeof(*d));
+  iface->data = d;
+  if (d != NULL) d->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (d == NULL || d->epfd < 0) {
+    /* Out of memory or descriptors, select() needs neither up front. */
+    LOG(LL_ERROR, ("%p epoll() is not available (%d), falling back",
+                   iface->mgr, mg_get_errno()));
+    mg_epoll_if_free(iface);
+    iface->vtable = &mg_socket_iface_vtable;
+    iface->vtable->init(iface);
+    return;
+  }
+  DBG(("%p using epoll(), fd %d", iface->mgr, d->epfd));
+#if MG_ENABLE_BROADCAST
+  mg_mgr_ctl_open(iface->mgr);
+  if (iface->mgr->ctl[1] != INVALID_SOCKET) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = d; /* Tells control socket events from connection events */
+    epoll_ctl(d->epfd, EPOLL_CTL_ADD, iface->mgr->ctl[1], &ev);
+  }
+#endif
+}
+
+static void mg_epoll_if_free(struct mg_iface *iface) {
+  struct mg_epoll_if_data *d = (struct mg_epoll_if_data *) iface->data;
+  if (d == NULL) return;
+  if (d->epfd >= 0) close(d->epfd);
+  MG_FREE(d);
+  iface->data = NULL;
+}
+
+static void mg_epoll_if_add_conn(struct mg_connection *nc) {
+  mg_epoll_if_update(nc);
+}
+
+static void mg_epoll_if_remove_conn(struct mg_connection *nc) {
+  struct mg_epoll_if_data *d = (struct mg_epoll_if_data *) nc->iface->data;
+  int i;
+  if (MG_EPOLL_STATE(nc) & (_MG_EPOLL_F_IN | _MG_EPOLL_F_OUT)) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    epoll_ctl(d->epfd, EPOLL_CTL_DEL, nc->sock, &ev);
+  }
+  MG_EPOLL_SET_STATE(nc, 0);
+  /* Null-out pending events for this conn in the batch being dispatched. */
+  for (i = d->cur_event + 1; i < d->num_events; i++) {
+    if (d->events[i].data.ptr == nc) d->events[i].data.ptr = NULL;
+  }
+}
+
+static void mg_epoll_if_sock_set(struct mg_connection *nc, sock_t sock) {
+  mg_socket_if_sock_set(nc, sock);
+  mg_epoll_if_update(nc);
+}
+
+static time_t mg_epoll_if_poll(struct mg_iface *iface, int timeout_ms) {
+  struct mg_epoll_if_data *d = (struct mg_epoll_if_data *) iface->data;
+  struct mg_mgr *mgr = iface->mgr;
+  struct mg_connection *nc, *tmp;
+  struct mg_udp_send_batch udp_batch;
+  double now, min_timer;
+
+  /*
+   * Handlers may have queued data for any connection since the last poll,
+   * catch up on interest changes. Such connections are all on the poll set.
+   * This is a comparison per connection, syscalls are only made for the
+   * connections whose interest has flipped.
+   */
+  for (nc = mgr->poll_set; nc != NULL; nc = tmp) {
+    tmp = nc->poll_next;
+    mg_epoll_if_update(nc);
+    if (mg_poll_set_urgent(nc)) timeout_ms = 0;
+    if ((MG_EPOLL_STATE(nc) & (_MG_EPOLL_F_IN | _MG_EPOLL_F_OUT)) ==
+        mg_epoll_if_wanted(nc)) {
+      mg_poll_set_prune(nc);
+    }
+  }
+
+  min_timer = mg_mgr_min_timer(mgr);
+  if (min_timer > 0) {
+    double timer_timeout_ms = (min_timer - mg_time()) * 1000 + 1 /* rounding */;
+    if (timer_timeout_ms < timeout_ms) {
+      timeout_ms = (int) timer_timeout_ms;
+    }
+  }
+  if (timeout_ms < 0) timeout_ms = 0;
+
+  d->num_events = epoll_wait(d->epfd, d->events, MG_EPOLL_MAX_EVENTS, timeout_ms);
+  now = mg_time();
+  if (d->num_events < 0) d->num_events = 0;
+
+  /* Dispatch I/O to the ready connections only. */
+  for (d->cur_event = 0; d->cur_event < d->num_events; d->cur_event++) {
+    struct epoll_event *ev = &d->events[d->cur_event];
+    int st, fd_flags = 0;
+#if MG_ENABLE_BROADCAST
+    if (ev->data.ptr == d) {
+      mg_mgr_handle_ctl_sock(mgr);
+      continue;
+    }
+#endif
+    if ((nc = (struct mg_connection *) ev->data.ptr) == NULL) continue;
+    st = MG_EPOLL_STATE(nc);
+    if ((st & _MG_EPOLL_F_IN) &&
+        (ev->events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+      fd_flags |= _MG_F_FD_CAN_READ;
+    }
+    if ((st & _MG_EPOLL_F_OUT) &&
+        (ev->events & (EPOLLOUT | EPOLLHUP | EPOLLERR))) {
+      fd_flags |= _MG_F_FD_CAN_WRITE;
+    }
+    if (ev->events & EPOLLERR) fd_flags |= _MG_F_FD_ERROR;
+    MG_EPOLL_SET_STATE(nc, st | _MG_EPOLL_F_VISITED);
+    mg_poll_set_add(nc); /* For the VISITED mark and the interest update */
+    mg_mgr_handle_conn(nc, fd_flags, now);
+  }
+  d->num_events = d->cur_event = 0;
+
+  /* MG_EV_POLL and deferred closes for everybody else on the poll set. */
+  udp_batch.num = 0;
+  for (nc = mgr->poll_set; nc != NULL; nc = tmp) {
+    int st = MG_EPOLL_STATE(nc), fd_flags = 0;
+    tmp = nc->poll_next;
+    if (st & _MG_EPOLL_F_VISITED) {
+      MG_EPOLL_SET_STATE(nc, st & ~_MG_EPOLL_F_VISITED);
+      continue;
+    }
+    /*
+     * UDP "connections" of a listener share its socket and cannot be
+     * registered on their own. Datagram sockets are practically always
+     * writable, so just flush their replies, batched.
+     */
+    if ((nc->flags & MG_F_UDP) && nc->listener != NULL &&
+        nc->send_mbuf.len > 0) {
+      if (mg_udp_send_batch_add(&udp_batch, nc, now)) continue;
+      fd_flags = _MG_F_FD_CAN_WRITE;
+    }
+    mg_mgr_handle_conn(nc, fd_flags, now);
+  }
+  mg_udp_send_batch_flush(&udp_batch, now);
+
+  return (time_t) now;
+}
+
+/* clang-format off */
+#define MG_EPOLL_IFACE_VTABLE                                           \
+  {                                                                     \
+    mg_epoll_if_init,                                                   \
+    mg_epoll_if_free,                                                   \
+    mg_epoll_if_add_conn,                                               \
+    mg_epoll_if_remove_conn,                                            \
+    mg_epoll_if_poll,                                                   \
+    mg_socket_if_listen_tcp,                                            \
+    mg_socket_if_listen_udp,                                            \
+    mg_socket_if_connect_tcp,                                           \
+    mg_socket_if_connect_udp,                                           \
+    mg_socket_if_tcp_send,                                              \
+    mg_socket_if_udp_send,                                              \
+    mg_socket_if_tcp_recv,                                              \
+    mg_socket_if_udp_recv,                                              \
+    mg_socket_if_create_conn,                                           \
+    mg_socket_if_destroy_conn,                                          \
+    mg_epoll_if_sock_set,                                               \
+    mg_socket_if_get_conn_addr,                                         \
+    mg_socket_if_tcp_sendv,                                             \
+    mg_socket_if_udp_recv_batch,                                        \
+    mg_socket_if_udp_send_batch,                                        \
+  }
+/* clang-format on */
+
+const struct mg_iface_vtable mg_epoll_iface_vtable = MG_EPOLL_IFACE_VTABLE;
+
+#endif /* MG_ENABLE_NET_IF_EPOLL */
+#ifdef MG_MODULE_LINES
+#line 1 "mongoose/src/mg_net_if_io_uring.c"
+#endif
+
+#if MG_ENABLE_NET_IF_IO_URING
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* Not declared under _XOPEN_SOURCE, and liburing is not required. */
+extern long syscall(long number, ...);
+
+/* Amalgamated: #include "mg_net_if_io_uring.h" */
+/* Amalgamated: #include "mg_net_if_epoll.h" */
+/* Amalgamated: #include "mg_net_if_socket.h" */
+/* Amalgamated: #include "mg_internal.h" */
+
+#ifndef MG_IO_URING_ENTRIES
+#define MG_IO_URING_ENTRIES 256
+#endif
+
+/* Provided receive buffers. The count must be a power of 2. */
+#ifndef MG_IO_URING_NUM_BUFS
+#define MG_IO_URING_NUM_BUFS 256
+#endif
+
+#ifndef MG_IO_URING_BUF_SIZE
+#define MG_IO_URING_BUF_SIZE 4096
+#endif
+
+/* Received-but-unconsumed buffers a connection may hold before recv stops. */
+#ifndef MG_IO_URING_MAX_RX_PENDING
+#define MG_IO_URING_MAX_RX_PENDING 8
+#endif
+
+/* How much of send_mbuf is handed to a single SEND submission. */
+#ifndef MG_IO_URING_MAX_TX
+#define MG_IO_URING_MAX_TX 65536
+#endif
+
+#define MG_IO_URING_BGID 0
+
+/* Operation tag, kept in the low bits of the SQE user_data. */
+#define MG_URING_OP_ACCEPT 1
+#define MG_URING_OP_RECV 2
+#define MG_URING_OP_SEND 3
+#define MG_URING_OP_POLL_IN 4
+#define MG_URING_OP_POLL_OUT 5
+#define MG_URING_OP_CTL 6
+#define MG_URING_OP_MASK 7
+
+/* Connection state flags. */
+#define MG_URING_F_ACCEPT (1 << 0)   /* Accept is armed */
+#define MG_URING_F_RECV (1 << 1)     /* Recv is armed */
+#define MG_URING_F_SEND (1 << 2)     /* Send is in flight */
+#define MG_URING_F_POLL_IN (1 << 3)  /* Read poll is armed */
+#define MG_URING_F_POLL_OUT (1 << 4) /* Write poll is armed */
+#define MG_URING_F_POLL_MODE (1 << 5) /* Readiness-based, like epoll */
+#define MG_URING_F_EOF (1 << 6)
+#define MG_URING_F_DEAD (1 << 7)     /* Detached from its connection */
+#define MG_URING_F_CLOSE_FD (1 << 8) /* Close the socket when freed */
+
+struct mg_uring_rx {
+  uint16_t bid;
+  uint32_t len;
+  uint32_t off;
+};
+
+/*
+ * Per-connection state, referenced from `nc->mgr_data`. It outlives the
+ * connection until all of its submissions have completed, so that the kernel
+ * never completes into freed memory.
+ */
+struct mg_uring_conn {
+  struct mg_connection *nc;
+  struct mg_uring_conn *next_dead;
+  int fd;
+  int flags;
+  int inflight; /* Submissions that still owe us a final completion */
+  int err;
+  int ready;    /* _MG_F_FD_* bits to be dispatched this iteration */
+  struct mg_uring_rx *rx; /* Pending received buffers, a FIFO */
+  int rx_head, rx_len, rx_cap;
+  struct mbuf tx; /* Data being sent, must stay put while in flight */
+  size_t tx_off;
+};
+
+struct mg_uring_timespec {
+  int64_t tv_sec;
+  long long tv_nsec;
+};
+
+struct mg_io_uring_if_data {
+  int ring_fd;
+  unsigned int sq_entries, sq_tail, sq_submitted;
+  unsigned int *sq_head_p, *sq_tail_p, *sq_mask_p, *sq_array;
+  unsigned int *cq_head_p, *cq_tail_p, *cq_mask_p;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ring, *cq_ring;
+  size_t sq_ring_sz, cq_ring_sz, sqes_sz;
+  struct io_uring_buf_ring *br;
+  char *bufs;
+  uint16_t br_tail;
+  int no_multishot_accept, no_multishot_recv;
+  int ctl_armed;
+  int sq_full; /* An SQE could not be had, keep connections to retry */
+  struct mg_uring_conn *dead; /* Detached states with completions pending */
+};
+
+static int mg_uring_enter(int fd, unsigned int to_submit,
+                          unsigned int min_complete, unsigned int flags,
+                          void *arg, size_t argsz) {
+  return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                       arg, argsz);
+}
+
+static void mg_uring_flush(struct mg_io_uring_if_data *d, int timeout_ms) {
+  struct io_uring_getevents_arg arg;
+  struct mg_uring_timespec ts;
+  unsigned int to_submit = d->sq_tail - d->sq_submitted;
+  unsigned int flags = IORING_ENTER_EXT_ARG;
+  int n;
+
+  __atomic_store_n(d->sq_tail_p, d->sq_tail, __ATOMIC_RELEASE);
+  memset(&arg, 0, sizeof(arg));
+  if (timeout_ms >= 0) {
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (long long) (timeout_ms % 1000) * 1000000;
+    arg.ts = (uint64_t)(uintptr_t) &ts;
+    flags |= IORING_ENTER_GETEVENTS;
+  }
+  if (to_submit == 0 && timeout_ms < 0) return;
+  n = mg_uring_enter(d->ring_fd, to_submit, timeout_ms >= 0 ? 1 : 0, flags,
+                     &arg, sizeof(arg));
+  if (n > 0) d->sq_submitted += (unsigned int) n;
+}
+
+static struct io_uring_sqe *mg_uring_get_sqe(struct mg_io_uring_if_data *d) {
+  struct io_uring_sqe *sqe;
+  unsigned int idx;
+  if (d->sq_tail - __atomic_load_n(d->sq_head_p, __ATOMIC_ACQUIRE) >=
+      d->sq_entries) {
+    mg_uring_flush(d, -1); /* Full, push what we have to the kernel */
+    if (d->sq_tail - __atomic_load_n(d->sq_head_p, __ATOMIC_ACQUIRE) >=
+        d->sq_entries) {
+      d->sq_full = 1;
+      return NULL;
+    }
+  }
+  idx = d->sq_tail & *d->sq_mask_p;
+  sqe = &d->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  d->sq_array[idx] = idx;
+  d->sq_tail++;
+  return sqe;
+}
+
+static uint64_t mg_uring_tag(struct mg_uring_conn *cs, int op) {
+  return (uint64_t)(uintptr_t) cs | (uint64_t) op;
+}
+
+static void mg_uring_buf_put(struct mg_io_uring_if_data *d, uint16_t bid) {
+  struct io_uring_buf *b =
+      &d->br->bufs[d->br_tail & (MG_IO_URING_NUM_BUFS - 1)];
+  b->addr = (uint64_t)(uintptr_t)(d->bufs + (size_t) bid * MG_IO_URING_BUF_SIZE);
+  b->len = MG_IO_URING_BUF_SIZE;
+  b->bid = bid;
+  d->br_tail++;
+  __atomic_store_n(&d->br->tail, d->br_tail, __ATOMIC_RELEASE);
+}
+
+static int mg_uring_submit(struct mg_io_uring_if_data *d,
+                           struct mg_uring_conn *cs, int op, int flag) {
+  struct io_uring_sqe *sqe = mg_uring_get_sqe(d);
+  if (sqe == NULL) return 0;
+  sqe->fd = cs->fd;
+  sqe->user_data = mg_uring_tag(cs, op);
+  switch (op) {
+    case MG_URING_OP_ACCEPT:
+      sqe->opcode = IORING_OP_ACCEPT;
+      sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+      if (!d->no_multishot_accept) sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+      break;
+    case MG_URING_OP_RECV:
+      sqe->opcode = IORING_OP_RECV;
+      sqe->flags = IOSQE_BUFFER_SELECT;
+      sqe->buf_group = MG_IO_URING_BGID;
+      if (!d->no_multishot_recv) sqe->ioprio = IORING_RECV_MULTISHOT;
+      break;
+    case MG_URING_OP_SEND:
+      sqe->opcode = IORING_OP_SEND;
+      sqe->addr = (uint64_t)(uintptr_t)(cs->tx.buf + cs->tx_off);
+      sqe->len = (uint32_t)(cs->tx.len - cs->tx_off);
+      sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+      /* See MG_F_SEND_MORE */
+      if (cs->nc != NULL && (cs->nc->flags & MG_F_SEND_MORE)) {
+        sqe->msg_flags |= MSG_MORE;
+      }
+      break;
+    case MG_URING_OP_POLL_IN:
+    case MG_URING_OP_POLL_OUT:
+      sqe->opcode = IORING_OP_POLL_ADD;
+      sqe->poll32_events = (op == MG_URING_OP_POLL_IN ? POLLIN : POLLOUT);
+      break;
+  }
+  cs->flags |= flag;
+  cs->inflight++;
+  return 1;
+}
+
+/* Asks the kernel to drop a (multishot) submission. */
+static void mg_uring_cancel(struct mg_io_uring_if_data *d,
+                            struct mg_uring_conn *cs, int op) {
+  struct io_uring_sqe *sqe = mg_uring_get_sqe(d);
+  if (sqe == NULL) return;
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = mg_uring_tag(cs, op);
+  sqe->user_data = 0; /* Completion is ignored */
+}
+
+static void mg_uring_rx_push(struct mg_uring_conn *cs, uint16_t bid,
+                             uint32_t len) {
+  if (cs->rx_len == cs->rx_cap) {
+    int i, cap = cs->rx_cap ? cs->rx_cap * 2 : MG_IO_URING_MAX_RX_PENDING;
+    struct mg_uring_rx *rx =
+        (struct mg_uring_rx *) MG_MALLOC(sizeof(*rx) * (size_t) cap);
+    for (i = 0; i < cs->rx_len; i++) {
+      rx[i] = cs->rx[(cs->rx_head + i) % cs->rx_cap];
+    }
+    MG_FREE(cs->rx);
+    cs->rx = rx;
+    cs->rx_cap = cap;
+    cs->rx_head = 0;
+  }
+  cs->rx[(cs->rx_head + cs->rx_len) % cs->rx_cap].bid = bid;
+  cs->rx[(cs->rx_head + cs->rx_len) % cs->rx_cap].len = len;
+  cs->rx[(cs->rx_head + cs->rx_len) % cs->rx_cap].off = 0;
+  cs->rx_len++;
+}
+
+static void mg_uring_conn_release(struct mg_io_uring_if_data *d,
+                                  struct mg_uring_conn *cs) {
+  while (cs->rx_len > 0) {
+    mg_uring_buf_put(d, cs->rx[cs->rx_head].bid);
+    cs->rx_head = (cs->rx_head + 1) % cs->rx_cap;
+    cs->rx_len--;
+  }
+  if (cs->flags & MG_URING_F_CLOSE_FD) close(cs->fd);
+  MG_FREE(cs->rx);
+  mbuf_free(&cs->tx);
+  MG_FREE(cs);
+}
+
+/* Frees detached states once the kernel is done with them. */
+static void mg_uring_reap_dead(struct mg_io_uring_if_data *d) {
+  struct mg_uring_conn **p = &d->dead;
+  while (*p != NULL) {
+    struct mg_uring_conn *cs = *p;
+    if (cs->inflight == 0) {
+      *p = cs->next_dead;
+      mg_uring_conn_release(d, cs);
+    } else {
+      p = &cs->next_dead;
+    }
+  }
+}
+
+/*
+ * Takes the state away from its connection: armed submissions are cancelled
+ * and the state is freed once their final completions have arrived.
+ */
+static void mg_uring_detach(struct mg_connection *nc) {
+  struct mg_io_uring_if_data *d =
+      (struct mg_io_uring_if_data *) nc->iface->data;
+  struct mg_uring_conn *cs = (struct mg_uring_conn *) nc->mgr_data;
+  if (cs == NULL || (cs->flags & MG_URING_F_DEAD)) return;
+  cs->nc = NULL;
+  cs->flags |= MG_URING_F_DEAD;
+  if (cs->flags & MG_URING_F_ACCEPT) mg_uring_cancel(d, cs, MG_URING_OP_ACCEPT);
+  if (cs->flags & MG_URING_F_RECV) mg_uring_cancel(d, cs, MG_URING_OP_RECV);
+  if (cs->flags & MG_URING_F_POLL_IN) {
+    mg_uring_cancel(d, cs, MG_URING_OP_POLL_IN);
+  }
+  if (cs->flags & MG_URING_F_POLL_OUT) {
+    mg_uring_cancel(d, cs, MG_URING_OP_POLL_OUT);
+  }
+  /* Give unread buffers back right away, other connections may need them. */
+  while (cs->rx_len > 0) {
+    mg_uring_buf_put(d, cs->rx[cs->rx_head].bid);
+    cs->rx_head = (cs->rx_head + 1) % cs->rx_cap;
+    cs->rx_len--;
+  }
+  cs->next_dead = d->dead;
+  d->dead = cs;
+}
+
+static int mg_uring_if_tcp_send(struct mg_connection *nc, const void *buf,
+                                size_t len) {
+  struct mg_uring_conn *cs = (struct mg_uring_conn *) nc->mgr_data;
+  if (cs == NULL || (cs->flags & MG_URING_F_POLL_MODE)) {
+    return mg_socket_if_tcp_send(nc, buf, len);
+  }
+  if (cs->err != 0) return -1;
+  /* Data is picked up from here by the SEND submitted in the poll loop. */
+  if ((cs->flags & MG_URING_F_SEND) || cs->tx.len >= MG_IO_URING_MAX_TX) {
+    return 0;
+  }
+  mg_io_buf_reserve(nc->mgr, &cs->tx, len);
+  return (int) mbuf_append(&cs->tx, buf, len);
+}
+
+static int mg_uring_if_tcp_recv(struct mg_connection *nc, void *buf,
+                                size_t len) {
+  struct mg_io_uring_if_data *d =
+      (struct mg_io_uring_if_data *) nc->iface->data;
+  struct mg_uring_conn *cs = (struct mg_uring_conn *) nc->mgr_data;
+  size_t n = 0;
+  if (cs == NULL || (cs->flags & MG_URING_F_POLL_MODE)) {
+    return mg_socket_if_tcp_recv(nc, buf, len);
+  }
+  while (n < len && cs->rx_len > 0) {
+    struct mg_uring_rx *rx = &cs->rx[cs->rx_head];
+    size_t k = rx->len - rx->off;
+    if (k > len - n) k = len - n;
+    memcpy((char *) buf + n,
+           d->bufs + (size_t) rx->bid * MG_IO_URING_BUF_SIZE + rx->off, k);
+    rx->off += (uint32_t) k;
+    n += k;
+    if (rx->off == rx->len) {
+      mg_uring_buf_put(d, rx->bid);
+      cs->rx_head = (cs->rx_head + 1) % cs->rx_cap;
+      cs->rx_len--;
+    }
+  }
+  if (n == 0) {
+    if (cs->err != 0) return -1;
+    /* Orderly shutdown of the socket, try flushing output. */
+    if (cs->flags & MG_URING_F_EOF) nc->flags |= MG_F_SEND_AND_CLOSE;
+  }
+  return (int) n;
+}
+
+static void mg_uring_if_sock_set(struct mg_connection *nc, sock_t sock) {
+  struct mg_uring_conn *cs;
+  mg_socket_if_sock_set(nc, sock);
+  mg_uring_detach(nc);
+  nc->mgr_data = NULL;
+  cs = (struct mg_uring_conn *) MG_CALLOC(1, sizeof(*cs));
+  cs->nc = nc;
+  cs->fd = sock;
+  /*
+   * Accepted plain TCP connections and TCP listeners are driven by
+   * completions. SSL (the library does its own socket I/O), UDP and outgoing
+   * connections fall back to readiness polling.
+   */
+  if ((nc->flags & (MG_F_UDP | MG_F_SSL)) ||
+      (nc->listener == NULL && !(nc->flags & MG_F_LISTENING))) {
+    cs->flags |= MG_URING_F_POLL_MODE;
+  }
+  nc->mgr_data = cs;
+}
+
+static void mg_uring_if_add_conn(struct mg_connection *nc) {
+  /* UDP "connections" of a listener share its socket, nothing to attach. */
+  if (nc->mgr_data == NULL && nc->sock != INVALID_SOCKET &&
+      !((nc->flags & MG_F_UDP) && nc->listener != NULL)) {
+    mg_uring_if_sock_set(nc, nc->sock);
+  }
+}
+
+static void mg_uring_if_remove_conn(struct mg_connection *nc) {
+  mg_uring_detach(nc);
+}
+
+static void mg_uring_if_destroy_conn(struct mg_connection *nc) {
+  struct mg_uring_conn *cs = (struct mg_uring_conn *) nc->mgr_data;
+  if (cs != NULL) {
+    mg_uring_detach(nc);
+    nc->mgr_data = NULL;
+    /*
+     * The kernel may still be sending the tail of a MG_F_SEND_AND_CLOSE
+     * connection. Keep the socket open, and its number reserved, until then.
+     */
+    if (cs->inflight > 0 && nc->sock == cs->fd) {
+      cs->flags |= MG_URING_F_CLOSE_FD;
+      nc->sock = INVALID_SOCKET;
+    }
+  }
+  mg_socket_if_destroy_conn(nc);
+}
+
+static void mg_uring_accept(struct mg_connection *lc, int sock) {
+  union socket_address sa;
+  socklen_t sa_len = sizeof(sa);
+  struct mg_connection *nc = mg_if_accept_new_conn(lc);
+  if (nc == NULL) {
+    closesocket(sock);
+    return;
+  }
+  memset(&sa, 0, sizeof(sa));
+  getpeername(sock, &sa.sa, &sa_len);
+  mg_sock_set(nc, sock);
+  mg_if_accept_tcp_cb(nc, &sa, sa_len);
+}
+
+static void mg_uring_handle_cqe(struct mg_io_uring_if_data *d,
+                                struct mg_mgr *mgr,
+                                const struct io_uring_cqe *cqe) {
+  int op = (int) (cqe->user_data & MG_URING_OP_MASK);
+  struct mg_uring_conn *cs =
+      (struct mg_uring_conn *) (uintptr_t)(cqe->user_data & ~(uint64_t)
+                                                                MG_URING_OP_MASK);
+  int more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+
+  if (cqe->user_data == 0) return; /* Cancellation result */
+  if (op == MG_URING_OP_CTL) {
+    d->ctl_armed = 0;
+#if MG_ENABLE_BROADCAST
+    if (cqe->res > 0) mg_mgr_handle_ctl_sock(mgr);
+#endif
+    return;
+  }
+  (void) mgr;
+
+  switch (op) {
+    case MG_URING_OP_ACCEPT:
+      if (!more) {
+        cs->flags &= ~MG_URING_F_ACCEPT;
+        cs->inflight--;
+      }
+      if (cqe->res >= 0) {
+        if (cs->nc != NULL) {
+          mg_uring_accept(cs->nc, cqe->res);
+        } else {
+          close(cqe->res);
+        }
+      } else if (cqe->res == -EINVAL && !d->no_multishot_accept) {
+        DBG(("multishot accept is not supported"));
+        d->no_multishot_accept = 1;
+      }
+      break;
+    case MG_URING_OP_RECV:
+      if (!more) {
+        cs->flags &= ~MG_URING_F_RECV;
+        cs->inflight--;
+      }
+      if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+        mg_uring_rx_push(cs, (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT),
+                         (uint32_t) cqe->res);
+        if (more && cs->rx_len >= MG_IO_URING_MAX_RX_PENDING &&
+            !(cs->flags & MG_URING_F_DEAD)) {
+          /* The app is not keeping up, stop receiving for now. */
+          mg_uring_cancel(d, cs, MG_URING_OP_RECV);
+        }
+      } else if (cqe->res == 0) {
+        cs->flags |= MG_URING_F_EOF;
+      } else if (cqe->res == -EINVAL && !d->no_multishot_recv) {
+        DBG(("multishot recv is not supported"));
+        d->no_multishot_recv = 1;
+      } else if (cqe->res < 0 && cqe->res != -ENOBUFS &&
+                 cqe->res != -ECANCELED && cqe->res != -EAGAIN &&
+                 cqe->res != -EINTR) {
+        cs->err = -cqe->res;
+      }
+      cs->ready |= _MG_F_FD_CAN_READ;
+      break;
+    case MG_URING_OP_SEND:
+      cs->inflight--;
+      cs->flags &= ~MG_URING_F_SEND;
+      if (cqe->res < 0 && cqe->res != -EAGAIN && cqe->res != -EINTR) {
+        cs->err = -cqe->res;
+        cs->ready |= _MG_F_FD_CAN_READ;
+      } else {
+        if (cqe->res > 0) cs->tx_off += (size_t) cqe->res;
+        if (cs->tx_off >= cs->tx.len) {
+          /* Idle connections don't hold on to a send buffer */
+          if (cs->nc != NULL) {
+            mg_io_buf_release(cs->nc->mgr, &cs->tx);
+          } else {
+            mbuf_free(&cs->tx);
+          }
+          cs->tx_off = 0;
+        } else if (cs->err == 0) {
+          mg_uring_submit(d, cs, MG_URING_OP_SEND, MG_URING_F_SEND);
+        }
+      }
+      break;
+    case MG_URING_OP_POLL_IN:
+    case MG_URING_OP_POLL_OUT:
+      cs->inflight--;
+      cs->flags &= ~(op == MG_URING_OP_POLL_IN ? MG_URING_F_POLL_IN
+                                              : MG_URING_F_POLL_OUT);
+      if (cqe->res > 0) {
+        if (op == MG_URING_OP_POLL_IN || (cqe->res & (POLLERR | POLLHUP))) {
+          cs->ready |= (op == MG_URING_OP_POLL_IN ? _MG_F_FD_CAN_READ
+                                                 : _MG_F_FD_CAN_WRITE);
+        } else {
+          cs->ready |= _MG_F_FD_CAN_WRITE;
+        }
+        if (cqe->res & POLLERR) cs->ready |= _MG_F_FD_ERROR;
+      }
+      break;
+  }
+  if (cs->nc != NULL) mg_poll_set_add(cs->nc);
+}
+
+/*
+ * Arms whatever submissions the connection needs and hands queued output to
+ * the kernel. Returns non-zero if the connection has work to dispatch
+ * without waiting.
+ */
+static int mg_uring_if_update(struct mg_io_uring_if_data *d,
+                              struct mg_connection *nc) {
+  struct mg_uring_conn *cs = (struct mg_uring_conn *) nc->mgr_data;
+  if (cs == NULL) {
+    /* UDP "connections" of a listener, flush their replies. */
+    if ((nc->flags & MG_F_UDP) && nc->listener != NULL &&
+        nc->send_mbuf.len > 0) {
+      return 1;
+    }
+    return 0;
+  }
+
+  if (cs->flags & MG_URING_F_POLL_MODE) {
+    if (nc->recv_mbuf.len < nc->recv_mbuf_limit &&
+        !(cs->flags & MG_URING_F_POLL_IN)) {
+      mg_uring_submit(d, cs, MG_URING_OP_POLL_IN, MG_URING_F_POLL_IN);
+    }
+    if ((((nc->flags & MG_F_CONNECTING) && !(nc->flags & MG_F_WANT_READ)) ||
+         (nc->send_mbuf.len > 0 && !(nc->flags & MG_F_CONNECTING))) &&
+        !(cs->flags & MG_URING_F_POLL_OUT)) {
+      mg_uring_submit(d, cs, MG_URING_OP_POLL_OUT, MG_URING_F_POLL_OUT);
+    }
+    return cs->ready != 0;
+  }
+
+  if (nc->flags & MG_F_LISTENING) {
+    if (!(cs->flags & MG_URING_F_ACCEPT)) {
+      mg_uring_submit(d, cs, MG_URING_OP_ACCEPT, MG_URING_F_ACCEPT);
     }
+    return 0;
   }
 
-  /*
-   * If there is a timer to be fired earlier than the requested timeout,
-   * adjust the timeout.
-   */
-  if (num_timers > 0) {
-    double timer_timeout_ms = (min_timer - mg_time()) * 1000 + 1 /* rounding */;
-    if (timer_timeout_ms < timeout_ms) {
-      timeout_ms = (int) timer_timeout_ms;
+  /* Move queued output into the send buffer and submit it. */
+  if (!(cs->flags & MG_URING_F_SEND) && cs->err == 0 &&
+      !(nc->flags & MG_F_CLOSE_IMMEDIATELY)) {
+    while (nc->send_mbuf.len > 0 && cs->tx.len < MG_IO_URING_MAX_TX) {
+      size_t before = nc->send_mbuf.len;
+      mg_if_can_send_cb(nc);
+      if (nc->send_mbuf.len >= before) break;
+    }
+    if (cs->tx.len > cs->tx_off) {
+      mg_uring_submit(d, cs, MG_URING_OP_SEND, MG_URING_F_SEND);
     }
   }
-  if (timeout_ms < 0) timeout_ms = 0;
 
-  tv.tv_sec = timeout_ms / 1000;
-  tv.tv_usec = (timeout_ms % 1000) * 1000;
+  if (cs->rx_len > 0 && nc->recv_mbuf.len < nc->recv_mbuf_limit) {
+    cs->ready |= _MG_F_FD_CAN_READ;
+  }
+  if (!(cs->flags & (MG_URING_F_RECV | MG_URING_F_EOF)) && cs->err == 0 &&
+      cs->rx_len < MG_IO_URING_MAX_RX_PENDING) {
+    mg_uring_submit(d, cs, MG_URING_OP_RECV, MG_URING_F_RECV);
+  }
+  return cs->ready != 0;
+}
 
-  num_ev = select((int) max_fd + 1, &read_set, &write_set, &err_set, &tv);
-  now = mg_time();
-#if 0
-  DBG(("select @ %ld num_ev=%d of %d, timeout=%d", (long) now, num_ev, num_fds,
-       timeout_ms));
-#endif
+static void mg_uring_if_free(struct mg_iface *iface);
 
-#if MG_ENABLE_BROADCAST
-  if (num_ev > 0 && mgr->ctl[1] != INVALID_SOCKET &&
-      FD_ISSET(mgr->ctl[1], &read_set)) {
-    mg_mgr_handle_ctl_sock(mgr);
-  }
-#endif
+static void mg_uring_if_init(struct mg_iface *iface) {
+  struct mg_io_uring_if_data *d =
+      (struct mg_io_uring_if_data *) MG_CALLOC(1, sizeof(*d));
+  struct io_uring_params p;
+  struct io_uring_buf_reg reg;
+  size_t br_sz = MG_IO_URING_NUM_BUFS * sizeof(struct io_uring_buf);
+  void *br = NULL;
+  int i, ok = 0;
 
-  for (nc = mgr->active_connections; nc != NULL; nc = tmp) {
-    int fd_flags = 0;
-    if (nc->sock != INVALID_SOCKET) {
-      if (num_ev > 0) {
-        fd_flags = (FD_ISSET(nc->sock, &read_set) &&
-                            (!(nc->flags & MG_F_UDP) || nc->listener == NULL)
-                        ? _MG_F_FD_CAN_READ
-                        : 0) |
-                   (FD_ISSET(nc->sock, &write_set) ? _MG_F_FD_CAN_WRITE : 0) |
-                   (FD_ISSET(nc->sock, &err_set) ? _MG_F_FD_ERROR : 0);
-      }
-#if MG_LWIP
-      /* With LWIP socket emulation layer, we don't get write events for UDP */
-      if ((nc->flags & MG_F_UDP) && nc->listener == NULL) {
-        fd_flags |= _MG_F_FD_CAN_WRITE;
+  iface->data = d;
+  memset(&p, 0, sizeof(p));
+  d->ring_fd = (int) syscall(__NR_io_uring_setup, MG_IO_URING_ENTRIES, &p);
+  if (d->ring_fd < 0) {
+    DBG(("io_uring_setup failed: %d", mg_get_errno()));
+  } else if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+             !(p.features & IORING_FEAT_EXT_ARG)) {
+    DBG(("io_uring is too old, features %#x", p.features));
+  } else {
+    d->sq_entries = p.sq_entries;
+    d->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    d->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (d->cq_ring_sz > d->sq_ring_sz) d->sq_ring_sz = d->cq_ring_sz;
+    d->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    d->sq_ring = mmap(NULL, d->sq_ring_sz, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, d->ring_fd, IORING_OFF_SQ_RING);
+    d->sqes = (struct io_uring_sqe *) mmap(
+        NULL, d->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED, d->ring_fd,
+        IORING_OFF_SQES);
+    if (d->sq_ring != MAP_FAILED && (void *) d->sqes != MAP_FAILED &&
+        posix_memalign(&br, 4096, br_sz) == 0) {
+      char *sq = (char *) d->sq_ring;
+      d->cq_ring = d->sq_ring; /* IORING_FEAT_SINGLE_MMAP */
+      d->sq_head_p = (unsigned int *) (sq + p.sq_off.head);
+      d->sq_tail_p = (unsigned int *) (sq + p.sq_off.tail);
+      d->sq_mask_p = (unsigned int *) (sq + p.sq_off.ring_mask);
+      d->sq_array = (unsigned int *) (sq + p.sq_off.array);
+      d->cq_head_p = (unsigned int *) (sq + p.cq_off.head);
+      d->cq_tail_p = (unsigned int *) (sq + p.cq_off.tail);
+      d->cq_mask_p = (unsigned int *) (sq + p.cq_off.ring_mask);
+      d->cqes = (struct io_uring_cqe *) (sq + p.cq_off.cqes);
+      d->sq_tail = d->sq_submitted = *d->sq_tail_p;
+
+      /* Provided buffer ring for receives, Linux 5.19+ */
+      memset(br, 0, br_sz);
+      d->br = (struct io_uring_buf_ring *) br;
+      memset(&reg, 0, sizeof(reg));
+      reg.ring_addr = (uint64_t)(uintptr_t) br;
+      reg.ring_entries = MG_IO_URING_NUM_BUFS;
+      reg.bgid = MG_IO_URING_BGID;
+      d->bufs = (char *) MG_MALLOC((size_t) MG_IO_URING_NUM_BUFS *
+                                   MG_IO_URING_BUF_SIZE);
+      if (d->bufs != NULL &&
+          syscall(__NR_io_uring_register, d->ring_fd,
+                  IORING_REGISTER_PBUF_RING, &reg, 1) == 0) {
+        for (i = 0; i < MG_IO_URING_NUM_BUFS; i++) {
+          mg_uring_buf_put(d, (uint16_t) i);
+        }
+        ok = 1;
+      } else {
+        DBG(("provided buffer rings are not supported: %d", mg_get_errno()));
       }
-#endif
     }
-    tmp = nc->next;
-    mg_mgr_handle_conn(nc, fd_flags, now);
   }
 
-  return (time_t) now;
-}
-
-#if MG_ENABLE_BROADCAST
-MG_INTERNAL void mg_socketpair_close(sock_t *sock) {
-  while (1) {
-    if (closesocket(*sock) == -1 && errno == EINTR) continue;
-    break;
+  if (!ok) {
+    /* Kernel lacks what we need, use a readiness-based iface instead. */
+    mg_uring_if_free(iface);
+#if MG_ENABLE_NET_IF_EPOLL
+    iface->vtable = &mg_epoll_iface_vtable;
+#else
+    iface->vtable = &mg_socket_iface_vtable;
+#endif
+    LOG(LL_INFO, ("%p io_uring is not available, falling back", iface->mgr));
+    iface->vtable->init(iface);
+    return;
   }
-  *sock = INVALID_SOCKET;
+  DBG(("%p using io_uring, fd %d", iface->mgr, d->ring_fd));
+#if MG_ENABLE_BROADCAST
+  mg_mgr_ctl_open(iface->mgr);
+#endif
 }
 
-MG_INTERNAL sock_t
-mg_socketpair_accept(sock_t sock, union socket_address *sa, socklen_t sa_len) {
-  sock_t rc;
-  while (1) {
-    if ((rc = accept(sock, &sa->sa, &sa_len)) == INVALID_SOCKET &&
-        errno == EINTR)
-      continue;
-    break;
-  }
-  return rc;
+static void mg_uring_if_free(struct mg_iface *iface) {
+  struct mg_io_uring_if_data *d = (struct mg_io_uring_if_data *) iface->data;
+  if (d == NULL) return;
+  /* Closing the ring cancels whatever is still in flight. */
+  if (d->ring_fd >= 0) close(d->ring_fd);
+  while (d->dead != NULL) {
+    struct mg_uring_conn *cs = d->dead;
+    d->dead = cs->next_dead;
+    cs->rx_len = 0; /* The buffer ring is going away */
+    mg_uring_conn_release(d, cs);
+  }
+  if (d->sq_ring != NULL && d->sq_ring != MAP_FAILED) {
+    munmap(d->sq_ring, d->sq_ring_sz);
+  }
+  if (d->sqes != NULL && (void *) d->sqes != MAP_FAILED) {
+    munmap(d->sqes, d->sqes_sz);
+  }
+  free(d->br);
+  MG_FREE(d->bufs);
+  MG_FREE(d);
+  iface->data = NULL;
 }
 
-int mg_socketpair(sock_t sp[2], int sock_type) {
-  union socket_address sa, sa2;
-  sock_t sock;
-  socklen_t len = sizeof(sa.sin);
-  int ret = 0;
-
-  sock = sp[0] = sp[1] = INVALID_SOCKET;
+static time_t mg_uring_if_poll(struct mg_iface *iface, int timeout_ms) {
+  struct mg_io_uring_if_data *d = (struct mg_io_uring_if_data *) iface->data;
+  struct mg_mgr *mgr = iface->mgr;
+  struct mg_connection *nc, *tmp;
+  double now, min_timer;
+  int have_work = 0;
+  unsigned int head, tail;
 
-  (void) memset(&sa, 0, sizeof(sa));
-  sa.sin.sin_family = AF_INET;
-  sa.sin.sin_addr.s_addr = htonl(0x7f000001); /* 127.0.0.1 */
-  sa2 = sa;
+#if MG_ENABLE_BROADCAST
+  if (!d->ctl_armed && mgr->ctl[1] != INVALID_SOCKET) {
+    struct io_uring_sqe *sqe = mg_uring_get_sqe(d);
+    if (sqe != NULL) {
+      sqe->opcode = IORING_OP_POLL_ADD;
+      sqe->fd = mgr->ctl[1];
+      sqe->poll32_events = POLLIN;
+      sqe->user_data = MG_URING_OP_CTL;
+      d->ctl_armed = 1;
+    }
+  }
+#endif
 
-  if ((sock = socket(AF_INET, sock_type, 0)) == INVALID_SOCKET) {
-  } else if (bind(sock, &sa.sa, len) != 0) {
-  } else if (sock_type == SOCK_STREAM && listen(sock, 1) != 0) {
-  } else if (getsockname(sock, &sa.sa, &len) != 0) {
-  } else if ((sp[0] = socket(AF_INET, sock_type, 0)) == INVALID_SOCKET) {
-  } else if (sock_type == SOCK_STREAM && connect(sp[0], &sa.sa, len) != 0) {
-  } else if (sock_type == SOCK_DGRAM &&
-             (bind(sp[0], &sa2.sa, len) != 0 ||
-              getsockname(sp[0], &sa2.sa, &len) != 0 ||
-              connect(sp[0], &sa.sa, len) != 0 ||
-              connect(sock, &sa2.sa, len) != 0)) {
-  } else if ((sp[1] = (sock_type == SOCK_DGRAM ? sock : mg_socketpair_accept(
-                                                            sock, &sa, len))) ==
-             INVALID_SOCKET) {
-  } else {
-    mg_set_close_on_exec(sp[0]);
-    mg_set_close_on_exec(sp[1]);
-    if (sock_type == SOCK_STREAM) mg_socketpair_close(&sock);
-    ret = 1;
+  /* Connections with state changes are all on the poll set. */
+  d->sq_full = 0;
+  for (nc = mgr->poll_set; nc != NULL; nc = tmp) {
+    tmp = nc->poll_next;
+    if (mg_uring_if_update(d, nc) || mg_poll_set_urgent(nc)) {
+      have_work = 1;
+    } else if (!d->sq_full) {
+      mg_poll_set_prune(nc);
+    }
   }
 
-  if (!ret) {
-    if (sp[0] != INVALID_SOCKET) mg_socketpair_close(&sp[0]);
-    if (sp[1] != INVALID_SOCKET) mg_socketpair_close(&sp[1]);
-    if (sock != INVALID_SOCKET) mg_socketpair_close(&sock);
+  min_timer = mg_mgr_min_timer(mgr);
+  if (min_timer > 0) {
+    double timer_timeout_ms = (min_timer - mg_time()) * 1000 + 1 /* rounding */;
+    if (timer_timeout_ms < timeout_ms) {
+      timeout_ms = (int) timer_timeout_ms;
+    }
   }
+  if (timeout_ms < 0 || have_work) timeout_ms = 0;
 
-  return ret;
-}
-#endif /* MG_ENABLE_BROADCAST */
+  /* One syscall submits everything queued above and waits. */
+  mg_uring_flush(d, timeout_ms);
+  now = mg_time();
 
-static void mg_sock_get_addr(sock_t sock, int remote,
-                             union socket_address *sa) {
-  socklen_t slen = sizeof(*sa);
-  memset(sa, 0, slen);
-  if (remote) {
-    getpeername(sock, &sa->sa, &slen);
-  } else {
-    getsockname(sock, &sa->sa, &slen);
+  head = *d->cq_head_p;
+  tail = __atomic_load_n(d->cq_tail_p, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    mg_uring_handle_cqe(d, mgr, &d->cqes[head & *d->cq_mask_p]);
   }
-}
-
-void mg_sock_to_str(sock_t sock, char *buf, size_t len, int flags) {
-  union socket_address sa;
-  mg_sock_get_addr(sock, flags & MG_SOCK_STRINGIFY_REMOTE, &sa);
-  mg_sock_addr_to_str(&sa, buf, len, flags);
-}
+  __atomic_store_n(d->cq_head_p, head, __ATOMIC_RELEASE);
+  mg_uring_reap_dead(d);
 
-void mg_socket_if_get_conn_addr(struct mg_connection *nc, int remote,
-                                union socket_address *sa) {
-  if ((nc->flags & MG_F_UDP) && remote) {
-    memcpy(sa, &nc->sa, sizeof(*sa));
-    return;
+  for (nc = mgr->poll_set; nc != NULL; nc = tmp) {
+    struct mg_uring_conn *cs = (struct mg_uring_conn *) nc->mgr_data;
+    int fd_flags = 0;
+    tmp = nc->poll_next;
+    if (cs != NULL) {
+      fd_flags = cs->ready;
+      cs->ready = 0;
+    } else if ((nc->flags & MG_F_UDP) && nc->listener != NULL &&
+               nc->send_mbuf.len > 0) {
+      fd_flags = _MG_F_FD_CAN_WRITE;
+    }
+    mg_mgr_handle_conn(nc, fd_flags, now);
   }
-  mg_sock_get_addr(nc->sock, remote, sa);
+
+  return (time_t) now;
 }
 
 /* clang-format off */
-#define MG_SOCKET_IFACE_VTABLE                                          \
+#define MG_IO_URING_IFACE_VTABLE                                        \
   {                                                                     \
-    mg_socket_if_init,                                                  \
-    mg_socket_if_free,                                                  \
-    mg_socket_if_add_conn,                                              \
-    mg_socket_if_remove_conn,                                           \
-    mg_socket_if_poll,                                                  \
+    mg_uring_if_init,                                                   \
+    mg_uring_if_free,                                                   \
+    mg_uring_if_add_conn,                                               \
+    mg_uring_if_remove_conn,                                            \
+    mg_uring_if_poll,                                                   \
     mg_socket_if_listen_tcp,                                            \
     mg_socket_if_listen_udp,                                            \
     mg_socket_if_connect_tcp,                                           \
     mg_socket_if_connect_udp,                                           \
-    mg_socket_if_tcp_send,                                              \
+    mg_uring_if_tcp_send,                                               \
     mg_socket_if_udp_send,                                              \
-    mg_socket_if_tcp_recv,                                              \
+    mg_uring_if_tcp_recv,                                               \
     mg_socket_if_udp_recv,                                              \
     mg_socket_if_create_conn,                                           \
-    mg_socket_if_destroy_conn,                                          \
-    mg_socket_if_sock_set,                                              \
+    mg_uring_if_destroy_conn,                                           \
+    mg_uring_if_sock_set,                                               \
     mg_socket_if_get_conn_addr,                                         \
   }
 /* clang-format on */
 
-const struct mg_iface_vtable mg_socket_iface_vtable = MG_SOCKET_IFACE_VTABLE;
-#if MG_NET_IF == MG_NET_IF_SOCKET
-const struct mg_iface_vtable mg_default_iface_vtable = MG_SOCKET_IFACE_VTABLE;
-#endif
+const struct mg_iface_vtable mg_io_uring_iface_vtable =
+    MG_IO_URING_IFACE_VTABLE;
 
-#endif /* MG_ENABLE_NET_IF_SOCKET */
+#endif /* MG_ENABLE_NET_IF_IO_URING */
 #ifdef MG_MODULE_LINES
 #line 1 "mongoose/src/mg_net_if_socks.c"
 #endif
@@ -5752,6 +8353,37 @@ struct mg_http_endpoint {
 #endif
 };
 
+/* One alternative of an endpoint's uri pattern, see mg_match_prefix_n() */
+struct mg_http_route_key {
+  struct mg_str prefix; /* Lowercased literal head, up to the first ?, * or $ */
+  int route;            /* Index in mg_http_routes::eps */
+  int literal;          /* The pattern is just `prefix`, no glob to check */
+};
+
+struct mg_http_route_node {
+  struct mg_str label; /* Lowercased bytes on the edge from the parent */
+  int first_kid;       /* Kids are consecutive, ordered by label.p[0] */
+  int num_kids;
+  int first_key; /* Keys whose prefix ends at this node */
+  int num_keys;
+};
+
+/*
+ * Endpoints of a listener, compiled into a radix trie over the literal heads
+ * of their patterns. Immutable once built, so listeners of several reactor
+ * threads may share it; the reference count is the only thing that changes.
+ */
+struct mg_http_routes {
+  int refs;
+  int num_eps;
+  struct mg_http_endpoint *eps; /* Copies, newest registered first */
+  struct mg_http_route_key *keys; /* Ordered by prefix */
+  int num_keys;
+  struct mg_http_route_node *nodes; /* nodes[0] is the root */
+  int num_nodes;
+  char *prefixes; /* Bytes of all keys' prefixes */
+};
+
 enum mg_http_multipart_stream_state {
   MPS_BEGIN,
   MPS_WAITING_FOR_BOUNDARY,
@@ -5801,12 +8433,18 @@ struct mg_http_proto_data {
 #endif
   struct mg_http_proto_data_chuncked chunk;
   struct mg_http_endpoint *endpoints;
+  struct mg_http_routes *routes; /* Compiled endpoints, NULL until needed */
   mg_event_handler_t endpoint_handler;
   struct mg_reverse_proxy_data reverse_proxy_data;
   size_t rcvd; /* How many bytes we have received. */
+  int hdr_scanned; /* recv_mbuf bytes known not to end the header block */
+  size_t hdr_len;  /* recv_mbuf.len it holds for, MG_EV_RECV adds to it */
+  int queued;      /* Pipelined requests wait for the response in progress */
+  struct mg_pool *pool; /* mg_mgr::proto_data_pool this came from */
 };
 
 static void mg_http_proto_data_destructor(void *proto_data);
+static void mg_http_proto_data_reset(struct mg_http_proto_data *pd);
 
 struct mg_connection *mg_connect_http_base(
     struct mg_mgr *mgr, MG_CB(mg_event_handler_t ev_handler, void *user_data),
@@ -5816,15 +8454,25 @@ struct mg_connection *mg_connect_http_base(
 
 MG_INTERNAL struct mg_http_proto_data *mg_http_create_proto_data(
     struct mg_connection *c) {
-  /* If we have proto data from previous connection, flush it. */
+  struct mg_http_proto_data *pd;
+  /* If we have proto data from previous request, flush and reuse it. */
+  if (c->proto_data != NULL &&
+      c->proto_data_destructor == mg_http_proto_data_destructor) {
+    pd = (struct mg_http_proto_data *) c->proto_data;
+    mg_http_proto_data_reset(pd);
+    return pd;
+  }
   if (c->proto_data != NULL) {
-    void *pd = c->proto_data;
+    void *old = c->proto_data;
     c->proto_data = NULL;
-    mg_http_proto_data_destructor(pd);
+    if (c->proto_data_destructor != NULL) c->proto_data_destructor(old);
   }
-  c->proto_data = MG_CALLOC(1, sizeof(struct mg_http_proto_data));
+  pd = (struct mg_http_proto_data *) mg_pool_alloc(&c->mgr->proto_data_pool,
+                                                   sizeof(*pd));
+  if (pd != NULL) pd->pool = &c->mgr->proto_data_pool;
+  c->proto_data = pd;
   c->proto_data_destructor = mg_http_proto_data_destructor;
-  return (struct mg_http_proto_data *) c->proto_data;
+  return pd;
 }
 
 static struct mg_http_proto_data *mg_http_get_proto_data(
@@ -5832,6 +8480,38 @@ static struct mg_http_proto_data *mg_http_get_proto_data(
   return (struct mg_http_proto_data *) c->proto_data;
 }
 
+#if MG_ENABLE_HTTP_IDLE_RELEASE
+/*
+ * Gives the proto data of a keep-alive connection that is done with its
+ * request back to the pool, the next request takes it again. Kept if a
+ * response is still being produced, or if an endpoint handler served the
+ * request: it is owed MG_EV_CLOSE.
+ */
+static void mg_http_release_idle_proto_data(struct mg_connection *c) {
+  struct mg_http_proto_data *pd = mg_http_get_proto_data(c);
+  if (pd == NULL || c->proto_data_destructor != mg_http_proto_data_destructor ||
+      c->recv_mbuf.len > 0 || (c->flags & MG_F_IS_WEBSOCKET)) {
+    return;
+  }
+#if MG_ENABLE_FILESYSTEM
+  if (pd->file.fp != NULL) return;
+#endif
+#if MG_ENABLE_HTTP_CGI
+  if (pd->cgi.cgi_nc != NULL) return;
+#endif
+#if MG_ENABLE_HTTP_STREAMING_MULTIPART
+  if (pd->mp_stream.boundary != NULL) return;
+#endif
+  if (pd->endpoints != NULL || pd->routes != NULL ||
+      pd->reverse_proxy_data.linked_conn != NULL ||
+      (pd->endpoint_handler != NULL && pd->endpoint_handler != c->handler)) {
+    return;
+  }
+  c->proto_data = NULL;
+  mg_http_proto_data_destructor(pd);
+}
+#endif
+
 #if MG_ENABLE_HTTP_STREAMING_MULTIPART
 static void mg_http_free_proto_data_mp_stream(
     struct mg_http_multipart_stream *mp) {
@@ -5884,8 +8564,9 @@ static void mg_http_free_reverse_proxy_data(struct mg_reverse_proxy_data *rpd) {
   }
 }
 
-static void mg_http_proto_data_destructor(void *proto_data) {
-  struct mg_http_proto_data *pd = (struct mg_http_proto_data *) proto_data;
+/* Releases everything the proto data holds and zeroes it for reuse. */
+static void mg_http_proto_data_reset(struct mg_http_proto_data *pd) {
+  struct mg_pool *pool = pd->pool;
 #if MG_ENABLE_FILESYSTEM
   mg_http_free_proto_data_file(&pd->file);
 #endif
@@ -5896,8 +8577,16 @@ static void mg_http_proto_data_destructor(void *proto_data) {
   mg_http_free_proto_data_mp_stream(&pd->mp_stream);
 #endif
   mg_http_free_proto_data_endpoints(&pd->endpoints);
+  mg_http_routes_release(pd->routes);
   mg_http_free_reverse_proxy_data(&pd->reverse_proxy_data);
-  MG_FREE(proto_data);
+  memset(pd, 0, sizeof(*pd));
+  pd->pool = pool;
+}
+
+static void mg_http_proto_data_destructor(void *proto_data) {
+  struct mg_http_proto_data *pd = (struct mg_http_proto_data *) proto_data;
+  mg_http_proto_data_reset(pd);
+  mg_pool_free(pd->pool, pd);
 }
 
 #if MG_ENABLE_FILESYSTEM
@@ -5971,41 +8660,204 @@ static struct mg_str mg_get_mime_types_entry(struct mg_str path) {
       return mg_mk_str(mg_static_builtin_mime_types[i].mime_type);
     }
   }
-  return mg_mk_str(NULL);
+  return mg_mk_str(NULL);
+}
+
+MG_INTERNAL int mg_get_mime_type_encoding(
+    struct mg_str path, struct mg_str *type, struct mg_str *encoding,
+    const struct mg_serve_http_opts *opts) {
+  const char *ext, *overrides;
+  struct mg_str k, v;
+
+  overrides = opts->custom_mime_types;
+  while ((overrides = mg_next_comma_list_entry(overrides, &k, &v)) != NULL) {
+    ext = path.p + (path.len - k.len);
+    if (path.len > k.len && mg_vcasecmp(&k, ext) == 0) {
+      *type = v;
+      return 1;
+    }
+  }
+
+  *type = mg_get_mime_types_entry(path);
+
+  /* Check for .html.gz, .js.gz, etc. */
+  if (mg_vcmp(type, "application/x-gunzip") == 0) {
+    struct mg_str path2 = mg_mk_str_n(path.p, path.len - 3);
+    struct mg_str type2 = mg_get_mime_types_entry(path2);
+    LOG(LL_ERROR, ("'%.*s' '%.*s' '%.*s'", (int) path.len, path.p,
+                   (int) path2.len, path2.p, (int) type2.len, type2.p));
+    if (type2.len > 0) {
+      *type = type2;
+      *encoding = mg_mk_str("gzip");
+    }
+  }
+
+  return (type->len > 0);
+}
+#endif
+
+#if MG_ENABLE_HTTP_SIMD
+#include <immintrin.h>
+#endif
+
+/* Lines of a header block that mg_http_scan() records */
+#define MG_HTTP_SCAN_LINES (MG_MAX_HTTP_HEADERS + 2)
+
+/*
+ * Where mg_http_scan() found the lines of a header block, as offsets from
+ * its start: nl[i] is the '\n' ending line i, sep[i] the first ':' or ' ' in
+ * it, -1 if none. Lines past MG_HTTP_SCAN_LINES are counted, not recorded.
+ */
+struct mg_http_scan {
+  int num_lines;
+  int bare_cr; /* Seen a '\r' that isn't followed by '\n' */
+  int nl[MG_HTTP_SCAN_LINES];
+  int sep[MG_HTTP_SCAN_LINES];
+};
+
+struct mg_http_scanner {
+  const unsigned char *buf;
+  int len;
+  struct mg_http_scan *scan; /* NULL: only find the end */
+  int want_sep;              /* No separator in the current line yet */
+};
+
+/*
+ * Handles buf[i], which is a control character, ':' or ' '. Returns -1 if
+ * the byte is not allowed, the header block length if buf[i] ends it, else 0.
+ */
+static int mg_http_scan_byte(struct mg_http_scanner *sc, int i) {
+  const unsigned char *buf = sc->buf;
+  struct mg_http_scan *scan = sc->scan;
+
+  if (buf[i] == '\n') {
+    if (scan != NULL) {
+      if (scan->num_lines < MG_HTTP_SCAN_LINES) scan->nl[scan->num_lines] = i;
+      if (++scan->num_lines < MG_HTTP_SCAN_LINES) {
+        scan->sep[scan->num_lines] = -1;
+      }
+      sc->want_sep = 1;
+    }
+    if (i + 1 < sc->len && buf[i + 1] == '\n') {
+      return i + 2;
+    } else if (i + 2 < sc->len && buf[i + 1] == '\r' && buf[i + 2] == '\n') {
+      return i + 3;
+    }
+  } else if (buf[i] == '\r') {
+    if (scan != NULL && i + 1 < sc->len && buf[i + 1] != '\n') {
+      scan->bare_cr = 1;
+    }
+  } else if (buf[i] == ':' || buf[i] == ' ') {
+    if (sc->want_sep) {
+      if (scan->num_lines < MG_HTTP_SCAN_LINES) {
+        scan->sep[scan->num_lines] = i;
+      }
+      sc->want_sep = 0;
+    }
+  } else if (buf[i] < 0x20 || buf[i] == 0x7f) {
+    return -1;
+  }
+  return 0;
 }
 
-MG_INTERNAL int mg_get_mime_type_encoding(
-    struct mg_str path, struct mg_str *type, struct mg_str *encoding,
-    const struct mg_serve_http_opts *opts) {
-  const char *ext, *overrides;
-  struct mg_str k, v;
+#if MG_ENABLE_HTTP_SIMD
+/*
+ * Handles the bytes of a block at `base` flagged in `ctl` (control
+ * characters) and `sep` (':' and ' '), in order.
+ */
+static int mg_http_scan_bits(struct mg_http_scanner *sc, int base,
+                             uint32_t ctl, uint32_t sep) {
+  uint32_t m;
+  while ((m = ctl | (sc->want_sep ? sep : 0)) != 0) {
+    int i = __builtin_ctz(m), r;
+    uint32_t rest = ~(((uint32_t) 2 << i) - 1);
+    if ((r = mg_http_scan_byte(sc, base + i)) != 0) return r;
+    ctl &= rest;
+    sep &= rest;
+  }
+  return 0;
+}
 
-  overrides = opts->custom_mime_types;
-  while ((overrides = mg_next_comma_list_entry(overrides, &k, &v)) != NULL) {
-    ext = path.p + (path.len - k.len);
-    if (path.len > k.len && mg_vcasecmp(&k, ext) == 0) {
-      *type = v;
-      return 1;
+static int mg_http_scan_sse2(struct mg_http_scanner *sc, int *pos) {
+  const __m128i c31 = _mm_set1_epi8(31), del = _mm_set1_epi8(127);
+  const __m128i colon = _mm_set1_epi8(':'), space = _mm_set1_epi8(' ');
+  int i, r;
+  for (i = *pos; i + 16 <= sc->len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (sc->buf + i));
+    /* max(v, 31) == 31: bytes 0..31, unsigned */
+    uint32_t ctl = (uint32_t) _mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, c31), c31),
+                     _mm_cmpeq_epi8(v, del)));
+    uint32_t sep = 0;
+    if (sc->scan != NULL) {
+      sep = (uint32_t) _mm_movemask_epi8(
+          _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, space)));
+    }
+    if ((ctl | sep) != 0 && (r = mg_http_scan_bits(sc, i, ctl, sep)) != 0) {
+      return r;
     }
   }
+  *pos = i;
+  return 0;
+}
 
-  *type = mg_get_mime_types_entry(path);
-
-  /* Check for .html.gz, .js.gz, etc. */
-  if (mg_vcmp(type, "application/x-gunzip") == 0) {
-    struct mg_str path2 = mg_mk_str_n(path.p, path.len - 3);
-    struct mg_str type2 = mg_get_mime_types_entry(path2);
-    LOG(LL_ERROR, ("'%.*s' '%.*s' '%.*s'", (int) path.len, path.p,
-                   (int) path2.len, path2.p, (int) type2.len, type2.p));
-    if (type2.len > 0) {
-      *type = type2;
-      *encoding = mg_mk_str("gzip");
+__attribute__((target("avx2"))) static int mg_http_scan_avx2(
+    struct mg_http_scanner *sc, int *pos) {
+  const __m256i c31 = _mm256_set1_epi8(31), del = _mm256_set1_epi8(127);
+  const __m256i colon = _mm256_set1_epi8(':'), space = _mm256_set1_epi8(' ');
+  int i, r;
+  for (i = *pos; i + 32 <= sc->len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (sc->buf + i));
+    uint32_t ctl = (uint32_t) _mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(v, c31), c31),
+                        _mm256_cmpeq_epi8(v, del)));
+    uint32_t sep = 0;
+    if (sc->scan != NULL) {
+      sep = (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(
+          _mm256_cmpeq_epi8(v, colon), _mm256_cmpeq_epi8(v, space)));
+    }
+    if ((ctl | sep) != 0 && (r = mg_http_scan_bits(sc, i, ctl, sep)) != 0) {
+      return r;
     }
   }
-
-  return (type->len > 0);
+  *pos = i;
+  return 0;
 }
+#endif /* MG_ENABLE_HTTP_SIMD */
+
+/*
+ * Validates a header block and finds its end in one pass, recording its
+ * lines into `scan` unless it's NULL. Scanning starts at `from`, which must
+ * be 0 when recording. Returns:
+ *   -1  if request is malformed
+ *    0  if request is not yet fully buffered
+ *   >0  actual request length, including last \r\n\r\n
+ */
+static int mg_http_scan(const char *s, int buf_len, int from,
+                        struct mg_http_scan *scan) {
+  struct mg_http_scanner sc;
+  int i = from, r = 0;
+
+  sc.buf = (const unsigned char *) s;
+  sc.len = buf_len;
+  sc.scan = scan;
+  sc.want_sep = (scan != NULL);
+  if (scan != NULL) {
+    scan->num_lines = scan->bare_cr = 0;
+    scan->sep[0] = -1;
+  }
+#if MG_ENABLE_HTTP_SIMD
+  if (__builtin_cpu_supports("avx2")) r = mg_http_scan_avx2(&sc, &i);
+  if (r == 0) r = mg_http_scan_sse2(&sc, &i);
+  if (r != 0) return r;
 #endif
+  for (; i < buf_len; i++) {
+    if (sc.buf[i] > ' ' && sc.buf[i] != ':' && sc.buf[i] != 0x7f) continue;
+    if ((r = mg_http_scan_byte(&sc, i)) != 0) return r;
+  }
+
+  return 0;
+}
 
 /*
  * Check whether full request is buffered. Return:
@@ -6014,65 +8866,186 @@ MG_INTERNAL int mg_get_mime_type_encoding(
  *   >0  actual request length, including last \r\n\r\n
  */
 static int mg_http_get_request_len(const char *s, int buf_len) {
-  const unsigned char *buf = (unsigned char *) s;
-  int i;
+  return mg_http_scan(s, buf_len, 0, NULL);
+}
+
+/* Names of enum mg_http_header_id, in its order */
+static const struct mg_str mg_http_header_names[MG_HTTP_NUM_HEADER_IDS] = {
+    MG_MK_STR("Host"),
+    MG_MK_STR("Connection"),
+    MG_MK_STR("Content-Length"),
+    MG_MK_STR("Content-Type"),
+    MG_MK_STR("Transfer-Encoding"),
+    MG_MK_STR("Range"),
+    MG_MK_STR("If-Modified-Since"),
+    MG_MK_STR("If-None-Match"),
+    MG_MK_STR("Authorization"),
+    MG_MK_STR("Cookie"),
+    MG_MK_STR("Accept-Encoding"),
+    MG_MK_STR("User-Agent"),
+    MG_MK_STR("Sec-WebSocket-Key"),
+    MG_MK_STR("Sec-WebSocket-Accept"),
+    MG_MK_STR("Sec-WebSocket-Protocol"),
+};
 
-  for (i = 0; i < buf_len; i++) {
-    if (!isprint(buf[i]) && buf[i] != '\r' && buf[i] != '\n' && buf[i] < 128) {
-      return -1;
-    } else if (buf[i] == '\n' && i + 1 < buf_len && buf[i + 1] == '\n') {
-      return i + 2;
-    } else if (buf[i] == '\n' && i + 2 < buf_len && buf[i + 1] == '\r' &&
-               buf[i + 2] == '\n') {
-      return i + 3;
-    }
+/*
+ * Returns the mg_http_header_id of header name `k`, -1 if it has none.
+ * This runs for every parsed header, so the only candidate is picked by
+ * length and first letter (keep the switch in sync with the names above),
+ * and then compared: clients mostly send the spelling above, so memcmp()
+ * decides; otherwise, as the names are letters and dashes only, a letter
+ * matches either case by or-ing in 0x20, unlike costly tolower().
+ */
+static int mg_http_header_id_of(const struct mg_str *k) {
+  const char *name;
+  int c = k->p[0] | 0x20, id;
+  size_t i;
+
+  switch (k->len) {
+    case 4: id = MG_HTTP_HDR_HOST; break;
+    case 5: id = MG_HTTP_HDR_RANGE; break;
+    case 6: id = MG_HTTP_HDR_COOKIE; break;
+    case 10:
+      id = c == 'c' ? MG_HTTP_HDR_CONNECTION : MG_HTTP_HDR_USER_AGENT;
+      break;
+    case 12: id = MG_HTTP_HDR_CONTENT_TYPE; break;
+    case 13:
+      id = c == 'i' ? MG_HTTP_HDR_IF_NONE_MATCH : MG_HTTP_HDR_AUTHORIZATION;
+      break;
+    case 14: id = MG_HTTP_HDR_CONTENT_LENGTH; break;
+    case 15: id = MG_HTTP_HDR_ACCEPT_ENCODING; break;
+    case 17:
+      id = c == 't' ? MG_HTTP_HDR_TRANSFER_ENCODING
+                    : c == 'i' ? MG_HTTP_HDR_IF_MODIFIED_SINCE
+                               : MG_HTTP_HDR_SEC_WEBSOCKET_KEY;
+      break;
+    case 20: id = MG_HTTP_HDR_SEC_WEBSOCKET_ACCEPT; break;
+    case 22: id = MG_HTTP_HDR_SEC_WEBSOCKET_PROTOCOL; break;
+    default: return -1;
   }
 
-  return 0;
+  name = mg_http_header_names[id].p;
+  if (memcmp(name, k->p, k->len) == 0) return id;
+  for (i = 0; i < k->len; i++) {
+    int n = name[i];
+    if (n == '-' ? k->p[i] != '-' : (k->p[i] | 0x20) != (n | 0x20)) return -1;
+  }
+  return id;
+}
+
+/*
+ * Finishes header slot `i` of `req`, which the caller has pointed at a name
+ * and a value, and indexes it. Returns 1 if the header is taken, 0 if it's
+ * skipped for an empty value, -1 at the end of the headers.
+ */
+static int mg_http_take_header(struct http_message *req, int i, int len) {
+  struct mg_str *k = &req->header_names[i], *v = &req->header_values[i];
+  int id;
+
+  while (v->len > 0 && v->p[v->len - 1] == ' ') {
+    v->len--; /* Trim trailing spaces in header value */
+  }
+
+  /*
+   * If header value is empty - skip it and go to next (if any).
+   * NOTE: Do not add it to headers_values because such addition changes API
+   * behaviour
+   */
+  if (k->len != 0 && v->len == 0) {
+    return 0;
+  }
+
+  if (k->len == 0 || v->len == 0) {
+    k->p = v->p = NULL;
+    k->len = v->len = 0;
+    return -1;
+  }
+
+  id = mg_http_header_id_of(k);
+  if (id >= 0 && req->header_ids[id] == 0) {
+    req->header_ids[id] = (unsigned short) (i + 1);
+  }
+
+  /* Longer names starting with Content-Length count too, as they always did */
+  if (id == MG_HTTP_HDR_CONTENT_LENGTH ||
+      (k->len > 14 && !mg_ncasecmp(k->p, "Content-Length", 14))) {
+    req->body.len = (size_t) to64(v->p);
+    req->message.len = len + req->body.len;
+  }
+
+  return 1;
 }
 
 static const char *mg_http_parse_headers(const char *s, const char *end,
                                          int len, struct http_message *req) {
-  int i = 0;
+  int i = 0, r;
   while (i < (int) ARRAY_SIZE(req->header_names) - 1) {
     struct mg_str *k = &req->header_names[i], *v = &req->header_values[i];
 
     s = mg_skip(s, end, ": ", k);
     s = mg_skip(s, end, "\r\n", v);
 
-    while (v->len > 0 && v->p[v->len - 1] == ' ') {
-      v->len--; /* Trim trailing spaces in header value */
-    }
+    if ((r = mg_http_take_header(req, i, len)) < 0) break;
+    i += r;
+  }
 
-    /*
-     * If header value is empty - skip it and go to next (if any).
-     * NOTE: Do not add it to headers_values because such addition changes API
-     * behaviour
-     */
-    if (k->len != 0 && v->len == 0) {
-      continue;
-    }
+  return s;
+}
+
+/*
+ * mg_http_parse_headers() for the header block `msg`, from `s` on, using
+ * the lines mg_http_scan() recorded. Returns 0 if the block needs the
+ * byte-wise parser: `s` not at a line start, a line without a separator, a
+ * bare '\r', or lines past MG_HTTP_SCAN_LINES.
+ */
+static int mg_http_parse_scanned_headers(const char *msg, const char *s,
+                                         int len, struct http_message *req,
+                                         const struct mg_http_scan *scan) {
+  int i = 0, r, line = 0, pos = (int) (s - msg);
+
+  if (scan->bare_cr) return 0;
+  while (line < scan->num_lines && line < MG_HTTP_SCAN_LINES &&
+         scan->nl[line] < pos) {
+    line++;
+  }
+  if (pos == len) {
+    line = scan->num_lines; /* No headers */
+  } else if (line >= MG_HTTP_SCAN_LINES ||
+             (line == 0 ? 0 : scan->nl[line - 1] + 1) != pos) {
+    return 0;
+  }
+
+  for (; i < (int) ARRAY_SIZE(req->header_names) - 1; line++) {
+    struct mg_str *k = &req->header_names[i], *v = &req->header_values[i];
+    int start, sep, p;
 
-    if (k->len == 0 || v->len == 0) {
-      k->p = v->p = NULL;
+    if (line >= scan->num_lines) {
+      k->p = v->p = NULL; /* Reached the blank line that ends the block */
       k->len = v->len = 0;
       break;
+    } else if (line >= MG_HTTP_SCAN_LINES || (sep = scan->sep[line]) < 0) {
+      return 0;
     }
+    start = (line == 0 ? 0 : scan->nl[line - 1] + 1);
+    k->p = msg + start;
+    k->len = sep - start;
+    p = sep;
+    while (msg[p] == ':' || msg[p] == ' ') p++;
+    v->p = msg + p;
+    v->len = scan->nl[line] - p;
+    if (v->len > 0 && v->p[v->len - 1] == '\r') v->len--;
 
-    if (!mg_ncasecmp(k->p, "Content-Length", 14)) {
-      req->body.len = (size_t) to64(v->p);
-      req->message.len = len + req->body.len;
-    }
-
-    i++;
+    if ((r = mg_http_take_header(req, i, len)) < 0) break;
+    i += r;
   }
 
-  return s;
+  return 1;
 }
 
 int mg_parse_http(const char *s, int n, struct http_message *hm, int is_req) {
-  const char *end, *qs;
-  int len = mg_http_get_request_len(s, n);
+  struct mg_http_scan scan;
+  const char *end, *qs, *msg = s;
+  int len = mg_http_scan(s, n, 0, &scan);
 
   if (len <= 0) return len;
 
@@ -6107,7 +9080,13 @@ int mg_parse_http(const char *s, int n, struct http_message *hm, int is_req) {
     s = mg_skip(s, end, "\r\n", &hm->resp_status_msg);
   }
 
-  s = mg_http_parse_headers(s, end, len, hm);
+  if (!mg_http_parse_scanned_headers(msg, s, len, hm, &scan)) {
+    memset(hm->header_names, 0, sizeof(hm->header_names));
+    memset(hm->header_values, 0, sizeof(hm->header_values));
+    memset(hm->header_ids, 0, sizeof(hm->header_ids));
+    hm->message.len = hm->body.len = (size_t) ~0;
+    mg_http_parse_headers(s, end, len, hm);
+  }
 
   /*
    * mg_parse_http() is used to parse both HTTP requests and HTTP
@@ -6146,6 +9125,21 @@ struct mg_str *mg_get_http_header(struct http_message *hm, const char *name) {
   return NULL;
 }
 
+/* For messages that mg_parse_http() has just indexed: never searches */
+static struct mg_str *mg_http_indexed_header(struct http_message *hm,
+                                             enum mg_http_header_id id) {
+  int i = hm->header_ids[id];
+  return i > 0 ? &hm->header_values[i - 1] : NULL;
+}
+
+struct mg_str *mg_get_http_header_id(struct http_message *hm,
+                                     enum mg_http_header_id id) {
+  struct mg_str *v = mg_http_indexed_header(hm, id);
+  if (v != NULL) return v;
+  /* Absent, or hm was built or edited by hand and has no index: search */
+  return mg_get_http_header(hm, mg_http_header_names[id].p);
+}
+
 #if MG_ENABLE_FILESYSTEM
 static void mg_http_transfer_file_data(struct mg_connection *nc) {
   struct mg_http_proto_data *pd = mg_http_get_proto_data(nc);
@@ -6172,6 +9166,11 @@ static void mg_http_transfer_file_data(struct mg_connection *nc) {
     } else {
       /* Rate-limited */
     }
+    if (pd->file.sent >= pd->file.cl || n < to_read) {
+      nc->flags &= ~MG_F_SEND_MORE;
+    } else {
+      nc->flags |= MG_F_SEND_MORE;
+    }
     if (pd->file.sent >= pd->file.cl) {
       LOG(LL_DEBUG, ("%p done, %d bytes, ka %d", nc, (int) pd->file.sent,
                      pd->file.keepalive));
@@ -6303,6 +9302,230 @@ MG_INTERNAL size_t mg_handle_chunked(struct mg_connection *nc,
   return body_len;
 }
 
+static int mg_http_route_key_cmp(const void *a, const void *b) {
+  const struct mg_str *x = &((const struct mg_http_route_key *) a)->prefix;
+  const struct mg_str *y = &((const struct mg_http_route_key *) b)->prefix;
+  int diff = memcmp(x->p, y->p, x->len < y->len ? x->len : y->len);
+  return diff != 0 ? diff : (int) x->len - (int) y->len;
+}
+
+/*
+ * Makes `node` the root of the keys [lo, hi), which share their first `depth`
+ * bytes. The keys are sorted, so those that continue with the same byte are
+ * adjacent, and their common prefix is that of the first and the last one.
+ */
+static void mg_http_routes_build(struct mg_http_routes *r, int node, int lo,
+                                 int hi, size_t depth) {
+  struct mg_http_route_key *keys = r->keys;
+  int i, j, kid;
+
+  r->nodes[node].first_key = lo;
+  while (lo < hi && keys[lo].prefix.len == depth) lo++;
+  r->nodes[node].num_keys = lo - r->nodes[node].first_key;
+
+  /* A kid per distinct next byte, allocated together */
+  r->nodes[node].first_kid = r->num_nodes;
+  for (i = lo; i < hi; i++) {
+    if (i == lo || keys[i].prefix.p[depth] != keys[i - 1].prefix.p[depth]) {
+      r->num_nodes++;
+    }
+  }
+  r->nodes[node].num_kids = r->num_nodes - r->nodes[node].first_kid;
+
+  for (i = lo, kid = r->nodes[node].first_kid; i < hi; i = j, kid++) {
+    const struct mg_str *first = &keys[i].prefix;
+    size_t end = depth + 1;
+    j = i + 1;
+    while (j < hi && keys[j].prefix.p[depth] == first->p[depth]) j++;
+    while (end < first->len && end < keys[j - 1].prefix.len &&
+           first->p[end] == keys[j - 1].prefix.p[end]) {
+      end++;
+    }
+    r->nodes[kid].label = mg_mk_str_n(first->p + depth, end - depth);
+    mg_http_routes_build(r, kid, i, j, end);
+  }
+}
+
+static int mg_http_routes_ref(struct mg_http_routes *r, int delta) {
+#ifdef __GNUC__
+  return __atomic_add_fetch(&r->refs, delta, __ATOMIC_ACQ_REL);
+#else
+  return r->refs += delta;
+#endif
+}
+
+void mg_http_routes_release(struct mg_http_routes *r) {
+  int i;
+  if (r == NULL || mg_http_routes_ref(r, -1) > 0) return;
+  for (i = 0; r->eps != NULL && i < r->num_eps; i++) {
+    MG_FREE((void *) r->eps[i].uri_pattern.p);
+    MG_FREE(r->eps[i].auth_domain);
+    MG_FREE(r->eps[i].auth_file);
+  }
+  MG_FREE(r->eps);
+  MG_FREE(r->keys);
+  MG_FREE(r->nodes);
+  MG_FREE(r->prefixes);
+  MG_FREE(r);
+}
+
+/*
+ * Compiles the endpoint list `eps`. Each alternative of a pattern becomes a
+ * key, filed under its literal head. Returns NULL if out of memory.
+ */
+static struct mg_http_routes *mg_http_routes_compile(
+    const struct mg_http_endpoint *eps) {
+  struct mg_http_routes *r;
+  const struct mg_http_endpoint *ep;
+  size_t bytes = 0, i;
+  int k = 0, route = 0;
+  char *buf;
+
+  r = (struct mg_http_routes *) MG_CALLOC(1, sizeof(*r));
+  if (r == NULL) return NULL;
+  r->refs = 1;
+  for (ep = eps; ep != NULL; ep = ep->next) {
+    r->num_eps++;
+    r->num_keys++;
+    for (i = 0; i < ep->uri_pattern.len; i++) {
+      if (ep->uri_pattern.p[i] == '|' || ep->uri_pattern.p[i] == ',') {
+        r->num_keys++;
+      }
+    }
+    bytes += ep->uri_pattern.len;
+  }
+  r->eps = (struct mg_http_endpoint *) MG_CALLOC(r->num_eps, sizeof(*r->eps));
+  r->keys = (struct mg_http_route_key *) MG_CALLOC(r->num_keys,
+                                                  sizeof(*r->keys));
+  /* Every node but the root ends a key or has two kids */
+  r->nodes = (struct mg_http_route_node *) MG_CALLOC(2 * r->num_keys + 1,
+                                                    sizeof(*r->nodes));
+  r->prefixes = buf = (char *) MG_MALLOC(bytes + 1);
+  if (r->eps == NULL || r->keys == NULL || r->nodes == NULL || buf == NULL) {
+    mg_http_routes_release(r);
+    return NULL;
+  }
+
+  for (ep = eps; ep != NULL; ep = ep->next, route++) {
+    struct mg_http_endpoint *copy = &r->eps[route];
+    const char *p = ep->uri_pattern.p, *end = p + ep->uri_pattern.len;
+    int first = k;
+
+    copy->uri_pattern = mg_strdup(ep->uri_pattern);
+    if (ep->auth_domain != NULL) copy->auth_domain = strdup(ep->auth_domain);
+    if (ep->auth_file != NULL) copy->auth_file = strdup(ep->auth_file);
+    copy->handler = ep->handler;
+#if MG_ENABLE_CALLBACK_USERDATA
+    copy->user_data = ep->user_data;
+#endif
+    if (copy->uri_pattern.len != ep->uri_pattern.len ||
+        (ep->auth_domain != NULL && copy->auth_domain == NULL) ||
+        (ep->auth_file != NULL && copy->auth_file == NULL)) {
+      mg_http_routes_release(r);
+      return NULL;
+    }
+
+    for (;;) {
+      struct mg_http_route_key *key = &r->keys[k++];
+      key->route = route;
+      key->prefix.p = buf;
+      while (p < end && strchr("|,?*$", *p) == NULL) {
+        *buf++ = (char) tolower(*(const unsigned char *) p++);
+      }
+      key->prefix.len = buf - key->prefix.p;
+      while (p < end && *p != '|' && *p != ',') p++;
+      if (p++ == end) break;
+    }
+    r->keys[first].literal =
+        k - first == 1 && r->keys[first].prefix.len == ep->uri_pattern.len;
+  }
+
+  qsort(r->keys, r->num_keys, sizeof(*r->keys), mg_http_route_key_cmp);
+  r->num_nodes = 1;
+  mg_http_routes_build(r, 0, 0, r->num_keys, 0);
+  return r;
+}
+
+static const struct mg_http_route_node *mg_http_routes_kid(
+    const struct mg_http_routes *r, const struct mg_http_route_node *node,
+    int c) {
+  int lo = node->first_kid, hi = lo + node->num_kids;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2, m = (unsigned char) r->nodes[mid].label.p[0];
+    if (m == c) return &r->nodes[mid];
+    if (m < c) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Walks down the trie along `uri`. Only keys passed on the way can match:
+ * their literal head is a prefix of the uri. The rest of their pattern is
+ * checked by mg_match_prefix_n(), the longest match wins, then the newest
+ * endpoint, the same as scanning the list.
+ */
+static struct mg_http_endpoint *mg_http_routes_find(
+    struct mg_http_routes *r, const struct mg_str *uri) {
+  const struct mg_http_route_node *node = &r->nodes[0];
+  size_t pos = 0, matched, matched_max = 0, i;
+  int best = -1, j;
+
+  for (;;) {
+    for (j = node->first_key; j < node->first_key + node->num_keys; j++) {
+      const struct mg_http_route_key *key = &r->keys[j];
+      matched = key->literal
+                    ? key->prefix.len
+                    : mg_match_prefix_n(r->eps[key->route].uri_pattern, *uri);
+      if (matched > matched_max ||
+          (matched == matched_max && matched > 0 && key->route < best)) {
+        best = key->route;
+        matched_max = matched;
+      }
+    }
+
+    if (pos == uri->len) break;
+    node = mg_http_routes_kid(r, node,
+                              tolower(*(const unsigned char *) &uri->p[pos]));
+    if (node == NULL || node->label.len > uri->len - pos) break;
+    for (i = 1; i < node->label.len; i++) {
+      if (tolower(*(const unsigned char *) &uri->p[pos + i]) !=
+          (unsigned char) node->label.p[i]) {
+        break;
+      }
+    }
+    if (i < node->label.len) break;
+    pos += node->label.len;
+  }
+
+  return best < 0 ? NULL : &r->eps[best];
+}
+
+struct mg_http_routes *mg_http_get_routes(struct mg_connection *nc) {
+  struct mg_http_proto_data *pd = nc ? mg_http_get_proto_data(nc) : NULL;
+  if (pd == NULL) return NULL;
+  if (pd->routes == NULL && pd->endpoints != NULL) {
+    pd->routes = mg_http_routes_compile(pd->endpoints);
+  }
+  if (pd->routes != NULL) mg_http_routes_ref(pd->routes, 1);
+  return pd->routes;
+}
+
+void mg_http_set_routes(struct mg_connection *nc,
+                        struct mg_http_routes *routes) {
+  struct mg_http_proto_data *pd;
+  if (nc == NULL) return;
+  pd = mg_http_get_proto_data(nc);
+  if (pd == NULL) pd = mg_http_create_proto_data(nc);
+  if (pd == NULL) return;
+  if (routes != NULL) mg_http_routes_ref(routes, 1);
+  mg_http_routes_release(pd->routes);
+  pd->routes = routes;
+}
+
 struct mg_http_endpoint *mg_http_get_endpoint_handler(struct mg_connection *nc,
                                                       struct mg_str *uri_path) {
   struct mg_http_proto_data *pd;
@@ -6316,6 +9539,12 @@ struct mg_http_endpoint *mg_http_get_endpoint_handler(struct mg_connection *nc,
 
   if (pd == NULL) return NULL;
 
+  if (pd->routes == NULL && pd->endpoints != NULL) {
+    pd->routes = mg_http_routes_compile(pd->endpoints);
+  }
+  if (pd->routes != NULL) return mg_http_routes_find(pd->routes, uri_path);
+
+  /* Out of memory for the trie: scan the list */
   ep = pd->endpoints;
   while (ep != NULL) {
     if ((matched = mg_match_prefix_n(ep->uri_pattern, *uri_path)) > 0) {
@@ -6353,6 +9582,62 @@ static void deliver_chunk(struct mg_connection *c, struct http_message *hm,
   if (c->flags & MG_F_DELETE_CHUNK) c->recv_mbuf.len = req_len;
 }
 
+/*
+ * Whether the response to the last request is still being produced by
+ * events to come: a file being sent, or a CGI script still running.
+ */
+static int mg_http_is_responding(struct mg_http_proto_data *pd) {
+#if MG_ENABLE_FILESYSTEM
+  if (pd->file.fp != NULL) return 1;
+#endif
+#if MG_ENABLE_HTTP_CGI
+  if (pd->cgi.cgi_nc != NULL) return 1;
+#endif
+  (void) pd;
+  return 0;
+}
+
+/*
+ * mg_parse_http() for the message at the start of recv_mbuf. While its
+ * header block is incomplete, every recv would scan it from the start
+ * again, so the bytes checked already are remembered in the proto data and
+ * only the new ones are scanned until the block is complete.
+ */
+static int mg_http_parse_recv(struct mg_connection *nc,
+                              struct http_message *hm, int is_req) {
+  struct mg_http_proto_data *pd = mg_http_get_proto_data(nc);
+  struct mbuf *io = &nc->recv_mbuf;
+  int len;
+
+  /*
+   * The scanned bytes are only known to be the same ones if nothing but
+   * received data changed recv_mbuf since: a handler that removes data from
+   * its front makes the length differ from the one kept, and the scan start
+   * over.
+   */
+  if (pd != NULL && pd->hdr_scanned > 0 && io->len == pd->hdr_len) {
+    len = mg_http_scan(io->buf, io->len, pd->hdr_scanned, NULL);
+    if (len < 0) return len;
+    if (len == 0) {
+      pd->hdr_scanned = (io->len > 2 ? (int) io->len - 2 : 0);
+      pd->hdr_len = io->len;
+      return 0;
+    }
+  }
+  len = mg_parse_http(io->buf, io->len, hm, is_req);
+  if (len == 0 && io->len > 2) {
+    /* A '\n' in the last two bytes may yet turn out to end the block */
+    if (pd == NULL) pd = mg_http_create_proto_data(nc);
+    if (pd != NULL) {
+      pd->hdr_scanned = (int) io->len - 2;
+      pd->hdr_len = io->len;
+    }
+  } else if (pd != NULL) {
+    pd->hdr_scanned = 0;
+  }
+  return len;
+}
+
 /*
  * lx106 compiler has a bug (TODO(mkm) report and insert tracking bug here)
  * If a big structure is declared in a big function, lx106 gcc will make it
@@ -6379,11 +9664,15 @@ void mg_http_handler(struct mg_connection *nc, int ev,
 #endif /* __XTENSA__ */
   struct mg_http_proto_data *pd = mg_http_get_proto_data(nc);
   struct mbuf *io = &nc->recv_mbuf;
-  int req_len;
+  int req_len, num_queued;
   const int is_req = (nc->listener != NULL);
 #if MG_ENABLE_HTTP_WEBSOCKET
   struct mg_str *vec;
 #endif
+  if (ev == MG_EV_RECV && pd != NULL) {
+    /* Appended behind the scanned bytes, before any handler can remove some */
+    pd->hdr_len += *(int *) ev_data;
+  }
   if (ev == MG_EV_CLOSE) {
 #if MG_ENABLE_HTTP_CGI
     /* Close associated CGI forwarder connection */
@@ -6438,25 +9727,63 @@ void mg_http_handler(struct mg_connection *nc, int ev,
 
   mg_call(nc, nc->handler, nc->user_data, ev, ev_data);
 
+  if (is_req && ev == MG_EV_ACCEPT) {
+    mg_set_idle(nc, MG_HTTP_IDLE_HEADER);
+  } else if (ev == MG_EV_SEND &&
+             (nc->idle_class == MG_HTTP_IDLE_KEEP_ALIVE ||
+              (is_req && nc->idle_class == 0 && pd != NULL &&
+               !(nc->flags & MG_F_IS_WEBSOCKET) &&
+               !mg_http_is_responding(pd)))) {
+    /* Still sending, or the file being streamed is through */
+    mg_set_idle(nc, MG_HTTP_IDLE_KEEP_ALIVE);
+#if MG_ENABLE_HTTP_IDLE_RELEASE
+    mg_http_release_idle_proto_data(nc); /* Once a file is through */
+    pd = mg_http_get_proto_data(nc);
+#endif
+  }
+
 #if MG_ENABLE_HTTP_STREAMING_MULTIPART
   if (pd != NULL && pd->mp_stream.boundary != NULL &&
       (ev == MG_EV_RECV || ev == MG_EV_POLL)) {
     if (ev == MG_EV_RECV) {
+      if (is_req) mg_set_idle(nc, MG_HTTP_IDLE_BODY);
       pd->rcvd += *(int *) ev_data;
       mg_http_multipart_continue(nc);
     } else if (pd->mp_stream.data_avail) {
       /* Try re-delivering the data. */
       mg_http_multipart_continue(nc);
     }
+    pd = mg_http_get_proto_data(nc);
+    if (pd != NULL && pd->mp_stream.data_avail) mg_want_poll(nc);
     return;
   }
 #endif /* MG_ENABLE_HTTP_STREAMING_MULTIPART */
 
+  /*
+   * Pipelined requests wait in recv_mbuf while a response takes more events
+   * (or after MG_MAX_HTTP_PIPELINE of them in a row), so that responses go
+   * out in order. Once it is through, they are dispatched from here.
+   */
+  if ((ev == MG_EV_SEND || ev == MG_EV_POLL) && pd != NULL && pd->queued &&
+      !mg_http_is_responding(pd) &&
+      !(nc->flags & (MG_F_SEND_AND_CLOSE | MG_F_CLOSE_IMMEDIATELY))) {
+    pd->queued = 0;
+    num_queued = (int) io->len;
+    ev = MG_EV_RECV;
+    ev_data = &num_queued;
+  }
+
   if (ev == MG_EV_RECV) {
     struct mg_str *s;
+    int dispatched = 0;
+
+    if (pd != NULL && io->len > 0 && mg_http_is_responding(pd)) {
+      pd->queued = 1;
+      return;
+    }
 
   again:
-    req_len = mg_parse_http(io->buf, io->len, hm, is_req);
+    req_len = mg_http_parse_recv(nc, hm, is_req);
 
     if (req_len > 0) {
       /* New request - new proto data */
@@ -6465,14 +9792,17 @@ void mg_http_handler(struct mg_connection *nc, int ev,
     }
 
     if (req_len > 0 &&
-        (s = mg_get_http_header(hm, "Transfer-Encoding")) != NULL &&
+        (s = mg_http_indexed_header(hm, MG_HTTP_HDR_TRANSFER_ENCODING)) !=
+            NULL &&
         mg_vcasecmp(s, "chunked") == 0) {
       mg_handle_chunked(nc, hm, io->buf + req_len, io->len - req_len);
     }
 
 #if MG_ENABLE_HTTP_STREAMING_MULTIPART
-    if (req_len > 0 && (s = mg_get_http_header(hm, "Content-Type")) != NULL &&
+    if (req_len > 0 &&
+        (s = mg_http_indexed_header(hm, MG_HTTP_HDR_CONTENT_TYPE)) != NULL &&
         s->len >= 9 && strncmp(s->p, "multipart", 9) == 0) {
+      if (is_req) mg_set_idle(nc, MG_HTTP_IDLE_BODY);
       mg_http_multipart_begin(nc, hm, req_len);
       mg_http_multipart_continue(nc);
       return;
@@ -6485,19 +9815,23 @@ void mg_http_handler(struct mg_connection *nc, int ev,
       DBG(("invalid request"));
       nc->flags |= MG_F_CLOSE_IMMEDIATELY;
     } else if (req_len == 0) {
-      /* Do nothing, request is not yet fully buffered */
+      /* Request is not yet fully buffered, the header deadline runs on */
+      if (is_req && nc->idle_class != MG_HTTP_IDLE_HEADER) {
+        mg_set_idle(nc, MG_HTTP_IDLE_HEADER);
+      }
     }
 #if MG_ENABLE_HTTP_WEBSOCKET
     else if (nc->listener == NULL && (nc->flags & MG_F_IS_WEBSOCKET)) {
       /* We're websocket client, got handshake response from server. */
       DBG(("%p WebSocket upgrade code %d", nc, hm->resp_code));
       if (hm->resp_code == 101 &&
-          mg_get_http_header(hm, "Sec-WebSocket-Accept")) {
+          mg_http_indexed_header(hm, MG_HTTP_HDR_SEC_WEBSOCKET_ACCEPT)) {
         /* TODO(lsm): check the validity of accept Sec-WebSocket-Accept */
         mg_call(nc, nc->handler, nc->user_data, MG_EV_WEBSOCKET_HANDSHAKE_DONE,
                 hm);
         mbuf_remove(io, req_len);
         nc->proto_handler = mg_ws_handler;
+        mg_ws_allow_poll(nc);
         mg_ws_handler(nc, MG_EV_RECV, ev_data MG_UD_ARG(user_data));
       } else {
         mg_call(nc, nc->handler, nc->user_data, MG_EV_WEBSOCKET_HANDSHAKE_DONE,
@@ -6506,13 +9840,16 @@ void mg_http_handler(struct mg_connection *nc, int ev,
         mbuf_remove(io, req_len);
       }
     } else if (nc->listener != NULL &&
-               (vec = mg_get_http_header(hm, "Sec-WebSocket-Key")) != NULL) {
+               (vec = mg_http_indexed_header(
+                    hm, MG_HTTP_HDR_SEC_WEBSOCKET_KEY)) != NULL) {
       struct mg_http_endpoint *ep;
 
       /* This is a websocket request. Switch protocol handlers. */
       mbuf_remove(io, req_len);
       nc->proto_handler = mg_ws_handler;
       nc->flags |= MG_F_IS_WEBSOCKET;
+      mg_ws_allow_poll(nc);
+      mg_set_idle(nc, 0); /* Websocket has pings for that */
 
       /*
        * If we have a handler set up with mg_register_http_endpoint(),
@@ -6542,7 +9879,17 @@ void mg_http_handler(struct mg_connection *nc, int ev,
 #endif /* MG_ENABLE_HTTP_WEBSOCKET */
     else if (hm->message.len > pd->rcvd) {
       /* Not yet received all HTTP body, deliver MG_EV_HTTP_CHUNK */
+      if (is_req) mg_set_idle(nc, MG_HTTP_IDLE_BODY);
       deliver_chunk(nc, hm, req_len);
+      if (!(nc->flags & MG_F_DELETE_CHUNK) &&
+          mg_http_indexed_header(hm, MG_HTTP_HDR_CONTENT_LENGTH) != NULL) {
+        /* The body is being buffered, make room for (the start of) the rest */
+        size_t left = hm->message.len - pd->rcvd;
+        if (left > MG_HTTP_MAX_BODY_RESERVE) left = MG_HTTP_MAX_BODY_RESERVE;
+        if (io->len + left <= nc->recv_mbuf_limit) {
+          mg_io_buf_reserve(nc->mgr, io, left);
+        }
+      }
       if (nc->recv_mbuf_limit > 0 && nc->recv_mbuf.len >= nc->recv_mbuf_limit) {
         LOG(LL_ERROR, ("%p recv buffer (%lu bytes) exceeds the limit "
                        "%lu bytes, and not drained, closing",
@@ -6552,7 +9899,7 @@ void mg_http_handler(struct mg_connection *nc, int ev,
       }
     } else {
       /* We did receive all HTTP body. */
-      int request_done = 1;
+      int request_done;
       int trigger_ev = nc->listener ? MG_EV_HTTP_REQUEST : MG_EV_HTTP_REPLY;
       char addr[32];
       mg_sock_addr_to_str(&nc->sa, addr, sizeof(addr),
@@ -6564,18 +9911,22 @@ void mg_http_handler(struct mg_connection *nc, int ev,
       mg_http_call_endpoint_handler(nc, trigger_ev, hm);
       mbuf_remove(io, hm->message.len);
       pd->rcvd -= hm->message.len;
-#if MG_ENABLE_FILESYSTEM
-      /* We don't have a generic mechanism of communicating that we are done
-       * responding to a request (should probably add one). But if we are
-       * serving
-       * a file, we are definitely not done. */
-      if (pd->file.fp != NULL) request_done = 0;
-#endif
-#if MG_ENABLE_HTTP_CGI
-      /* If this is a CGI request, we are not done either. */
-      if (pd->cgi.cgi_nc != NULL) request_done = 0;
+      request_done = !mg_http_is_responding(pd);
+      if (io->len > 0) {
+        if (request_done && ++dispatched < MG_MAX_HTTP_PIPELINE) goto again;
+        /* Give other connections a turn, see above for the rest */
+        pd->queued = 1;
+        if (request_done) mg_want_poll(nc);
+      }
+      if (is_req && !request_done) {
+        /* A CGI may be silent for long, keep-alive is armed once it is done */
+        mg_set_idle(nc, 0);
+      } else if (is_req && io->len == 0) {
+        mg_set_idle(nc, MG_HTTP_IDLE_KEEP_ALIVE);
+#if MG_ENABLE_HTTP_IDLE_RELEASE
+        mg_http_release_idle_proto_data(nc);
 #endif
-      if (request_done && io->len > 0) goto again;
+      }
     }
   }
 }
@@ -6597,7 +9948,7 @@ static void mg_http_multipart_begin(struct mg_connection *nc,
   char *boundary = boundary_buf;
   int boundary_len;
 
-  ct = mg_get_http_header(hm, "Content-Type");
+  ct = mg_http_indexed_header(hm, MG_HTTP_HDR_CONTENT_TYPE);
   if (ct == NULL) {
     /* We need more data - or it isn't multipart mesage */
     goto exit_mp;
@@ -7129,7 +10480,7 @@ void mg_http_serve_file_internal(struct mg_connection *nc,
     char etag[50], current_time[50], last_modified[50], range[70];
     time_t t = (time_t) mg_time();
     int64_t r1 = 0, r2 = 0, cl = st.st_size;
-    struct mg_str *range_hdr = mg_get_http_header(hm, "Range");
+    struct mg_str *range_hdr = mg_get_http_header_id(hm, MG_HTTP_HDR_RANGE);
     int n, status_code = 200;
 
     /* Handle Range header */
@@ -7165,7 +10516,8 @@ void mg_http_serve_file_internal(struct mg_connection *nc,
 
 #if !MG_DISABLE_HTTP_KEEP_ALIVE
     {
-      struct mg_str *conn_hdr = mg_get_http_header(hm, "Connection");
+      struct mg_str *conn_hdr =
+          mg_get_http_header_id(hm, MG_HTTP_HDR_CONNECTION);
       if (conn_hdr != NULL) {
         pd->file.keepalive = (mg_vcasecmp(conn_hdr, "keep-alive") == 0);
       } else {
@@ -7196,6 +10548,12 @@ void mg_http_serve_file_internal(struct mg_connection *nc,
                 encoding.p);
     }
     mg_send(nc, "\r\n", 2);
+    /* The file goes out in pieces of up to MG_MAX_HTTP_SEND_MBUF */
+    if (nc->send_mbuf.len < MG_MAX_HTTP_SEND_MBUF) {
+      size_t first = MG_MAX_HTTP_SEND_MBUF - nc->send_mbuf.len;
+      mg_io_buf_reserve(nc->mgr, &nc->send_mbuf,
+                        (int64_t) first < cl ? first : (size_t) cl);
+    }
     pd->file.cl = cl;
     pd->file.type = DATA_FILE;
     mg_http_transfer_file_data(nc);
@@ -7312,6 +10670,17 @@ void mg_send_http_chunk(struct mg_connection *nc, const char *buf, size_t len) {
   mg_send(nc, "\r\n", 2);
 }
 
+void mg_send_http_chunk_ref(struct mg_connection *nc, const char *buf,
+                            size_t len, void (*free_cb)(void *buf)) {
+  char chunk_size[50];
+  int n;
+
+  n = snprintf(chunk_size, sizeof(chunk_size), "%lX\r\n", (unsigned long) len);
+  mg_send(nc, chunk_size, n);
+  mg_send_ref(nc, buf, len, free_cb);
+  mg_send(nc, "\r\n", 2);
+}
+
 void mg_printf_http_chunk(struct mg_connection *nc, const char *fmt, ...) {
   char mem[MG_VPRINTF_BUFFER_SIZE], *buf = mem;
   int len;
@@ -7428,7 +10797,7 @@ int mg_http_parse_header(struct mg_str *hdr, const char *var_name, char *buf,
 
 int mg_get_http_basic_auth(struct http_message *hm, char *user, size_t user_len,
                            char *pass, size_t pass_len) {
-  struct mg_str *hdr = mg_get_http_header(hm, "Authorization");
+  struct mg_str *hdr = mg_get_http_header_id(hm, MG_HTTP_HDR_AUTHORIZATION);
   if (hdr == NULL) return -1;
   return mg_parse_http_basic_auth(hdr, user, user_len, pass, pass_len);
 }
@@ -7570,7 +10939,7 @@ int mg_http_check_digest_auth(struct http_message *hm, const char *auth_domain,
 
   /* Parse "Authorization:" header, fail fast on parse error */
   if (hm == NULL || fp == NULL ||
-      (hdr = mg_get_http_header(hm, "Authorization")) == NULL ||
+      (hdr = mg_get_http_header_id(hm, MG_HTTP_HDR_AUTHORIZATION)) == NULL ||
       mg_http_parse_header2(hdr, "username", &username, sizeof(username_buf)) ==
           0 ||
       mg_http_parse_header2(hdr, "cnonce", &cnonce, sizeof(cnonce_buf)) == 0 ||
@@ -8023,7 +11392,7 @@ MG_INTERNAL int mg_uri_to_local_path(struct http_message *hm,
 #else
     const char *rewrites = "";
 #endif
-    struct mg_str *hh = mg_get_http_header(hm, "Host");
+    struct mg_str *hh = mg_get_http_header_id(hm, MG_HTTP_HDR_HOST);
     struct mg_str a, b;
     /* Check rewrites first. */
     while ((rewrites = mg_next_comma_list_entry(rewrites, &a, &b)) != NULL) {
@@ -8205,11 +11574,12 @@ MG_INTERNAL time_t mg_parse_date_string(const char *datetime) {
 
 MG_INTERNAL int mg_is_not_modified(struct http_message *hm, cs_stat_t *st) {
   struct mg_str *hdr;
-  if ((hdr = mg_get_http_header(hm, "If-None-Match")) != NULL) {
+  if ((hdr = mg_get_http_header_id(hm, MG_HTTP_HDR_IF_NONE_MATCH)) != NULL) {
     char etag[64];
     mg_http_construct_etag(etag, sizeof(etag), st);
     return mg_vcasecmp(hdr, etag) == 0;
-  } else if ((hdr = mg_get_http_header(hm, "If-Modified-Since")) != NULL) {
+  } else if ((hdr = mg_get_http_header_id(
+                  hm, MG_HTTP_HDR_IF_MODIFIED_SINCE)) != NULL) {
     return st->st_mtime <= mg_parse_date_string(hdr->p);
   } else {
     return 0;
@@ -8415,7 +11785,7 @@ void mg_serve_http(struct mg_connection *nc, struct http_message *hm,
 
   /* Close connection for non-keep-alive requests */
   if (mg_vcmp(&hm->proto, "HTTP/1.1") != 0 ||
-      ((hdr = mg_get_http_header(hm, "Connection")) != NULL &&
+      ((hdr = mg_get_http_header_id(hm, MG_HTTP_HDR_CONNECTION)) != NULL &&
        mg_vcmp(hdr, "keep-alive") != 0)) {
 #if 0
     nc->flags |= MG_F_SEND_AND_CLOSE;
@@ -8743,6 +12113,9 @@ void mg_register_http_endpoint_opt(struct mg_connection *nc,
 #endif
   new_ep->next = pd->endpoints;
   pd->endpoints = new_ep;
+  /* Compiled again on the next lookup */
+  mg_http_routes_release(pd->routes);
+  pd->routes = NULL;
 }
 
 static void mg_http_call_endpoint_handler(struct mg_connection *nc, int ev,
@@ -9114,8 +12487,8 @@ static void mg_prepare_cgi_environment(struct mg_connection *nc,
   mg_addenv(blk, "HTTPS=off");
 #endif
 
-  if ((h = mg_get_http_header((struct http_message *) hm, "Content-Type")) !=
-      NULL) {
+  if ((h = mg_get_http_header_id((struct http_message *) hm,
+                                 MG_HTTP_HDR_CONTENT_TYPE)) != NULL) {
     mg_addenv(blk, "CONTENT_TYPE=%.*s", (int) h->len, h->p);
   }
 
@@ -9124,8 +12497,8 @@ static void mg_prepare_cgi_environment(struct mg_connection *nc,
               hm->query_string.p);
   }
 
-  if ((h = mg_get_http_header((struct http_message *) hm, "Content-Length")) !=
-      NULL) {
+  if ((h = mg_get_http_header_id((struct http_message *) hm,
+                                 MG_HTTP_HDR_CONTENT_LENGTH)) != NULL) {
     mg_addenv(blk, "CONTENT_LENGTH=%.*s", (int) h->len, h->p);
   }
 
@@ -9204,6 +12577,7 @@ static void mg_cgi_ev_handler(struct mg_connection *cgi_nc, int ev,
         } else {
           struct http_message hm;
           struct mg_str *h;
+          memset(&hm, 0, sizeof(hm));
           mg_http_parse_headers(io->buf, io->buf + io->len, io->len, &hm);
           if (mg_get_http_header(&hm, "Location") != NULL) {
             mg_printf(nc, "%s", "HTTP/1.1 302 Moved\r\n");
@@ -9735,7 +13109,8 @@ MG_INTERNAL void mg_handle_put(struct mg_connection *nc, const char *path,
                                struct http_message *hm) {
   struct mg_http_proto_data *pd = mg_http_get_proto_data(nc);
   cs_stat_t st;
-  const struct mg_str *cl_hdr = mg_get_http_header(hm, "Content-Length");
+  const struct mg_str *cl_hdr =
+      mg_get_http_header_id(hm, MG_HTTP_HDR_CONTENT_LENGTH);
   int rc, status_code = mg_stat(path, &st) == 0 ? 200 : 201;
 
   mg_http_free_proto_data_file(&pd->file);
@@ -9973,6 +13348,13 @@ static int mg_deliver_websocket_data(struct mg_connection *nc) {
               nc->recv_mbuf.len - wsd->reass_len - cleanup_len);
       nc->recv_mbuf.len -= cleanup_len;
     }
+  } else if (header_len > 0) {
+    /* Header is in, make room for (the start of) the rest of the frame */
+    uint64_t left = frame_len - new_data_len;
+    if (left > MG_HTTP_MAX_BODY_RESERVE) left = MG_HTTP_MAX_BODY_RESERVE;
+    if (nc->recv_mbuf.len + left <= nc->recv_mbuf_limit) {
+      mg_io_buf_reserve(nc->mgr, &nc->recv_mbuf, (size_t) left);
+    }
   }
 
   return ok;
@@ -10036,6 +13418,9 @@ static void mg_send_ws_header(struct mg_connection *nc, int op, size_t len,
     header_len = 10;
   }
 
+  /* Header, mask and payload in one allocation */
+  mg_io_buf_reserve(nc->mgr, &nc->send_mbuf, header_len + 4 + len);
+
   /* client connections enable masking */
   if (nc->listener == NULL) {
     header[1] |= 1 << 7; /* set masking flag */
@@ -10110,6 +13495,15 @@ void mg_printf_websocket_frame(struct mg_connection *nc, int op,
   }
 }
 
+/*
+ * Idle websockets are pinged on MG_EV_POLL, which MG_F_NO_POLL (inherited
+ * from the listener) would stop: upgraded connections drop the flag.
+ */
+MG_INTERNAL void mg_ws_allow_poll(struct mg_connection *nc) {
+  nc->flags &= ~MG_F_NO_POLL;
+  mg_poll_set_add(nc);
+}
+
 MG_INTERNAL void mg_ws_handler(struct mg_connection *nc, int ev,
                                void *ev_data MG_UD_ARG(void *user_data)) {
   mg_call(nc, nc->handler, nc->user_data, ev, ev_data);
@@ -10170,7 +13564,7 @@ MG_INTERNAL void mg_ws_handshake(struct mg_connection *nc,
             "Upgrade: websocket\r\n"
             "Connection: Upgrade\r\n");
 
-  s = mg_get_http_header(hm, "Sec-WebSocket-Protocol");
+  s = mg_get_http_header_id(hm, MG_HTTP_HDR_SEC_WEBSOCKET_PROTOCOL);
   if (s != NULL) {
     mg_printf(nc, "Sec-WebSocket-Protocol: %.*s\r\n", (int) s->len, s->p);
   }
@@ -14384,7 +17778,7 @@ time_t mg_sl_if_poll(struct mg_iface *iface, int timeout_ms) {
   struct SlTimeval_t tv;
   SlFdSet_t read_set, write_set, err_set;
   sock_t max_fd = INVALID_SOCKET;
-  int num_fds, num_ev = 0, num_timers = 0;
+  int num_fds, num_ev = 0;
 
   SL_SOCKET_FD_ZERO(&read_set);
   SL_SOCKET_FD_ZERO(&write_set);
@@ -14394,7 +17788,6 @@ time_t mg_sl_if_poll(struct mg_iface *iface, int timeout_ms) {
    * Note: it is ok to have connections with sock == INVALID_SOCKET in the list,
    * e.g. timer-only "connections".
    */
-  min_timer = 0;
   for (nc = mgr->active_connections, num_fds = 0; nc != NULL; nc = tmp) {
     tmp = nc->next;
 
@@ -14415,20 +17808,14 @@ time_t mg_sl_if_poll(struct mg_iface *iface, int timeout_ms) {
         if (max_fd == INVALID_SOCKET || nc->sock > max_fd) max_fd = nc->sock;
       }
     }
-
-    if (nc->ev_timer_time > 0) {
-      if (num_timers == 0 || nc->ev_timer_time < min_timer) {
-        min_timer = nc->ev_timer_time;
-      }
-      num_timers++;
-    }
   }
 
   /*
    * If there is a timer to be fired earlier than the requested timeout,
    * adjust the timeout.
    */
-  if (num_timers > 0) {
+  min_timer = mg_mgr_min_timer(mgr);
+  if (min_timer > 0) {
     double timer_timeout_ms = (min_timer - mg_time()) * 1000 + 1 /* rounding */;
     if (timer_timeout_ms < timeout_ms) {
       timeout_ms = timer_timeout_ms;
@@ -15668,8 +19055,6 @@ time_t mg_lwip_if_poll(struct mg_iface *iface, int timeout_ms) {
   int n = 0;
   double now = mg_time();
   struct mg_connection *nc, *tmp;
-  double min_timer = 0;
-  int num_timers = 0;
 #if 0
   DBG(("begin poll @%u", (unsigned int) (now * 1000)));
 #endif
@@ -15684,12 +19069,6 @@ time_t mg_lwip_if_poll(struct mg_iface *iface, int timeout_ms) {
         cs->pcb.tcp->unsent != NULL) {
       mg_lwip_netif_run_on_tcpip(tcp_output_tcpip, cs->pcb.tcp);
     }
-    if (nc->ev_timer_time > 0) {
-      if (num_timers == 0 || nc->ev_timer_time < min_timer) {
-        min_timer = nc->ev_timer_time;
-      }
-      num_timers++;
-    }
 
     if (nc->sock != INVALID_SOCKET) {
       if (mg_lwip_if_can_send(nc, cs)) {
@@ -15708,9 +19087,9 @@ time_t mg_lwip_if_poll(struct mg_iface *iface, int timeout_ms) {
     }
   }
 #if 0
-  DBG(("end poll @%u, %d conns, %d timers (min %u), next in %d ms",
-       (unsigned int) (now * 1000), n, num_timers,
-       (unsigned int) (min_timer * 1000), timeout_ms));
+  DBG(("end poll @%u, %d conns, next timer %u, next in %d ms",
+       (unsigned int) (now * 1000), n,
+       (unsigned int) (mg_mgr_min_timer(mgr) * 1000), timeout_ms));
 #endif
   (void) timeout_ms;
   return now;
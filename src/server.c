@@ -16,6 +16,7 @@
  */
 
 /* user includes */
+#include "my_reactor.h"
 #include "my_config.h"
 #include "my_endpoint.h"
 #include "my_log.h"
@@ -31,54 +32,60 @@ static const char *s_ssl_key = HTTPS_SSL_KEY;
 static const char *s_http_port = HTTP_SVC_PORT;
 #endif /* MG_ENABLE_SSL */
 
+/* ------------------------- private interface ------------------------ */
+
+// @brief:  set up a listener, called once per reactor
+static void server_setup(struct mg_connection *nc) {
+#if defined(MG_ENABLE_HTTP_STREAMING_MULTIPART) && MG_ENABLE_HTTP_STREAMING_MULTIPART
+    // register new endpoint: /upload
+    mg_register_http_endpoint(nc, "/upload", handle_upload MG_UD_ARG(NULL));
+#endif // HTTP MULTIPART
+
+    // Set up HTTP server parameters
+    mg_set_protocol_http_websocket(nc);
+}
+
 /* ------------------------- public interface ------------------------- */
 
+// usage: http_server [port] [reactors(0: one per cpu)] [pin(1: pin reactors to cpus)]
 int main(int argc, char *argv[]) {
     if (1 < argc && argv[1]) {
         s_http_port = argv[1];
     }
 
-    struct mg_mgr mgr;
-    struct mg_connection *nc;
+    struct my_reactor_opts opts;
 
-    mg_mgr_init(&mgr, NULL);
+    memset(&opts, 0, sizeof(opts));
+    opts.port = s_http_port;
+    opts.num_reactors = (2 < argc) ? atoi(argv[2]) : 1;
+    opts.pin_cpus = (3 < argc) ? atoi(argv[3]) : 0;
+    opts.handler = ev_handler;
+    opts.setup = server_setup;
+#if MG_ENABLE_NET_IF_IO_URING
+    // use io_uring, falls back to epoll/select() on older kernels
+    opts.iface = &mg_io_uring_iface_vtable;
+#elif MG_ENABLE_NET_IF_EPOLL
+    // use epoll instead of select() on linux
+    opts.iface = &mg_epoll_iface_vtable;
+#endif
+    // small responses: don't let Nagle wait for the client's delayed ack
+    opts.bind_opts.sock_opts.nodelay = 1;
+    // wake up only once the request has arrived, and allow TFO handshakes
+    opts.bind_opts.sock_opts.defer_accept = 1;
+    opts.bind_opts.sock_opts.fastopen = 256;
+    // write responses from the handler, not one poll iteration later;
+    // no MG_EV_POLL for idle keep-alive clients, nothing here needs it
+    // (websocket connections drop the flag when upgraded, for their pings)
+    opts.bind_opts.flags |= MG_F_EAGER_SEND | MG_F_NO_POLL;
 #if MG_ENABLE_SSL
-    struct mg_bind_opts bind_opts;
-    const char *err;
-
-    memset(&bind_opts, 0, sizeof(bind_opts));
-    bind_opts.ssl_cert = s_ssl_cert;
-    bind_opts.ssl_key = s_ssl_key;
-    bind_opts.error_string = &err;
+    opts.bind_opts.ssl_cert = s_ssl_cert;
+    opts.bind_opts.ssl_key = s_ssl_key;
     log_verbose("Starting SSL server on port %s, cert from %s, key from %s\n",
-        s_http_port, bind_opts.ssl_cert, bind_opts.ssl_key);
-    nc = mg_bind_opt(&mgr, s_http_port, ev_handler, bind_opts);
-    if (nc == NULL) {
-        log_err("Failed to create listener: %s\n", err);
-        return 1;
-    }
+        s_http_port, opts.bind_opts.ssl_cert, opts.bind_opts.ssl_key);
 #else
     log_verbose("Starting web server on port %s\n", s_http_port);
-    // create a connection to input address
-    nc = mg_bind(&mgr, s_http_port, ev_handler);
-    if (nc == NULL) {
-        log_err("Failed to create listener\n");
-        return 1;
-    }
 #endif /* MG_ENABLE_SSL */
 
-#if defined(MG_ENABLE_HTTP_STREAMING_MULTIPART) && MG_ENABLE_HTTP_STREAMING_MULTIPART
-    // register new endpoint: /upload
-    mg_register_http_endpoint(nc, "/upload", handle_upload MG_UD_ARG(NULL));
-#endif // HTTP MULTIPART
-
-    // Set up HTTP server parameters
-    mg_set_protocol_http_websocket(nc);
-
-    for (;;) {
-        mg_mgr_poll(&mgr, 1000);
-    }
-    mg_mgr_free(&mgr);
-
-    return 0;
+    // run the event loop(s), doesn't return unless listeners can't be created
+    return my_reactor_run(&opts);
 }